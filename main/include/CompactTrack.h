@@ -0,0 +1,79 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "RingBuffer.h"
+#include "proto/ConnectPb.h"
+
+namespace cspot {
+
+/**
+ * @brief Compact record of a context track. Track and episode URIs are just a
+ * prefix plus a base62 GID, so only the 16 byte GID is kept. The UID, and URIs
+ * that don't have that form, live in the TrackArena the record was interned in.
+ */
+struct CompactTrack {
+  enum class Kind : uint8_t {
+    None,     // No URI
+    Track,    // spotify:track:<GID>
+    Episode,  // spotify:episode:<GID>
+    Raw,      // Any other URI, stored in the arena
+  };
+
+  std::array<uint8_t, 16> gid{};
+  cspot_proto::ContextIndex index;
+
+  uint32_t uidOffset = 0;
+  uint32_t uriOffset = 0;
+  uint16_t uidLength = 0;
+  uint16_t uriLength = 0;
+  Kind kind = Kind::None;
+};
+
+/**
+ * @brief Per-context string storage for CompactTrack records. Strings are
+ * appended to a single buffer, and only materialised when a track is handed
+ * out.
+ */
+class TrackArena {
+ public:
+  // Large enough for "spotify:episode:" followed by 22 base62 characters
+  using UriBuffer = std::array<char, 40>;
+
+  TrackArena() = default;
+
+  CompactTrack intern(std::string_view uid, std::string_view uri,
+                      const cspot_proto::ContextIndex& index);
+
+  // Copies a track interned in another arena into this one
+  CompactTrack intern(const CompactTrack& track, const TrackArena& source);
+
+  std::string_view uid(const CompactTrack& track) const;
+
+  // Formats the URI into the buffer, unless it is stored in the arena
+  std::string_view uri(const CompactTrack& track, UriBuffer& buffer) const;
+
+  cspot_proto::ContextTrack materialize(const CompactTrack& track) const;
+
+  /**
+   * @brief Moves the strings of the live tracks into a fresh buffer, and
+   * rewrites their offsets. Does nothing while at least half the arena is live.
+   * Records not in liveTracks are invalid afterwards.
+   */
+  void compact(RingBuffer<CompactTrack>& liveTracks);
+
+  void clear() { buffer.clear(); }
+
+  size_t size() const { return buffer.size(); }
+
+ private:
+  std::string buffer;
+
+  // Appends the string, returns false if it is too long for a record
+  bool append(std::string_view text, uint32_t& offset, uint16_t& length);
+};
+}  // namespace cspot
@@ -1,14 +1,19 @@
 #pragma once
 
 // Protobufs
+#include <optional>
 #include <random>
+#include <vector>
+#include "PlaybackClock.h"
 #include "TrackProvider.h"
 #include "bell/Result.h"
 #include "connect.pb.h"
-#include <cJSON.h>
 
 #include "SessionContext.h"
+#include "api/DealerMessage.h"
 #include "api/SpClient.h"
+#include "events/AsyncTask.h"
+#include "events/EventLoop.h"
 
 namespace cspot {
 
@@ -17,26 +22,108 @@ class ConnectStateHandler {
   ConnectStateHandler(std::shared_ptr<SessionContext> sessionContext,
                       std::shared_ptr<SpClient> spClient);
 
-  bell::Result<> handlePlayerCommand(cJSON* messageJson);
+  // Player command validated and decoded, ready to be applied
+  struct PlayerCommand {
+    enum class Type { TRANSFER, SKIP_NEXT };
 
-  bell::Result<> putState(
+    Type type;
+    cspot_proto::TransferState transferState;  // Only set for TRANSFER
+  };
+
+  /**
+   * @brief Validates and decodes a player command without touching the
+   * network, so the request can be acknowledged right away.
+   */
+  bell::Result<PlayerCommand> acceptPlayerCommand(const DealerMessage& request);
+
+  /**
+   * @brief Applies an accepted command. A failure is reported to the other
+   * devices as a state update, as the command has already been acknowledged.
+   * The request must outlive the task.
+   */
+  AsyncTask<> applyPlayerCommand(PlayerCommand command,
+                                 const DealerMessage& request);
+
+  /**
+   * @brief Marks the connect state as changed, on the loop thread. Changes are
+   * published after a short debounce window, so a burst of them results in a
+   * single PUT. Reasons that can't wait, like NEW_CONNECTION, flush right away.
+   *
+   * @param reason merged with the pending one, the more important one is sent
+   */
+  void markStateDirty(
       PutStateReason reason = PutStateReason_PLAYER_STATE_CHANGED);
 
+  // Publishes pending changes now, or once the PUT in flight completes
+  void flushState();
+
+  /**
+   * @brief Keeps the server's view of the cluster pushed over the dealer, on
+   * the loop thread. Detects another device taking over playback.
+   */
+  void handleClusterUpdate(cspot_proto::ClusterUpdate&& update);
+
+  // Playback position right now, in ms
+  int64_t currentPositionMs() const;
+
  private:
   const char* LOG_TAG = "ConnectStateHandler";
 
+  // Time changes are collected for, before they get published
+  static constexpr uint32_t putStateDebounceMs = 200;
+
   std::shared_ptr<SessionContext> sessionContext;
   std::shared_ptr<SpClient> spClient;
   std::shared_ptr<TrackProvider> trackProvider;
 
+  // Bumped on every transfer, so a slower older one can't override a newer one
+  uint32_t transferGeneration = 0;
 
   // Holds the protobuf state
   cspot_proto::PutStateRequest putStateRequestProto;
 
+  // Source of the published position, in server time
+  PlaybackClock playbackClock;
+
+  // Publishing state, only touched on the loop thread
+  bool stateDirty = false;
+  PutStateReason pendingReason = PutStateReason_UNKNOWN_PUT_STATE_REASON;
+  bool flushScheduled = false;
+  EventLoop::TimerHandle flushTimer;
+
+  // Last cluster pushed by the server, empty until the first update
+  std::optional<cspot_proto::Cluster> cluster;
+
+  // Set once the cluster lists us as active, after we became active
+  bool activeConfirmed = false;
+
+  // Hash of the last PUT's content, unset until a PUT went through
+  std::optional<uint32_t> publishedStateHash;
+
+  // Writes the playback clock's anchor to the player state
+  void updatePlaybackPosition();
+
+  // True if the cluster already holds the state a PUT would send
+  bool serverHasState(uint32_t stateHash) const;
+
+  // At most one PUT is in flight, a flush requested meanwhile waits for it
+  bool putInFlight = false;
+  bool flushAfterPut = false;
+
+  // Size of the last encoded request, so the next one is allocated once
+  size_t encodedStateSize = 0;
+
+  // Expires with the handler, guards timers and PUT completions still queued
+  std::shared_ptr<bool> lifetimeToken = std::make_shared<bool>(true);
+
+  void scheduleFlush();
+  void onPutStateDone(bell::Result<> result);
+
   void initialize();
 
-  bell::Result<> handleTransferCommand(std::string_view payloadDataStr,
-                                       cJSON* options);
+  AsyncTask<bell::Result<>> handleTransferCommand(
+      const cspot_proto::TransferState& transferState,
+      const DealerMessage::CommandOptions& options);
 
   bell::Result<> handleSkipNextCommand();
 };
@@ -1,15 +1,27 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <iostream>
+#include <memory>
 #include <string>
+#include "CompactTrack.h"
+#include "RingBuffer.h"
+#include "TrackIndex.h"
 #include "api/SpClient.h"
+#include "events/WorkerPool.h"
 #include "proto/ConnectPb.h"
-#include "tcb/span.hpp"
 
 namespace cspot {
 class ContextTrackResolver {
  public:
+  /**
+   * @param workerPool refills the track window in the background once fewer
+   * than trackUpdateThreshold tracks are left on either side of the current
+   * one. Without it, refills block the caller.
+   */
   ContextTrackResolver(std::shared_ptr<SpClient> spClient,
+                       std::shared_ptr<WorkerPool> workerPool = nullptr,
                        uint32_t maxWindowSize = 32,
                        uint32_t trackUpdateThreshold = 8);
 
@@ -22,8 +34,15 @@ class ContextTrackResolver {
 
   bell::Result<cspot_proto::ContextTrack> getCurrentTrack();
 
-  tcb::span<cspot_proto::ContextTrack> previousTracks();
-  tcb::span<cspot_proto::ContextTrack> nextTracks();
+  using TrackView = RingBuffer<CompactTrack>::View;
+
+  TrackView previousTracks();
+  TrackView nextTracks();
+
+  // Expands a track returned by previousTracks() or nextTracks()
+  cspot_proto::ContextTrack materialize(const CompactTrack& track) const {
+    return trackArena.materialize(track);
+  }
 
   bell::Result<cspot_proto::ContextTrack> skipForward(
       const cspot_proto::ContextTrack& track);
@@ -31,9 +50,33 @@ class ContextTrackResolver {
   bell::Result<cspot_proto::ContextTrack> skipBackward(
       const cspot_proto::ContextTrack& track);
 
+  /**
+   * @brief Sets a handler run on the EventLoop thread once a background refill
+   * finished. The refill is merged by the next resolver call, or by
+   * collectPrefetch().
+   */
+  void setPrefetchHandler(std::function<void()> handler) {
+    prefetchHandler = std::move(handler);
+  }
+
+  /**
+   * @brief Merges a finished background refill into the cache, never waits
+   * for one. Returns whether anything was merged.
+   */
+  bool collectPrefetch();
+
+  // Never wait for a background refill, fail with
+  // errc::resource_unavailable_try_again while the window is still empty
   bell::Result<cspot_proto::ContextTrack> next();
   bell::Result<cspot_proto::ContextTrack> previous();
 
+  /**
+   * @brief Makes a cached track the current one, looked up by UID or URI.
+   * Fails if the track isn't in the cache.
+   */
+  bell::Result<cspot_proto::ContextTrack> skipTo(const std::string& uid,
+                                                 const std::string& uri);
+
   // Context tracks IDs or URIs can sometimes be missing or invalid
   struct TrackId {
     std::optional<std::string> uid = std::nullopt;
@@ -61,16 +104,6 @@ class ContextTrackResolver {
 
       return false;
     }
-
-    bool operator==(const cspot_proto::ContextTrack& other) const {
-      if (!other.uid.empty() && uid.has_value()) {
-        return uid.value() == other.uid;
-      }
-      if (!other.uri.empty() && uri.has_value()) {
-        return uri.value() == other.uri;
-      }
-      return false;
-    }
   };
 
   // Represents a resolved context page, can either link to a page URL or be a root context
@@ -101,20 +134,41 @@ class ContextTrackResolver {
     // Target track ID
     TrackId targetTrackId;
 
-    // Resolved context pages
-    std::vector<cspot_proto::ContextTrack> tracks;
+    // Resolved context pages, interned in arena
+    RingBuffer<CompactTrack> tracks;
+    TrackArena* arena = nullptr;
     std::optional<uint32_t> foundTrackIndex = std::nullopt;
 
     // Window size config
     uint32_t maxWindowSize = 0;
 
     FetchMode fetchMode = FetchMode::Replace;
+
+    // Page tracks are collected from, set once the target track is found
+    std::optional<uint32_t> pageIndex = std::nullopt;
+  };
+
+  /**
+   * @brief Fetch of the root context or of a single page. Owns everything the
+   * parse touches, so it can run on a worker while the cache is being served.
+   */
+  struct ContextFetch {
+    std::string url;  // Root context URL, or the page URL
+    bool isRoot = false;
+    uint32_t pageIndex = 0;
+
+    // Copy of the resolved pages, updated by the parse
+    std::vector<ResolvedContextPage> pages;
+
+    ContextTrackParseState parseState;
+    TrackArena arena;
   };
 
  private:
   const char* LOG_TAG = "ContextTrackResolver";
 
   std::shared_ptr<SpClient> spClient;
+  std::shared_ptr<WorkerPool> workerPool;
 
   // Root context URL, without "context://" prefix
   std::string rootContextUrl;
@@ -124,22 +178,55 @@ class ContextTrackResolver {
 
   uint32_t maxWindowSize;
   uint32_t trackUpdateThreshold;
+  uint32_t cacheCapacity;
 
-  // Contains state for the context track parser
-  ContextTrackParseState contextParseState;
   std::vector<ResolvedContextPage> resolvedContextPages;
 
-  std::vector<cspot_proto::ContextTrack> trackCache;
+  // Strings of trackCache
+  TrackArena trackArena;
+
+  // Sliding window of the context, holds at most cacheCapacity tracks
+  RingBuffer<CompactTrack> trackCache;
   std::optional<uint32_t> currentTrackInCacheIndex;
 
-bool prepareParseState();
+  // Maps UIDs and URIs to logical trackCache indexes, which stay valid while
+  // the window slides
+  TrackIndex trackCacheIndex;
 
-  void updateTracksFromParseState();
+  // Keep trackCacheIndex in sync, every trackCache change goes through these
+  void appendToCache(const std::vector<CompactTrack>& tracks);
+  void prependToCache(const std::vector<CompactTrack>& tracks);
+  void dropFromCacheFront(size_t amount);
+  void dropFromCacheBack(size_t amount);
+  void indexCachedTrack(size_t position);
+  void unindexCachedTrack(size_t position);
+
+  std::optional<uint32_t> findInCache(const TrackId& trackId) const;
+
+  // Same rules as TrackId::operator==, for a track in trackArena
+  bool isSameTrack(const TrackId& trackId, const CompactTrack& track) const;
+
+  // Refill running on a worker, shared with the job so either can go first
+  struct PendingFetch {
+    ContextFetch fetch;
+    bell::Result<> result;
+    std::atomic<bool> done = false;
+  };
+  std::shared_ptr<PendingFetch> pendingFetch;
+  std::function<void()> prefetchHandler;
 
   bell::Result<> ensureContextTracks();
 
-  bell::Result<> resolveRootContext();
+  // Starts a background refill if the window ran low, and none is running
+  void prefetchIfLow();
+
+  std::optional<ContextFetch> planRefill() const;
+  std::optional<ContextFetch> makeFetch(uint32_t pageIdx, uint32_t windowStart,
+                                        uint32_t windowEnd,
+                                        FetchMode mode) const;
 
-  bell::Result<> resolveContextPage(ResolvedContextPage& page);
+  void applyFetch(ContextFetch& fetch);
+
+  bell::Result<> resolveRootContext();
 };
 }  // namespace cspot
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+namespace cspot {
+
+/**
+ * @brief Streaming JSON writer over a fixed, caller-provided buffer. Never
+ * allocates, output that doesn't fit marks the writer as overflowed.
+ *
+ * Fixed-shape messages can be written as precomputed raw fragments, with only
+ * the changing values going through the escaping writer.
+ */
+class JsonWriter {
+ public:
+  JsonWriter(char* buffer, size_t capacity)
+      : buffer(buffer), capacity(capacity) {}
+
+  template <size_t N>
+  explicit JsonWriter(std::array<char, N>& buffer)
+      : JsonWriter(buffer.data(), N) {}
+
+  JsonWriter& beginObject();
+  JsonWriter& endObject();
+  JsonWriter& beginArray();
+  JsonWriter& endArray();
+
+  // Writes an object key, the value follows with any of the value writers
+  JsonWriter& key(std::string_view key);
+
+  JsonWriter& string(std::string_view value);
+  JsonWriter& number(int64_t value);
+  JsonWriter& boolean(bool value);
+
+  template <typename T>
+  JsonWriter& field(std::string_view name, T value) {
+    key(name);
+    if constexpr (std::is_same_v<T, bool>) {
+      return boolean(value);
+    } else if constexpr (std::is_integral_v<T>) {
+      return number(value);
+    } else {
+      return string(value);
+    }
+  }
+
+  // Appends already encoded JSON as is
+  JsonWriter& raw(std::string_view json);
+
+  // Appends the escaped contents of a string, without the quotes
+  JsonWriter& escaped(std::string_view value);
+
+  bool overflowed() const { return hasOverflowed; }
+  std::string_view view() const { return {buffer, size}; }
+
+ private:
+  // Nesting tracked for comma placement, deeper documents overflow
+  static constexpr size_t maxDepth = 32;
+
+  char* buffer;
+  size_t capacity;
+  size_t size = 0;
+  bool hasOverflowed = false;
+
+  // Bit per nesting level, set once the container holds an element
+  uint32_t hasElements = 0;
+  size_t depth = 0;
+
+  // Set right after a key, so its value doesn't get a comma
+  bool afterKey = false;
+
+  void put(char c);
+  void beginValue();
+  void open(char c);
+  void close(char c);
+};
+}  // namespace cspot
@@ -8,6 +8,7 @@
 #include <bell/io/BinaryStream.h>
 #include <bell/utils/DigestCrypto.h>
 
+#include "JsonWriter.h"
 #include "crypto/DiffieHellman.h"
 
 namespace cspot {
@@ -21,6 +22,11 @@ class LoginBlob {
   bell::Result<> authenticateZeroconfString(std::string_view queryStr);
 
   std::string buildZeroconfJSONResponse();
+
+  // Writes the getInfo response into the caller's buffer, false on overflow
+  // or if the fixed part of it didn't fit on construction
+  bool buildZeroconfJSONResponse(JsonWriter& writer);
+
   std::string getUsername();
   std::string getDeviceName();
   std::string getDeviceId();
@@ -52,6 +58,10 @@ class LoginBlob {
   // Base64 encoded public key
   std::string dhPublicKey;
 
+  // getInfo response up to the active user, the only field that changes.
+  // Empty if it overflowed its buffer.
+  std::string zeroconfResponsePrefix;
+
   std::recursive_mutex accessMutex;
 
   std::vector<uint8_t> encryptedAuthBlob;
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cspot {
+
+/**
+ * @brief Playback position as a function of time. The clock only stores an
+ * anchor, the position at a point in server time, and moves it on seeks, pauses
+ * and rate changes. Any other position is computed from it, so nothing has to
+ * tick while playing.
+ */
+class PlaybackClock {
+ public:
+  PlaybackClock() = default;
+
+  // Replaces the anchor, e.g. with the one of a transferred playback
+  void restore(int64_t anchorTimestampMs, int64_t anchorPositionMs,
+               double rate, bool paused);
+
+  void seek(int64_t positionMs, int64_t nowMs);
+  void pause(int64_t nowMs);
+  void resume(int64_t nowMs);
+  void setRate(double rate, int64_t nowMs);
+
+  // Position at the given server time, in ms
+  int64_t positionAt(int64_t nowMs) const;
+
+  int64_t anchorTimestampMs() const { return timestampMs; }
+  int64_t anchorPositionMs() const { return positionMs; }
+  double rate() const { return playbackRate; }
+  bool isPaused() const { return paused; }
+
+ private:
+  int64_t timestampMs = 0;
+  int64_t positionMs = 0;
+  double playbackRate = 1.0;
+  bool paused = true;
+
+  // Moves the anchor to now, keeping the position continuous
+  void rebase(int64_t nowMs);
+};
+}  // namespace cspot
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace cspot {
+
+/**
+ * @brief Double-ended ring buffer, adding or removing k elements at either end
+ * costs O(k) no matter how many are buffered.
+ *
+ * Every element also has a logical index, that stays the same while it is
+ * buffered. The front index moves down on pushFront and up on popFront, so
+ * positions can be stored as logical indexes without ever being rewritten.
+ *
+ * @tparam T element type, has to be default constructible and copyable
+ */
+template <typename T>
+class RingBuffer {
+ public:
+  // Read-only range of consecutive elements, invalidated by any change
+  class View {
+   public:
+    View() = default;
+    View(const RingBuffer* ring, size_t first, size_t count)
+        : ring(ring), first(first), count(count) {}
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t idx) const { return (*ring)[first + idx]; }
+
+   private:
+    const RingBuffer* ring = nullptr;
+    size_t first = 0;
+    size_t count = 0;
+  };
+
+  RingBuffer() = default;
+
+  /**
+   * @param capacity elements held without reallocating, rounded up to the
+   * next power of two. The buffer only grows when full.
+   */
+  explicit RingBuffer(size_t capacity) { reserve(capacity); }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+  size_t capacity() const { return slots.size(); }
+
+  T& operator[](size_t idx) { return slots[slot(idx)]; }
+  const T& operator[](size_t idx) const { return slots[slot(idx)]; }
+
+  T& front() { return (*this)[0]; }
+  const T& front() const { return (*this)[0]; }
+  T& back() { return (*this)[count - 1]; }
+  const T& back() const { return (*this)[count - 1]; }
+
+  View view(size_t first, size_t amount) const {
+    return View(this, first, amount);
+  }
+
+  // Logical index of the front element
+  uint32_t frontIndex() const { return firstIndex; }
+
+  void pushBack(const T& value) {
+    growIfFull();
+    slots[slot(count)] = value;
+    count++;
+  }
+
+  void pushFront(const T& value) {
+    growIfFull();
+    head = (head + slots.size() - 1) & mask();
+    slots[head] = value;
+    count++;
+    firstIndex--;
+  }
+
+  void popFront(size_t amount = 1) {
+    amount = std::min(amount, count);
+    for (size_t i = 0; i < amount; i++) {
+      slots[head] = T();
+      head = (head + 1) & mask();
+    }
+    count -= amount;
+    firstIndex += static_cast<uint32_t>(amount);
+  }
+
+  void popBack(size_t amount = 1) {
+    amount = std::min(amount, count);
+    for (size_t i = 0; i < amount; i++) {
+      count--;
+      slots[slot(count)] = T();
+    }
+  }
+
+  // Drops every element, the logical indexes carry on from the front
+  void clear() { popFront(count); }
+
+  void reserve(size_t newCapacity) {
+    if (newCapacity <= slots.size()) {
+      return;
+    }
+
+    size_t roundedCapacity = 2;
+    while (roundedCapacity < newCapacity) {
+      roundedCapacity <<= 1;
+    }
+
+    // Unwrap the elements to the start of the new storage
+    std::vector<T> newSlots(roundedCapacity);
+    for (size_t i = 0; i < count; i++) {
+      newSlots[i] = std::move((*this)[i]);
+    }
+    slots = std::move(newSlots);
+    head = 0;
+  }
+
+ private:
+  std::vector<T> slots;
+  size_t head = 0;
+  size_t count = 0;
+  uint32_t firstIndex = 0;
+
+  size_t mask() const { return slots.size() - 1; }
+  size_t slot(size_t idx) const { return (head + idx) & mask(); }
+
+  void growIfFull() {
+    if (count == slots.size()) {
+      reserve(slots.size() + 1);
+    }
+  }
+};
+}  // namespace cspot
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string_view>
+
+namespace cspot {
+
+/**
+ * @brief Estimates the offset between the local and the server clock, from the
+ * Date header of HTTP responses.
+ *
+ * A Date header only has a resolution of a second, and the server read its
+ * clock somewhere between sending the request and receiving the response. Every
+ * sample thus bounds the offset to an interval, the estimate is the middle of
+ * the intersection of all of them. Safe to use from any thread.
+ */
+class ServerClock {
+ public:
+  ServerClock() = default;
+
+  /**
+   * @brief Adds a response to the estimate.
+   *
+   * @param dateHeader value of the response's Date header
+   * @param sentAtMs local time in ms since epoch, when the request was sent
+   * @param receivedAtMs local time in ms since epoch, when the response arrived
+   */
+  void addSample(std::string_view dateHeader, int64_t sentAtMs,
+                 int64_t receivedAtMs);
+
+  // Current server time in ms since epoch, the local time until synced
+  int64_t nowMs() const;
+
+  // Offset to add to the local time, 0 until synced
+  int64_t offsetMs() const;
+
+  bool isSynced() const;
+
+  // Local time in ms since epoch
+  static int64_t localNowMs();
+
+  // Parses an IMF-fixdate, like "Sun, 06 Nov 1994 08:49:37 GMT"
+  static std::optional<int64_t> parseHttpDate(std::string_view date);
+
+ private:
+  mutable std::mutex boundsMutex;
+  bool hasBounds = false;
+
+  // Interval the offset is known to be in
+  int64_t minOffsetMs = 0;
+  int64_t maxOffsetMs = 0;
+};
+}  // namespace cspot
@@ -1,13 +1,16 @@
 #pragma once
 
+#include <chrono>
 #include <memory>
 
 #include "ConnectStateHandler.h"
 #include "LoginBlob.h"
 #include "SessionContext.h"
 #include "api/DealerClient.h"
+#include "api/DealerMessage.h"
 #include "api/SpClient.h"
 #include "bell/Result.h"
+#include "events/AsyncTask.h"
 #include "events/EventLoop.h"
 
 namespace cspot {
@@ -17,16 +20,38 @@ class Session {
 
   bell::Result<> start();
 
+  // Time from a command's dispatch until its ack got sent
+  struct CommandAckStats {
+    uint32_t count;
+    uint32_t lastUs;
+    uint32_t maxUs;
+    uint64_t totalUs;
+  };
+
+  // Only consistent when read on the loop thread
+  CommandAckStats getCommandAckStats() const { return commandAckStats; }
+
  private:
   const char* LOG_TAG = "Session";
 
+  CommandAckStats commandAckStats = {};
+
   std::shared_ptr<LoginBlob> loginBlob;
   std::shared_ptr<SessionContext> sessionContext;
   std::shared_ptr<DealerClient> dealerClient;
   std::shared_ptr<SpClient> spClient;
   std::shared_ptr<ConnectStateHandler> connectStateHandler;
 
+  // Inflates gzip compressed dealer pushes, used on the loop thread
+  GzipInflater pushInflater;
+
   void handleDealerMessage(EventLoop::Event&& event);
   void handleDealerRequest(EventLoop::Event&& event);
+
+  // Acks a dealer request once it's validated, then carries it out
+  AsyncTask<> processDealerRequest(
+      DealerMessage request, std::chrono::steady_clock::time_point receivedAt);
+
+  void recordCommandAck(std::chrono::steady_clock::time_point receivedAt);
 };
 }  // namespace cspot
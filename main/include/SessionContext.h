@@ -1,14 +1,18 @@
 #pragma once
 
 #include "LoginBlob.h"
+#include "ServerClock.h"
 #include "api/CredentialsResolver.h"
 #include "events/EventLoop.h"
+#include "events/WorkerPool.h"
 
 namespace cspot {
 struct SessionContext {
   std::shared_ptr<LoginBlob> loginBlob;
   std::shared_ptr<EventLoop> eventLoop;
+  std::shared_ptr<WorkerPool> workerPool;
   std::shared_ptr<CredentialsResolver> credentialsResolver;
+  std::shared_ptr<ServerClock> serverClock;
 
   std::string sessionId;
 };
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace cspot {
+
+/**
+ * @brief Open-addressing hash map from 64-bit track keys to positions. Probes
+ * linearly, and erases by shifting the following entries back, so lookups
+ * never wade through tombstones.
+ *
+ * Keys are hashes of a track's UID or URI. A key maps to every position it
+ * was inserted with, as a context can hold the same track more than once.
+ * Equal hashes of different tracks are possible too, callers confirm a hit
+ * against the track itself.
+ */
+class TrackIndex {
+ public:
+  TrackIndex() = default;
+
+  static uint64_t uidKey(std::string_view uid);
+  static uint64_t uriKey(std::string_view uri);
+
+  // Maps the key to the position, next to any position it already maps to
+  void insert(uint64_t key, uint32_t position);
+
+  // Removes the mapping of the key to the position, other ones stay
+  void erase(uint64_t key, uint32_t position);
+
+  // Calls visit with every position the key maps to, in no particular order
+  template <typename Visitor>
+  void forEachPosition(uint64_t key, Visitor&& visit) const {
+    if (slots.empty()) {
+      return;
+    }
+
+    size_t slotIdx = key & mask();
+    while (slots[slotIdx].key != 0) {
+      if (slots[slotIdx].key == key) {
+        visit(slots[slotIdx].position);
+      }
+      slotIdx = (slotIdx + 1) & mask();
+    }
+  }
+
+  void clear();
+
+  size_t size() const { return count; }
+
+ private:
+  // Key 0 marks an empty slot, no hash is ever 0
+  struct Slot {
+    uint64_t key = 0;
+    uint32_t position = 0;
+  };
+
+  static constexpr size_t initialCapacity = 64;
+
+  std::vector<Slot> slots;
+  size_t count = 0;
+
+  size_t mask() const { return slots.size() - 1; }
+
+  // Doubles the table once it is 3/4 full
+  void reserveForInsert();
+};
+}  // namespace cspot
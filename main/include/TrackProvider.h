@@ -38,6 +38,12 @@ class TrackProvider {
   bell::Result<> skipToPreviousTrack(
       cspot_proto::ContextTrack* track = nullptr);
 
+  /**
+   * @brief Merges a finished background refill, and tops the next tracks back
+   * up. Returns whether the next tracks changed.
+   */
+  bool refreshNextTracks();
+
   // Nanopb callback for encoding next tracks in the playback state
   static bool pbEncodeNextTracks(pb_ostream_t* stream, const pb_field_t* field,
                                  void* const* arg) {
@@ -72,6 +78,9 @@ class TrackProvider {
   // Index of the current track in the track queue
   uint32_t trackQueueIndex = 0;
 
+  // Appends context tracks until nextTracks holds the encoded window
+  bool fillNextTracks();
+
   bool encodePbTracks(pb_ostream_t* stream, const pb_field_t* field,
                       bool isPreviousTracks);
 };
@@ -1,14 +1,18 @@
 #pragma once
 
 #include <array>
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <optional>
 
 #include <bell/Logger.h>
 #include <bell/Result.h>
-#include <esp_websocket_client.h>
 
 // Own includes
 #include "SessionContext.h"
+#include "api/DealerRouter.h"
+#include "api/WebsocketClient.h"
 
 namespace cspot {
 class DealerClient {
@@ -17,7 +21,11 @@ class DealerClient {
 
   bell::Result<> connect();
 
-  bell::Result<> replyToRequest(bool success, const std::string& requestKey);
+  bell::Result<> replyToRequest(bool success, std::string_view requestKey);
+
+  // Frames matching no route are dropped, must be called before connect()
+  void addRoute(DealerRouter::Field field, std::string_view prefix,
+                EventLoop::EventType eventType);
 
   // Used for keep alive messages
   void doHousekeeping();
@@ -29,10 +37,61 @@ class DealerClient {
 
   std::shared_ptr<cspot::SessionContext> sessionContext;
 
+  DealerRouter router;
+
+  // Bounds the memory a single reassembled message can take
+  static constexpr size_t maxMessageSize = 256 * 1024;
+
+  // Message being reassembled from its fragments, filled in place
+  std::optional<PayloadWriter> pendingMessage;
+
+  // Set while the remainder of an oversized or unrouted message is discarded
+  bool discardingMessage = false;
+
+  // Route of the pending message, settled once its routed field arrived
+  std::optional<EventLoop::EventType> pendingEventType;
+  bool isRouteDecided = false;
+
+  // When the first fragment of the pending message arrived
+  std::chrono::steady_clock::time_point pendingReceivedAt;
+
+  // The routed field leads dealer frames, past this many bytes the route is
+  // only matched again once the message is complete
+  static constexpr size_t routeWindow = 4096;
+
+  // Message the event loop refused. Reads stay paused until it got posted, so
+  // the websocket thread never blocks on a busy loop.
+  struct ParkedMessage {
+    EventLoop::EventType eventType;
+    DealerFrame frame;
+  };
+  std::mutex parkedMutex;
+  std::optional<ParkedMessage> parkedMessage;
+
+  // Expires with the client, guards callbacks queued on the event loop
+  std::shared_ptr<bool> lifetimeToken = std::make_shared<bool>(true);
+
   bool connectionReady = false;
-  esp_websocket_client_handle_t wsClient = nullptr;
+  std::unique_ptr<WebsocketClient> wsClient;
+
+  // Called on the websocket client's thread
+  void handleConnectionChange(bool connected);
+
+  // Appends a received fragment, and posts the message once it's complete
+  void handleFragment(const WebsocketClient::Fragment& fragment);
+
+  // Matches the received start of a message, false if nothing subscribes to
+  // it and the rest of it can be skipped
+  bool routeMessage(const uint8_t* data, size_t size, bool isComplete);
+
+  // Makes room for size more bytes in the pending message
+  bool reserveFragment(size_t size);
+
+  // Posts a complete message, parking it and pausing reads if the loop is full
+  void postMessage(EventLoop::EventType eventType, DealerFrame frame);
 
-  static void websocketHandler(void* arg, esp_event_base_t base, int32_t id,
-                               void* data);
+  // Retries the parked message on the loop thread, once it caught up
+  void scheduleParkedRetry();
+  void retryParkedMessage();
 };
 }  // namespace cspot
\ No newline at end of file
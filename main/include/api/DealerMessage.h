@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "api/GzipInflater.h"
+#include "bell/Result.h"
+#include "events/PayloadBuffer.h"
+
+namespace cspot {
+
+/**
+ * @brief Fields of a dealer websocket frame that we route on, parsed in a
+ * single pass without building a DOM.
+ *
+ * String fields are views into the frame, which the message keeps alive.
+ * Only strings containing escapes are copied out.
+ */
+struct DealerMessage {
+  enum class Type { UNKNOWN, MESSAGE, REQUEST, PING, PONG };
+
+  struct Headers {
+    std::string_view connectionId;      // Spotify-Connection-Id
+    std::string_view contentType;       // Content-Type
+    std::string_view transferEncoding;  // Transfer-Encoding
+  };
+
+  struct CommandOptions {
+    std::string_view restorePaused;
+    std::string_view restorePosition;
+    std::string_view restoreTrack;
+  };
+
+  // Player command carried by a request
+  struct Command {
+    std::string_view endpoint;
+    std::string_view data;  // Base64 encoded protobuf
+    CommandOptions options;
+  };
+
+  Type type = Type::UNKNOWN;
+  std::string_view uri;           // Set on messages
+  std::string_view messageIdent;  // Set on requests
+  std::string_view key;           // Set on requests, echoed in the reply
+  Headers headers;
+
+  // String entries of a message's payloads
+  std::vector<std::string_view> payloads;
+
+  // Payload of a request
+  std::optional<uint32_t> messageId;
+  std::string_view sentByDeviceId;
+  Command command;
+
+  DealerMessage() = default;
+  DealerMessage(DealerMessage&&) = default;
+  DealerMessage& operator=(DealerMessage&&) = default;
+
+  // A copy would view into the storage of the original
+  DealerMessage(const DealerMessage&) = delete;
+  DealerMessage& operator=(const DealerMessage&) = delete;
+
+  static bell::Result<DealerMessage> parse(PayloadBuffer frame);
+
+  // Largest payload a message may carry once decoded
+  static constexpr size_t maxPayloadSize = 512 * 1024;
+
+  /**
+   * @brief Decodes the base64 payloads of a message into one buffer, inflating
+   * it when the message was sent with "Transfer-Encoding: gzip".
+   */
+  bell::Result<PayloadBuffer> decodePayload(GzipInflater& inflater) const;
+
+ private:
+  PayloadBuffer frame;
+
+  // Strings with escapes, which can't be viewed in place. Nodes stay put when
+  // the message is moved.
+  std::list<std::string> unescapedStrings;
+};
+}  // namespace cspot
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "events/EventLoop.h"
+
+namespace cspot {
+
+/**
+ * @brief Routes raw dealer frames to event types, before they are parsed.
+ *
+ * The top-level "uri" (messages) or "message_ident" (requests) value is found
+ * with a byte scan of the frame, and matched against a prefix trie of the
+ * registered routes. Frames that no route subscribes to are dropped without
+ * any JSON parse or allocation.
+ */
+class DealerRouter {
+ public:
+  // Frame field that a route matches on
+  enum class Field {
+    URI,            // "uri" of messages
+    MESSAGE_IDENT,  // "message_ident" of requests
+    FIELD_COUNT     // Keep last
+  };
+
+  /**
+   * @brief Registers a route, replacing one with the same prefix.
+   *
+   * Not thread safe, routes are meant to be set up before the dealer connects.
+   * The longest matching prefix wins.
+   */
+  void addRoute(Field field, std::string_view prefix,
+                EventLoop::EventType eventType);
+
+  // Event type to post the frame as, empty if the frame should be dropped
+  std::optional<EventLoop::EventType> match(const uint8_t* frame,
+                                            size_t size) const;
+
+  /**
+   * @brief Matches the start of a frame that is still being received.
+   *
+   * isDecided is cleared when the routed field isn't complete within the data
+   * yet, the frame has to be matched again once more of it arrived.
+   */
+  std::optional<EventLoop::EventType> matchPartial(const uint8_t* frame,
+                                                   size_t size,
+                                                   bool& isDecided) const;
+
+ private:
+  struct Route {
+    std::string prefix;
+    EventLoop::EventType eventType;
+  };
+
+  struct Edge {
+    char byte;
+    uint16_t node;
+  };
+
+  // Edges of a node are stored contiguously, sorted by byte
+  struct Node {
+    uint16_t firstEdge = 0;
+    uint16_t edgeCount = 0;
+    bool hasRoute = false;
+    EventLoop::EventType eventType = EventLoop::EventType::DEALER_MESSAGE;
+  };
+
+  struct Trie {
+    std::vector<Route> routes;  // Sorted by prefix
+    std::vector<Node> nodes;    // Root first
+    std::vector<Edge> edges;
+  };
+
+  std::array<Trie, static_cast<size_t>(Field::FIELD_COUNT)> tries;
+
+  // Rebuilds the flat trie from its sorted routes
+  static void compile(Trie& trie);
+  static uint16_t compileNode(Trie& trie, size_t first, size_t last,
+                              size_t depth);
+
+  // Scans the frame for a routed field, isComplete tells whether the frame
+  // might continue past size
+  std::optional<EventLoop::EventType> matchFrame(const uint8_t* frame,
+                                                 size_t size, bool isComplete,
+                                                 bool& isDecided) const;
+
+  // Walks the trie along the JSON string value starting at pos, right after
+  // its opening quote. isTruncated is set if the value runs past size.
+  static std::optional<EventLoop::EventType> matchValue(const Trie& trie,
+                                                        const uint8_t* frame,
+                                                        size_t size,
+                                                        size_t pos,
+                                                        bool& isTruncated);
+};
+}  // namespace cspot
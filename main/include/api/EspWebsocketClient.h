@@ -0,0 +1,64 @@
+#pragma once
+
+#ifdef ESP_PLATFORM
+
+#include <esp_websocket_client.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "api/WebsocketClient.h"
+
+namespace cspot {
+
+// WebsocketClient on top of the ESP-IDF websocket client
+class EspWebsocketClient : public WebsocketClient {
+ public:
+  EspWebsocketClient() = default;
+  ~EspWebsocketClient() override;
+
+  bell::Result<> connect(const std::string& url) override;
+  bell::Result<> sendText(std::string_view text) override;
+  void disconnect() override;
+  void setReadsPaused(bool paused) override;
+
+ private:
+  const char* LOG_TAG = "EspWebsocketClient";
+
+  esp_websocket_client_handle_t wsClient = nullptr;
+
+  // Longest a send waits for the client task to let go of the connection
+  static constexpr uint32_t sendTimeoutMs = 5000;
+
+  // The client task holds its lock while dispatching a data event, so the
+  // handler can't wait for a resume without stalling sendText(). Fragments
+  // received while paused are held here instead, and handed over on resume.
+  struct HeldFragment {
+    std::vector<uint8_t> data;
+    size_t payloadOffset;
+    size_t payloadLength;
+    Opcode opcode;
+    bool fin;
+  };
+  std::atomic<bool> readsPaused = false;
+  std::recursive_mutex deliveryMutex;
+  std::deque<HeldFragment> heldFragments;
+  size_t heldBytes = 0;
+  bool isReleasing = false;
+
+  // Past this many held bytes, messages starting while paused are dropped
+  static constexpr size_t maxHeldBytes = 64 * 1024;
+  bool droppingMessage = false;
+
+  // Hands a fragment over, or holds it while paused. Called with
+  // deliveryMutex held.
+  void deliverFragment(const Fragment& fragment);
+  void clearHeldFragments();
+
+  static void websocketHandler(void* arg, esp_event_base_t base, int32_t id,
+                               void* data);
+};
+}  // namespace cspot
+
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "bell/Result.h"
+#include "events/PayloadBuffer.h"
+
+namespace cspot {
+
+/**
+ * @brief Inflates gzip compressed dealer pushes into pooled buffers.
+ *
+ * Uses the tinfl decoder from the ROM on ESP32, streaming through a 32KB
+ * window, and zlib on hosts. The output buffer is sized once from the size
+ * stored in the gzip trailer, and checked against the trailer's CRC32 once
+ * inflated. The decoder state takes ~43KB, so it is allocated per push and
+ * released right after.
+ */
+class GzipInflater {
+ public:
+
+  /**
+   * @brief Inflates a single gzip member
+   *
+   * @param data compressed bytes, including the gzip header and trailer
+   * @param size amount of compressed bytes
+   * @param maxSize largest inflated size that is accepted
+   */
+  bell::Result<PayloadBuffer> inflate(const uint8_t* data, size_t size,
+                                      size_t maxSize);
+
+ private:
+  const char* LOG_TAG = "GzipInflater";
+
+  struct State;
+
+  // Returns the offset of the deflate stream, 0 if the header is invalid
+  static size_t parseHeader(const uint8_t* data, size_t size);
+
+  // Inflates the raw deflate stream into writer, returns the CRC32 of the
+  // inflated bytes
+  bell::Result<uint32_t> inflateStream(const uint8_t* input, size_t size,
+                                       PayloadWriter& writer);
+};
+}  // namespace cspot
@@ -0,0 +1,218 @@
+#pragma once
+
+#ifndef ESP_PLATFORM
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+#include "api/WebsocketClient.h"
+#include "bell/utils/Semaphore.h"
+#include "bell/utils/Task.h"
+
+namespace cspot {
+class PosixWebsocketClient;
+
+/**
+ * @brief Single thread multiplexing any amount of websocket connections over
+ * poll(). Connections only ever run on this thread once registered, so a
+ * connection itself needs no locking beyond its send queue.
+ */
+class WebsocketReactor : public bell::Task {
+ public:
+  static WebsocketReactor& instance();
+  ~WebsocketReactor();
+
+  void add(PosixWebsocketClient* client);
+
+  // Once this returns, the reactor won't touch the client anymore
+  void remove(PosixWebsocketClient* client);
+
+  // Interrupts poll(), so newly queued output gets written
+  void wake();
+
+ private:
+  const char* LOG_TAG = "WebsocketReactor";
+
+  WebsocketReactor();
+
+  // How often connections get to run their timers when idle
+  static constexpr int pollTimeoutMs = 1000;
+
+  std::atomic<bool> isRunning = true;
+
+  // Self-pipe that wake() writes to
+  int wakeFds[2] = {-1, -1};
+
+  std::mutex clientsMutex;
+  std::vector<PosixWebsocketClient*> clients;
+
+  // Held while connections are serviced, so remove() can wait for it. A
+  // handler may disconnect its own client, hence recursive.
+  std::recursive_mutex serviceMutex;
+
+  bell::Semaphore stoppedSemaphore;
+
+  void taskLoop() override;
+};
+
+/**
+ * @brief WebsocketClient for POSIX hosts. TLS runs on mbedTLS, and the socket
+ * is non-blocking, driven by the shared WebsocketReactor. Like the ESP client,
+ * a dropped connection is reconnected until disconnect() is called.
+ */
+class PosixWebsocketClient : public WebsocketClient {
+ public:
+  /**
+   * @param caPath file or directory of trusted CA certificates for wss://
+   */
+  PosixWebsocketClient(std::string caPath = "/etc/ssl/certs");
+  ~PosixWebsocketClient() override;
+
+  bell::Result<> connect(const std::string& url) override;
+  bell::Result<> sendText(std::string_view text) override;
+  void disconnect() override;
+  void setReadsPaused(bool paused) override;
+
+ private:
+  friend class WebsocketReactor;
+
+  const char* LOG_TAG = "PosixWebsocketClient";
+
+  enum class State {
+    IDLE,
+    CONNECTING,     // TCP connect in progress
+    HANDSHAKING,    // TLS handshake in progress
+    UPGRADING,      // Waiting for the HTTP upgrade response
+    OPEN,
+    BACKOFF,        // Dropped, waiting to reconnect
+    RESOLVING,      // Reconnect resolving off the reactor
+    CLOSED
+  };
+
+  // Size of the receive buffer, larger frames are delivered in fragments
+  static constexpr size_t receiveBufferSize = 16 * 1024;
+
+  // Interval of keepalive pings, a connection missing a pong is dropped
+  static constexpr std::chrono::seconds pingInterval{30};
+
+  // Time allowed from connect() until the upgrade completes
+  static constexpr std::chrono::seconds connectTimeout{15};
+
+  // Wait before reconnecting, the ESP client's default
+  static constexpr std::chrono::seconds reconnectDelay{10};
+
+  std::string caPath;
+  std::atomic<State> state = State::IDLE;
+  std::chrono::steady_clock::time_point connectStartedAt;
+  std::chrono::steady_clock::time_point reconnectAt;
+
+  // Transport
+  bool useTls = false;
+  bool tlsConfigured = false;
+  bool handshakeWantsWrite = false;
+  mbedtls_net_context netContext;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctrDrbg;
+  std::mutex randomMutex;
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config sslConfig;
+  mbedtls_x509_crt caChain;
+
+  std::string host;
+  uint16_t port = 0;
+  std::string requestPath;
+  std::string handshakeKey;
+
+  // Encoded frames waiting to be written
+  std::mutex sendMutex;
+  std::vector<uint8_t> sendBuffer;
+
+  // Length of a TLS write that would have blocked. mbedTLS already took the
+  // record, so the retry has to pass the very same length.
+  size_t inFlightLength = 0;
+
+  std::vector<uint8_t> receiveBuffer;
+  size_t receivedBytes = 0;
+
+  // While set the socket isn't polled for input, and buffered frames wait
+  std::atomic<bool> readsPaused = false;
+
+  // Set on resume, so the reactor hands over the frames still buffered
+  std::atomic<bool> resumeRequested = false;
+
+  // Frame being received
+  bool inFrame = false;
+  Opcode frameOpcode = Opcode::CONTINUATION;
+  bool frameFin = false;
+  size_t framePayloadLength = 0;
+  size_t framePayloadOffset = 0;
+
+  std::chrono::steady_clock::time_point lastPingSent;
+  bool awaitingPong = false;
+
+  // Socket of a reconnect, resolved and connected on a thread of its own so a
+  // slow lookup doesn't hold up the reactor. Shared with that thread, which
+  // may outlive the client.
+  struct PendingConnect {
+    std::atomic<bool> isDone = false;
+    int fd = -1;
+
+    ~PendingConnect();
+  };
+  std::shared_ptr<PendingConnect> pendingConnect;
+
+  // Resolves the host, and starts a non-blocking connect to it
+  static bell::Result<int> startConnect(const std::string& host,
+                                        uint16_t port);
+
+  // Takes over a connecting socket, and sets up the connection on it
+  bell::Result<> openConnection(int fd);
+  bell::Result<> setupTls();
+
+  // Called by the reactor
+  int pollFd() const { return netContext.fd; }
+  bool wantsWrite();
+  bool readsPausedNow() const { return readsPaused; }
+  bool takeResumeRequest() { return resumeRequested.exchange(false); }
+  void onReadable();
+  void onWritable();
+  void onTick(std::chrono::steady_clock::time_point now);
+
+  void advanceHandshake();
+  void queueUpgradeRequest();
+  bool parseUpgradeResponse();
+
+  // Parses and dispatches as much of the receive buffer as possible
+  void processFrames();
+  void handleControlFrame(Opcode opcode, const uint8_t* payload, size_t size);
+
+  // Encodes a masked frame into the send buffer
+  void queueFrame(Opcode opcode, const uint8_t* payload, size_t size);
+
+  // Random source of both TLS and frame masking, safe to call from any thread
+  static int random(void* ctx, uint8_t* output, size_t len);
+
+  // Positive amount of bytes, 0 if the call would block, negative on error
+  int transportRead(uint8_t* buf, size_t len);
+  int transportWrite(const uint8_t* buf, size_t len);
+
+  // Writes from the front of the send buffer, called with sendMutex held
+  int writeSendBuffer();
+
+  // Drops the connection and reports it, called on the reactor thread
+  void fail(const char* reason);
+  void closeTransport();
+};
+}  // namespace cspot
+
+#endif
@@ -24,6 +24,11 @@ class SpClient {
   bell::Result<> putConnectStateInactive(int retryCount = 3);
   bell::Result<> putConnectState(cspot_proto::PutStateRequest& stateRequest,
                                  int retryCount = 3);
+
+  // Sends an already encoded PutStateRequest, safe to call from a worker
+  bell::Result<> putConnectState(const std::vector<uint8_t>& encodedState,
+                                 const std::string& connectionId,
+                                 int retryCount = 3);
   bell::Result<bell::HTTPReader> contextResolve(const std::string& contextUri);
 
   bell::Result<bell::HTTPReader> doRequest(bell::http::Method method,
@@ -39,5 +44,8 @@ class SpClient {
 
   std::shared_ptr<SessionContext> sessionContext;
   std::vector<std::uint8_t> requestBuffer;
+
+  // Feeds the response's Date header to the session's server clock
+  void sampleServerClock(const bell::HTTPReader& response, int64_t sentAtMs);
 };
 }  // namespace cspot
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "bell/Result.h"
+
+namespace cspot {
+
+/**
+ * @brief Websocket connection used by the dealer, implemented on top of
+ * esp_websocket_client on ESP32, and of mbedTLS sockets on POSIX hosts.
+ *
+ * Received frames are handed over in fragments, as the receive buffer fills
+ * up, so a large frame never has to fit in the backend's own buffers.
+ */
+class WebsocketClient {
+ public:
+  // RFC 6455 frame opcodes
+  enum class Opcode : uint8_t {
+    CONTINUATION = 0x0,
+    TEXT = 0x1,
+    BINARY = 0x2,
+    CLOSE = 0x8,
+    PING = 0x9,
+    PONG = 0xA
+  };
+
+  // Part of a received data frame
+  struct Fragment {
+    const uint8_t* data;
+    size_t size;
+    size_t payloadOffset;  // Offset of data within the frame's payload
+    size_t payloadLength;  // Size of the frame's whole payload
+    Opcode opcode;
+    bool fin;  // Set on the final frame of a message
+  };
+
+  // Handlers are called on the backend's own thread
+  using ConnectionHandler = std::function<void(bool connected)>;
+  using FragmentHandler = std::function<void(const Fragment& fragment)>;
+
+  virtual ~WebsocketClient() = default;
+
+  // Creates the backend of the current platform
+  static std::unique_ptr<WebsocketClient> create();
+
+  void setConnectionHandler(ConnectionHandler handler) {
+    connectionHandler = std::move(handler);
+  }
+
+  void setFragmentHandler(FragmentHandler handler) {
+    fragmentHandler = std::move(handler);
+  }
+
+  // Starts connecting to a ws:// or wss:// url, completion is reported
+  // through the connection handler
+  virtual bell::Result<> connect(const std::string& url) = 0;
+
+  // Queues a text frame, safe to call from any thread
+  virtual bell::Result<> sendText(std::string_view text) = 0;
+
+  virtual void disconnect() = 0;
+
+  /**
+   * @brief Stops handing over received frames until resumed. The socket is
+   * left unread, so TCP flow control holds the server back. The ESP backend
+   * can't leave it unread, it holds what arrives meanwhile and hands it over
+   * from the thread resuming reads. Safe to call from any thread, including
+   * from the fragment handler.
+   */
+  virtual void setReadsPaused(bool paused) = 0;
+
+ protected:
+  ConnectionHandler connectionHandler;
+  FragmentHandler fragmentHandler;
+};
+}  // namespace cspot
@@ -1,4 +1,6 @@
 #pragma once
+
+#ifdef ESP_PLATFORM
 #include "esp_log.h"
 
 #define BELL_LOG(level, tag, fmt, ...) BELL_LOG_##level(tag, fmt, ##__VA_ARGS__)
@@ -6,3 +8,29 @@
 #define BELL_LOG_error(tag, fmt, ...) ESP_LOGE(tag, fmt, ##__VA_ARGS__)
 #define BELL_LOG_warn(tag, fmt, ...) ESP_LOGW(tag, fmt, ##__VA_ARGS__)
 #define BELL_LOG_debug(tag, fmt, ...) ESP_LOGD(tag, fmt, ##__VA_ARGS__)
+#else
+#include <cstdio>
+#include <utility>
+
+#include <fmt/format.h>
+
+namespace bell {
+// Host builds log to stderr, in the "L TAG: message" layout of ESP-IDF
+template <typename... Args>
+void log(char level, const char* tag, fmt::format_string<Args...> format,
+         Args&&... args) {
+  fmt::print(stderr, "{} {}: {}\n", level, tag,
+             fmt::format(format, std::forward<Args>(args)...));
+}
+}  // namespace bell
+
+#define BELL_LOG(level, tag, fmt, ...) BELL_LOG_##level(tag, fmt, ##__VA_ARGS__)
+#define BELL_LOG_info(tag, format, ...) \
+  ::bell::log('I', tag, format, ##__VA_ARGS__)
+#define BELL_LOG_error(tag, format, ...) \
+  ::bell::log('E', tag, format, ##__VA_ARGS__)
+#define BELL_LOG_warn(tag, format, ...) \
+  ::bell::log('W', tag, format, ##__VA_ARGS__)
+#define BELL_LOG_debug(tag, format, ...) \
+  ::bell::log('D', tag, format, ##__VA_ARGS__)
+#endif
@@ -13,6 +13,7 @@ class Result {
   Result(const T& v) : value(v) {}
   Result(T&& v) : value(std::move(v)) {}
   Result(std::error_code ec) : error(ec) {}
+  Result(std::errc e) : error(std::make_error_code(e)) {}
 
   explicit operator bool() const { return !error.has_value(); }
 
@@ -34,6 +35,7 @@ class Result<void> {
  public:
   Result() = default;
   Result(std::error_code ec) : error(ec) {}
+  Result(std::errc e) : error(std::make_error_code(e)) {}
 
   operator bool() const { return !error.has_value(); }
   std::error_code getError() const { return error.value(); }
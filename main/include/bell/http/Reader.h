@@ -1,4 +1,7 @@
 #pragma once
+#include <algorithm>
+#include <cctype>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <vector>
@@ -6,17 +9,45 @@
 
 namespace bell {
 namespace http {
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+inline bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+// Response headers the reader keeps, the rest are dropped as they arrive
+inline bool isKeptHeader(std::string_view name) {
+  return equalsIgnoreCase(name, "Date");
+}
+
 class HTTPReader {
  public:
-  HTTPReader(int status, std::string body)
-      : status(status), body(std::move(body)) {}
+  HTTPReader(int status, std::string body, Headers headers = {})
+      : status(status), body(std::move(body)), headers(std::move(headers)) {}
   bell::Result<int> getStatusCode() { return status; }
-  bell::Result<std::string_view> getBodyStringView() { return body; }
+  bell::Result<std::string_view> getBodyStringView() {
+    return std::string_view(body);
+  }
   bell::Result<const char*> getBodyBytesPtr() { return body.c_str(); }
   bell::Result<size_t> getBodyBytesLength() { return body.size(); }
+
+  // Value of a kept response header, names compare case-insensitively
+  std::optional<std::string_view> getHeader(std::string_view name) const {
+    for (const auto& [key, value] : headers) {
+      if (equalsIgnoreCase(key, name)) {
+        return std::string_view(value);
+      }
+    }
+    return std::nullopt;
+  }
  private:
   int status;
   std::string body;
+  Headers headers;
 };
 
 enum class Method { GET, POST, PUT };
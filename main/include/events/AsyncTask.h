@@ -0,0 +1,367 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "bell/Logger.h"
+#include "bell/Result.h"
+#include "bell/http/Reader.h"
+#include "bell/net/TCPSocket.h"
+#include "events/EventLoop.h"
+#include "events/WorkerPool.h"
+
+namespace cspot {
+
+/**
+ * @brief Cancellation flag shared by a tree of AsyncTasks, copies refer to the
+ * same flag. Cancelling resumes the currently suspended awaitable with
+ * std::errc::operation_canceled, and fails every later one right away.
+ */
+class CancellationToken {
+ public:
+  CancellationToken() : state(std::make_shared<State>()) {}
+
+  // Safe to call from any thread
+  void cancel() {
+    std::function<void()> handler;
+    {
+      std::scoped_lock lock(state->mutex);
+      if (state->cancelled) {
+        return;
+      }
+      state->cancelled = true;
+      handler = std::move(state->onCancel);
+    }
+
+    if (handler) {
+      handler();
+    }
+  }
+
+  bool isCancelled() const {
+    std::scoped_lock lock(state->mutex);
+    return state->cancelled;
+  }
+
+  /**
+   * @brief Sets the handler called on cancellation, replacing the previous one.
+   *
+   * @return false if the token is already cancelled
+   */
+  bool setCancelHandler(std::function<void()> handler) {
+    std::scoped_lock lock(state->mutex);
+    if (state->cancelled) {
+      return false;
+    }
+    state->onCancel = std::move(handler);
+    return true;
+  }
+
+ private:
+  struct State {
+    std::mutex mutex;
+    bool cancelled = false;
+    std::function<void()> onCancel;
+  };
+
+  std::shared_ptr<State> state;
+};
+
+namespace detail {
+struct PromiseBase {
+  CancellationToken token;
+  std::coroutine_handle<> continuation;
+  std::exception_ptr exception;
+
+  // Tasks are lazy, they start when awaited or spawned
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  // Hands control back to the awaiting task, without growing the stack
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+
+    template <typename PromiseT>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<PromiseT> handle) noexcept {
+      auto continuation = handle.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  FinalAwaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+  std::optional<T> value;
+
+  template <typename U>
+  void return_value(U&& result) {
+    value.emplace(std::forward<U>(result));
+  }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+  void return_void() {}
+};
+}  // namespace detail
+
+/**
+ * @brief Lazily started coroutine, resumed on the EventLoop thread. Awaiting a
+ * task starts it, and shares the awaiting task's CancellationToken with it.
+ *
+ * Use spawn() to start a top level task from an event handler.
+ */
+template <typename T = void>
+class [[nodiscard]] AsyncTask {
+ public:
+  struct promise_type : detail::Promise<T> {
+    AsyncTask get_return_object() {
+      return AsyncTask(
+          std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+
+  AsyncTask(AsyncTask&& other) noexcept
+      : handle(std::exchange(other.handle, {})) {}
+  AsyncTask& operator=(AsyncTask&&) = delete;
+  AsyncTask(const AsyncTask&) = delete;
+  AsyncTask& operator=(const AsyncTask&) = delete;
+
+  ~AsyncTask() {
+    if (handle) {
+      handle.destroy();
+    }
+  }
+
+  bool await_ready() const noexcept { return false; }
+
+  template <typename PromiseT>
+  std::coroutine_handle<> await_suspend(
+      std::coroutine_handle<PromiseT> awaiting) noexcept {
+    handle.promise().continuation = awaiting;
+    handle.promise().token = awaiting.promise().token;
+    return handle;
+  }
+
+  T await_resume() {
+    auto& promise = handle.promise();
+    if (promise.exception) {
+      std::rethrow_exception(promise.exception);
+    }
+
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(promise.value.value());
+    }
+  }
+
+ private:
+  explicit AsyncTask(std::coroutine_handle<promise_type> handle)
+      : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+// Owns a spawned task, and frees itself once the task completes
+struct DetachedTask {
+  struct promise_type : PromiseBase {
+    promise_type(AsyncTask<>&, const CancellationToken& taskToken) {
+      token = taskToken;
+    }
+
+    DetachedTask get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+  };
+};
+
+inline DetachedTask runDetached(AsyncTask<> task, CancellationToken token) {
+  try {
+    co_await task;
+  } catch (const std::exception& e) {
+    BELL_LOG(error, "AsyncTask", "Unhandled error in task: {}", e.what());
+  }
+}
+
+template <typename T>
+struct IsResult : std::false_type {};
+
+template <typename T>
+struct IsResult<bell::Result<T>> : std::true_type {};
+}  // namespace detail
+
+/**
+ * @brief Starts a task, running it until its first suspension point. Must be
+ * called on the EventLoop thread.
+ *
+ * @return token that cancels the task
+ */
+inline CancellationToken spawn(AsyncTask<> task,
+                               CancellationToken token = CancellationToken()) {
+  detail::runDetached(std::move(task), token);
+  return token;
+}
+
+/**
+ * @brief Suspends the awaiting task until an operation completes. The start
+ * function receives a resolver, which has to be called on the EventLoop thread.
+ *
+ * @tparam R bell::Result returned by co_await
+ */
+template <typename R>
+class CompletionAwaiter {
+ public:
+  using Resolver = std::function<void(R)>;
+  using StartFunction = std::function<void(Resolver)>;
+
+  CompletionAwaiter(EventLoop& eventLoop, StartFunction start)
+      : eventLoop(eventLoop),
+        start(std::move(start)),
+        completion(std::make_shared<Completion>()) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  template <typename PromiseT>
+  bool await_suspend(std::coroutine_handle<PromiseT> awaiting) {
+    completion->handle = awaiting;
+
+    // Cancellation may come from any thread, resume from the loop
+    bool isArmed = awaiting.promise().token.setCancelHandler(
+        [loop = &eventLoop, completion = completion]() {
+          loop->postCallback([completion]() {
+            resolve(completion,
+                    std::make_error_code(std::errc::operation_canceled));
+          });
+        });
+    if (!isArmed) {
+      completion->result.emplace(
+          std::make_error_code(std::errc::operation_canceled));
+      return false;
+    }
+
+    start([completion = completion](R result) {
+      resolve(completion, std::move(result));
+    });
+    return true;
+  }
+
+  R await_resume() { return std::move(completion->result.value()); }
+
+ private:
+  // Outlives the awaiter, so a late completion of a cancelled operation is
+  // simply ignored
+  struct Completion {
+    std::coroutine_handle<> handle;
+    std::optional<R> result;
+  };
+
+  EventLoop& eventLoop;
+  StartFunction start;
+  std::shared_ptr<Completion> completion;
+
+  static void resolve(const std::shared_ptr<Completion>& completion,
+                      R result) {
+    if (completion->result.has_value()) {
+      return;  // Already resumed
+    }
+    completion->result.emplace(std::move(result));
+    completion->handle.resume();
+  }
+};
+
+/**
+ * @brief Suspends the awaiting task for a delay, without blocking the loop.
+ * The timer is cancelled with the awaiter, so a cancelled task doesn't leave
+ * it pending in the timer wheel.
+ */
+class SleepAwaiter {
+ public:
+  SleepAwaiter(EventLoop& eventLoop, uint32_t delayMs)
+      : awaiter(eventLoop, [this, loop = &eventLoop, delayMs](auto resolve) {
+          timer = loop->postDelayed(
+              EventLoop::EventType::CALLBACK,
+              EventLoop::Callback([resolve]() { resolve(bell::Result<>()); }),
+              delayMs);
+        }) {}
+
+  // The start function points back here
+  SleepAwaiter(const SleepAwaiter&) = delete;
+  SleepAwaiter& operator=(const SleepAwaiter&) = delete;
+
+  ~SleepAwaiter() { timer.cancel(); }
+
+  bool await_ready() const noexcept { return false; }
+
+  template <typename PromiseT>
+  bool await_suspend(std::coroutine_handle<PromiseT> awaiting) {
+    return awaiter.await_suspend(awaiting);
+  }
+
+  bell::Result<> await_resume() { return awaiter.await_resume(); }
+
+ private:
+  EventLoop::TimerHandle timer;
+  CompletionAwaiter<bell::Result<>> awaiter;
+};
+
+inline SleepAwaiter sleepFor(EventLoop& eventLoop, uint32_t delayMs) {
+  return SleepAwaiter(eventLoop, delayMs);
+}
+
+/**
+ * @brief Runs a blocking job on the worker pool, resuming the awaiting task
+ * with its result. A cancelled task resumes right away, but the job still runs
+ * to completion, so it must not reference the task's frame.
+ *
+ * @tparam JobT callable returning a bell::Result
+ */
+template <typename JobT>
+auto runOnWorker(WorkerPool& workerPool, JobT job) {
+  using R = std::invoke_result_t<JobT&>;
+  static_assert(detail::IsResult<R>::value, "Jobs must return a bell::Result");
+
+  return CompletionAwaiter<R>(
+      workerPool.getEventLoop(),
+      [pool = &workerPool, job = std::move(job)](auto resolve) {
+        pool->submit(job, resolve);
+      });
+}
+
+// Performs an HTTP request on the worker pool
+inline auto httpRequest(
+    WorkerPool& workerPool, bell::http::Method method, std::string url,
+    std::vector<std::pair<std::string, std::string>> headers = {}) {
+  return runOnWorker(workerPool, [method, url = std::move(url),
+                                  headers = std::move(headers)]() {
+    return bell::http::request(method, url, headers);
+  });
+}
+
+/**
+ * @brief Reads from a blocking socket on the worker pool. The socket and the
+ * buffer have to outlive the read, even if the task gets cancelled.
+ */
+inline auto socketRead(WorkerPool& workerPool, bell::net::TCPSocket& socket,
+                       uint8_t* buffer, size_t length) {
+  return runOnWorker(workerPool, [socket = &socket, buffer, length]() {
+    return socket->read(buffer, length);
+  });
+}
+}  // namespace cspot
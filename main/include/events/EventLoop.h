@@ -1,33 +1,55 @@
 #pragma once
 
 #include <bell/utils/Semaphore.h>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
-#include <unordered_map>
+#include <thread>
 #include <utility>
 #include <variant>
+#include <vector>
 
 #include "bell/utils/Task.h"
 #include "events/EventModels.h"
+#include "events/MPSCQueue.h"
+#include "events/PayloadBuffer.h"
+#include "events/TimerWheel.h"
 
 namespace cspot {
 class EventLoop : public bell::Task {
  public:
-  EventLoop();
-  ~EventLoop() {};
+  EventLoop(size_t laneCapacity = 32);
+  ~EventLoop();
 
   enum class EventType {
     DEALER_REQUEST,
     DEALER_MESSAGE,
     TRACKPROVIDER_UPDATED,
-    CURRENT_TRACK_METADATA
+    CURRENT_TRACK_METADATA,
+    CALLBACK,         // Runs the Callback payload on the loop thread
+    EVENT_TYPE_COUNT  // Keep last, used to size the handler table
   };
 
-  // Define all possible event payload types
-  using EventPayload =
-      std::variant<std::string, std::monostate, CurrentTrackMetadata>;
+  // Dispatch lanes, lower values are served first
+  enum class Priority {
+    CONTROL,         // User commands, waiting for an ack
+    STATE,           // Connect state and track updates
+    BACKGROUND,      // Metadata and prefetching
+    PRIORITY_COUNT   // Keep last
+  };
+
+  using Callback = std::function<void()>;
+
+  // Define all possible event payload types. Raw messages travel as shared
+  // PayloadBuffers, so copying an event never copies its bytes.
+  using EventPayload = std::variant<PayloadBuffer, std::monostate,
+                                    CurrentTrackMetadata, DealerFrame,
+                                    Callback>;
 
   struct Event {
     EventType type;
@@ -40,32 +62,346 @@ class EventLoop : public bell::Task {
 
   using EventHandler = std::function<void(Event&&)>;
 
-  // Post an event by moving it into the queue
+  // How pending events of the same type are folded together on dispatch
+  enum class Coalescing {
+    NONE,         // Every event is dispatched
+    LATEST_WINS,  // Only the most recent payload is dispatched
+    MERGE         // Payloads are folded with a merge function
+  };
+
+  using MergeFunction =
+      std::function<EventPayload(EventPayload&& older, EventPayload&& newer)>;
+
+  // What happens to an event posted while its type is at capacity
+  enum class OverflowPolicy {
+    BLOCK,        // Producer waits for room, dropped if posted from the loop
+    DROP_OLDEST,  // The oldest queued event of the type is discarded
+    DROP_NEWEST,  // The posted event is discarded
+    COALESCE,     // The oldest queued event of the type is folded into it
+    SPILL         // Never dropped, events that don't fit wait in an unbounded
+                  // list behind the lane
+  };
+
+  struct QueueStats {
+    uint32_t queued;         // Events waiting in the queue right now
+    uint32_t highWaterMark;  // Most events ever waiting at once
+    uint32_t dropped;        // Events discarded by the overflow policy
+  };
+
+  // Called on the posting thread when an event type backs up to 3/4 of its
+  // capacity or starts dropping, once until it drains again
+  using BackpressureCallback =
+      std::function<void(EventType type, const QueueStats& stats)>;
+
+  /**
+   * @brief Post an event by moving it into the queue. Takes no mutex unless
+   * the type's overflow policy blocks, safe to call from any thread.
+   *
+   * @return false if the event was dropped, it is counted in the type's
+   * QueueStats and logged
+   */
   template <typename T>
-  void post(EventType type, T&& payload) {
-    std::scoped_lock lock(queueMutex);
-    eventQueue.emplace(type, std::forward<T>(payload));
-    eventSemaphore.give();
+  [[nodiscard]] bool post(EventType type, T&& payload) {
+    return post(laneForType[static_cast<size_t>(type)], type,
+                std::forward<T>(payload));
+  }
+
+  // Post an event to an explicit lane, overriding the type's priority
+  template <typename T>
+  [[nodiscard]] bool post(Priority priority, EventType type, T&& payload) {
+    auto laneIdx = static_cast<size_t>(priority);
+    auto& lane = *lanes[laneIdx];
+    SlotReservation reservation;
+    if (!reserveSlot(type, reservation)) {
+      return false;
+    }
+
+    if (reservation.spills && spillLists[laneIdx].count > 0) {
+      // Queue up behind the events that already spilled, to keep their order
+      spill(laneIdx, Event(type, std::forward<T>(payload)));
+    } else {
+      // Only consumed on success, so the payload can be offered again
+      while (!lane.tryEmplace(type, std::forward<T>(payload))) {
+        if (reservation.spills) {
+          spill(laneIdx, Event(type, std::forward<T>(payload)));
+          break;
+        }
+        if (!waitForLane(type)) {
+          onQueueFull(type);
+          return false;
+        }
+      }
+    }
+
+    if (reservation.replacesOlder) {
+      typeCounters[static_cast<size_t>(type)].pendingReplacements++;
+    }
+
+    wakeConsumer();
+    return true;
+  }
+
+  /**
+   * @brief Schedule a callback to run on the loop thread, safe to call from any
+   * thread. Never blocks and never drops, callbacks resume tasks and complete
+   * jobs, so CALLBACK always spills over instead.
+   */
+  void postCallback(Callback callback, Priority priority = Priority::STATE) {
+    static_cast<void>(
+        post(priority, EventType::CALLBACK, std::move(callback)));
+  }
+
+  // Changes the lane events of the given type are posted to
+  void setPriority(EventType type, Priority priority) {
+    laneForType[static_cast<size_t>(type)] = priority;
   }
 
-  // Register a handler for a specific event type
+  // Handle to a delayed or periodic event, used to cancel it
+  class TimerHandle {
+   public:
+    TimerHandle() = default;
+
+    // Safe to call from any thread, and after the timer already fired
+    void cancel() {
+      if (timer) {
+        timer->cancel();
+      }
+    }
+
+   private:
+    friend class EventLoop;
+    explicit TimerHandle(std::shared_ptr<TimerWheel::Timer> timer)
+        : timer(std::move(timer)) {}
+
+    std::shared_ptr<TimerWheel::Timer> timer;
+  };
+
+  // Post an event after the given delay. It enters its lane like any other
+  // post, so priorities, coalescing and the overflow policy apply to it.
+  template <typename T>
+  TimerHandle postDelayed(EventType type, T&& payload, uint32_t delayMs) {
+    return scheduleTimer(
+        delayMs, 0,
+        [this, type,
+         payload = EventPayload(std::forward<T>(payload))]() mutable {
+          // Drops are logged and counted by post()
+          static_cast<void>(post(type, std::move(payload)));
+        });
+  }
+
+  // Post a copy of the event every periodMs, until cancelled
+  template <typename T>
+  TimerHandle postPeriodic(EventType type, T&& payload, uint32_t periodMs) {
+    return scheduleTimer(
+        periodMs, periodMs,
+        [this, type, payload = EventPayload(std::forward<T>(payload))]() {
+          static_cast<void>(post(type, EventPayload(payload)));
+        });
+  }
+
+  // Register a handler for a specific event type, every registered handler
+  // receives its own copy of the event
   void registerHandler(EventType type, EventHandler handler);
 
   // Unregister all handlers for a specific event type
   void unregisterHandler(EventType type);
 
+  /**
+   * @brief Sets the coalescing policy of an event type. Events drained from a
+   * lane in the same pass are folded into the position of the first pending
+   * one, so a batch holds at most one instance of the type.
+   *
+   * @param merge required for Coalescing::MERGE, called on the loop thread
+   */
+  void setCoalescing(EventType type, Coalescing coalescing,
+                     MergeFunction merge = nullptr);
+
+  /**
+   * @brief Bounds the amount of queued events of a type. CALLBACK always uses
+   * OverflowPolicy::SPILL, other policies are refused for it.
+   *
+   * @param capacity maximum events waiting, capped by the lane capacity
+   * @param policy applied to events posted while the type is at capacity
+   */
+  void setQueuePolicy(EventType type, uint32_t capacity, OverflowPolicy policy);
+
+  // Replaces the callback notified when the loop falls behind
+  void setBackpressureCallback(BackpressureCallback callback);
+
+  QueueStats getQueueStats(EventType type) const;
+
   // Processes the incoming events
   void processEvents(int timeoutMs = 1000);
 
  private:
   const char* LOG_TAG = "EventLoop";
 
+  // Only signalled when the consumer is actually waiting on it
   bell::Semaphore eventSemaphore;
-  std::mutex queueMutex;
-  std::queue<Event> eventQueue;
-  std::unordered_map<EventType, EventHandler> handlers;
+  std::atomic<bool> consumerSleeping = false;
+
+  static constexpr size_t laneCount =
+      static_cast<size_t>(Priority::PRIORITY_COUNT);
+  static constexpr size_t eventTypeCount =
+      static_cast<size_t>(EventType::EVENT_TYPE_COUNT);
+
+  // Maximum amount of consecutive events a lane can dispatch, while lower
+  // lanes are waiting. Bounds how long lower lanes can be starved.
+  static constexpr std::array<uint32_t, laneCount> laneBudgets = {16, 8, 4};
+
+  std::array<std::unique_ptr<MPSCQueue<Event>>, laneCount> lanes;
+  std::array<std::atomic<Priority>, eventTypeCount> laneForType;
+
+  // Events of OverflowPolicy::SPILL types that didn't fit their lane. Only
+  // touched once a lane is full, so the lock stays off the common path.
+  struct SpillList {
+    std::mutex mutex;
+    std::deque<Event> events;
+    std::atomic<size_t> count = 0;
+  };
+  std::array<SpillList, laneCount> spillLists;
+
+  // Events drained from a lane during the current pass, only touched by the
+  // loop thread
+  struct LaneBatch {
+    std::vector<Event> events;
+    size_t cursor = 0;
+
+    // Position of the not yet dispatched event of each coalesced type
+    std::array<size_t, eventTypeCount> pendingIndex;
+
+    // Set when the next event of the type folds into the pending one, after
+    // an overflow with OverflowPolicy::COALESCE
+    std::array<bool, eventTypeCount> foldNext;
+  };
+  std::array<LaneBatch, laneCount> batches;
+
+  // Cleared on destruction, stops the dispatch loop
+  std::atomic<bool> isRunning = true;
+  bell::Semaphore stoppedSemaphore;
+
+  struct HandlerEntry {
+    std::vector<EventHandler> handlers;
+    Coalescing coalescing = Coalescing::NONE;
+    MergeFunction merge;
+
+    // Read by producers on post, 0 means bounded by the lane only
+    uint32_t capacity = 0;
+    OverflowPolicy overflowPolicy = OverflowPolicy::DROP_NEWEST;
+  };
+
+  // Handlers are indexed by EventType. The table is copied on every change and
+  // published atomically, so dispatch never takes the handlers lock. Readers
+  // hold a reference while using a table, the last one frees a replaced table.
+  struct HandlerTable {
+    std::array<HandlerEntry, eventTypeCount> entries;
+    BackpressureCallback onBackpressure;
+  };
+  using HandlerTablePtr = std::shared_ptr<const HandlerTable>;
+  std::atomic<HandlerTablePtr> handlerTable;
+
+  // Serializes writers of the handler table
   std::mutex handlersMutex;
 
+  // Delayed and periodic events, expired on the loop thread
+  TimerWheel timerWheel;
+  std::mutex timerMutex;
+
+  // Set when a timer is scheduled, so a sleeping loop re-computes its timeout
+  std::atomic<bool> timersChanged = false;
+
+  struct TypeCounters {
+    std::atomic<uint32_t> queued = 0;
+    std::atomic<uint32_t> highWaterMark = 0;
+    std::atomic<uint32_t> dropped = 0;
+
+    // Events posted over capacity, each one discards or folds an older event
+    // of the type once collected
+    std::atomic<uint32_t> pendingReplacements = 0;
+
+    // Set once backpressure got reported, cleared when the type drained
+    std::atomic<bool> isLagging = false;
+  };
+  std::array<TypeCounters, eventTypeCount> typeCounters;
+
+  // Blocked producers wait here for the loop to drain
+  std::mutex spaceMutex;
+  std::condition_variable spaceCondition;
+  std::atomic<uint32_t> blockedProducers = 0;
+  std::atomic<uint32_t> drainCount = 0;
+
+  // Producers on the loop thread can never block
+  std::atomic<std::thread::id> loopThreadId;
+
+  // Rings the doorbell if the consumer went to sleep
+  void wakeConsumer() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumerSleeping.exchange(false)) {
+      eventSemaphore.give();
+    }
+  }
+
+  // Blocks until an event is posted, or the timeout expires
+  void waitForEvents(int timeoutMs);
+
+  struct SlotReservation {
+    // An older event of the type has to make room on collect
+    bool replacesOlder = false;
+
+    // The event goes to the spill list if its lane is full
+    bool spills = false;
+  };
+
+  /**
+   * @brief Counts an event of the type as queued, applying the overflow policy
+   * when the type is at capacity.
+   *
+   * @return false if the event has to be dropped
+   */
+  bool reserveSlot(EventType type, SlotReservation& reservation);
+
+  // Appends an event that didn't fit its lane to the lane's spill list
+  void spill(size_t laneIdx, Event&& event);
+
+  // Waits for the lane to free up for a blocking type, releasing the slot
+  // reserved for the event if it can't
+  bool waitForLane(EventType type);
+
+  // Blocks the producer until the loop drained some events
+  bool waitForSpace(const std::function<bool()>& hasSpace);
+
+  // Logs and reports an event that had to be dropped
+  void onQueueFull(EventType type);
+
+  // Notifies the backpressure callback once per episode, on the posting thread
+  void reportBackpressure(EventType type);
+
+  // Wakes producers blocked on a full type or lane
+  void notifyProducers();
+
+  TimerHandle scheduleTimer(uint32_t delayMs, uint32_t periodMs,
+                            std::function<void()> callback);
+
+  // Posts the events of all timers that expired by now
+  void runExpiredTimers();
+
+  bool lanesEmpty() const;
+
+  // Publishes a modified copy of the handler table
+  void updateHandlerTable(const std::function<void(HandlerTable&)>& update);
+
+  // Moves pending events of a lane into its batch, coalescing them
+  void collectLane(size_t laneIdx, const HandlerTable& table);
+
+  // Adds a single event taken from a lane or its spill list to the batch
+  void collectEvent(size_t laneIdx, Event&& event, const HandlerTable& table);
+
+  // Drains the lanes in priority order, within each lane's budget
+  void dispatchLanes();
+
+  // Calls the handlers registered for the event type, on the loop thread
+  void dispatchEvent(Event&& event);
+
   // Bell task implementation
   void taskLoop() override;
 };
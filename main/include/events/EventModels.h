@@ -1,5 +1,8 @@
 #pragma once
 
+#include <chrono>
+
+#include "events/PayloadBuffer.h"
 #include "proto/SpotifyId.h"
 
 namespace cspot {
@@ -8,4 +11,10 @@ struct CurrentTrackMetadata {
   std::string name;
   int32_t durationMs = 0;
 };
+
+// A dealer message, stamped when its first fragment came off the socket
+struct DealerFrame {
+  PayloadBuffer payload;
+  std::chrono::steady_clock::time_point receivedAt;
+};
 };  // namespace cspot
\ No newline at end of file
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <optional>
+#include <utility>
+
+namespace cspot {
+
+/**
+ * @brief Bounded lock-free multi-producer / single-consumer ring buffer.
+ *
+ * Every cell carries a sequence number, producers claim a slot with a single
+ * CAS on the enqueue position and publish it by bumping the cell sequence.
+ * The consumer never takes a lock, it only reads the sequence of the next cell.
+ *
+ * @tparam T element type, has to be move constructible
+ */
+template <typename T>
+class MPSCQueue {
+ public:
+  /**
+   * @param capacity maximum amount of queued elements, rounded up to the
+   * next power of two
+   */
+  explicit MPSCQueue(size_t capacity) {
+    size_t roundedCapacity = 2;
+    while (roundedCapacity < capacity) {
+      roundedCapacity <<= 1;
+    }
+
+    mask = roundedCapacity - 1;
+    cells = std::make_unique<Cell[]>(roundedCapacity);
+    for (size_t i = 0; i < roundedCapacity; i++) {
+      cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~MPSCQueue() {
+    // Destroy elements that were never consumed
+    while (tryPop().has_value()) {}
+  }
+
+  MPSCQueue(const MPSCQueue&) = delete;
+  MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+  /**
+   * @brief Constructs an element in place, safe to call from any thread.
+   *
+   * @return false if the queue is full, the arguments are left untouched
+   */
+  template <typename... Args>
+  bool tryEmplace(Args&&... args) {
+    Cell* cell = nullptr;
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+
+    while (true) {
+      cell = &cells[pos & mask];
+      size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(sequence) -
+                  static_cast<std::ptrdiff_t>(pos);
+
+      if (diff == 0) {
+        // Slot is free, try to claim it
+        if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        // Consumer did not free this slot yet, queue is full
+        return false;
+      } else {
+        pos = enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+
+    new (cell->storage) T(std::forward<Args>(args)...);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief Takes the oldest element out of the queue. Only one thread may
+   * consume at a time.
+   */
+  std::optional<T> tryPop() {
+    Cell& cell = cells[dequeuePos & mask];
+    size_t sequence = cell.sequence.load(std::memory_order_acquire);
+
+    if (sequence != dequeuePos + 1) {
+      // Empty, or the producer that claimed this slot is still writing it
+      return std::nullopt;
+    }
+
+    T* element = std::launder(reinterpret_cast<T*>(cell.storage));
+    std::optional<T> result(std::move(*element));
+    element->~T();
+
+    // Hand the slot back to the producers, one lap ahead
+    cell.sequence.store(dequeuePos + mask + 1, std::memory_order_release);
+    dequeuePos++;
+
+    return result;
+  }
+
+  // Only reliable when called from the consumer thread
+  bool empty() const {
+    return cells[dequeuePos & mask].sequence.load(std::memory_order_acquire) !=
+           dequeuePos + 1;
+  }
+
+  size_t capacity() const { return mask + 1; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  std::unique_ptr<Cell[]> cells;
+  size_t mask = 0;
+
+  // Keep producer and consumer positions on separate cache lines
+  alignas(64) std::atomic<size_t> enqueuePos = 0;
+  alignas(64) size_t dequeuePos = 0;
+};
+}  // namespace cspot
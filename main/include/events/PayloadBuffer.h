@@ -0,0 +1,144 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cspot {
+class PayloadWriter;
+
+/**
+ * @brief Refcounted, immutable byte buffer used as event payload. Copies share
+ * the same block, so a payload can be handed to any amount of handlers
+ * without touching its bytes.
+ *
+ * Blocks come from a pool of size classes, so the steady flow of dealer
+ * messages doesn't fragment the heap.
+ */
+class PayloadBuffer {
+ public:
+  PayloadBuffer() = default;
+  ~PayloadBuffer() { release(); }
+
+  PayloadBuffer(const PayloadBuffer& other) : block(other.block) {
+    if (block) {
+      block->refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  PayloadBuffer(PayloadBuffer&& other) noexcept
+      : block(std::exchange(other.block, nullptr)) {}
+
+  PayloadBuffer& operator=(PayloadBuffer other) noexcept {
+    std::swap(block, other.block);
+    return *this;
+  }
+
+  // Copies the bytes into a pooled block, the only copy a payload goes through
+  static PayloadBuffer copyFrom(const void* data, size_t size);
+
+  const uint8_t* data() const { return block ? block->bytes() : nullptr; }
+  size_t size() const { return block ? block->size : 0; }
+  bool empty() const { return size() == 0; }
+
+  std::string_view view() const {
+    return {reinterpret_cast<const char*>(data()), size()};
+  }
+
+ private:
+  friend class PayloadWriter;
+  friend class PayloadPool;
+
+  struct Block {
+    std::atomic<uint32_t> refCount;
+    uint32_t size;
+    uint32_t capacity;
+    uint8_t sizeClass;
+
+    // Payload bytes follow the header
+    uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+    const uint8_t* bytes() const {
+      return reinterpret_cast<const uint8_t*>(this + 1);
+    }
+  };
+
+  explicit PayloadBuffer(Block* block) : block(block) {}
+
+  void release();
+
+  Block* block = nullptr;
+};
+
+/**
+ * @brief Exclusive, writable pooled block. Filled by one producer, then frozen
+ * into a PayloadBuffer without copying.
+ */
+class PayloadWriter {
+ public:
+  // Allocates a block with room for at least capacity bytes
+  explicit PayloadWriter(size_t capacity);
+  ~PayloadWriter();
+
+  PayloadWriter(PayloadWriter&& other) noexcept
+      : block(std::exchange(other.block, nullptr)) {}
+  PayloadWriter& operator=(PayloadWriter&&) = delete;
+  PayloadWriter(const PayloadWriter&) = delete;
+  PayloadWriter& operator=(const PayloadWriter&) = delete;
+
+  uint8_t* data() { return block->bytes(); }
+  size_t size() const { return block->size; }
+  size_t capacity() const { return block->capacity; }
+
+  // Sets the amount of valid bytes, up to the capacity
+  void setSize(size_t size);
+
+  // Copies bytes to the end of the written data, fails if they don't fit
+  bool append(const void* data, size_t size);
+
+  // Hands the block over to an immutable buffer, the writer is empty after
+  PayloadBuffer freeze() &&;
+
+ private:
+  PayloadBuffer::Block* block;
+};
+
+// Size-classed free lists backing PayloadBuffer blocks
+class PayloadPool {
+ public:
+  static PayloadPool& instance();
+  ~PayloadPool();
+
+  PayloadBuffer::Block* allocate(size_t capacity);
+  void free(PayloadBuffer::Block* block);
+
+ private:
+  PayloadPool() = default;
+
+  static constexpr size_t sizeClassCount = 5;
+
+  // Capacities of the pooled blocks, larger payloads are allocated directly
+  static constexpr std::array<uint32_t, sizeClassCount> classCapacities = {
+      256, 1024, 4096, 16384, 65536};
+
+  // Amount of free blocks kept per class. Large blocks are rare, and not
+  // worth keeping around.
+  static constexpr std::array<size_t, sizeClassCount> classCacheLimits = {
+      8, 4, 2, 1, 0};
+
+  // Bounds the memory held by all free lists together, checked on every
+  // free, so a burst of messages never leaves more than this cached
+  static constexpr size_t maxCachedBytes = 32 * 1024;
+
+  // Marks blocks that bypass the pool
+  static constexpr uint8_t unpooledClass = UINT8_MAX;
+
+  std::mutex freeListsMutex;
+  std::array<std::vector<PayloadBuffer::Block*>, sizeClassCount> freeLists;
+  size_t cachedBytes = 0;
+};
+}  // namespace cspot
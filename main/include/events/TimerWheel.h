@@ -0,0 +1,101 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cspot {
+
+/**
+ * @brief Hierarchical timing wheel, in the spirit of Varghese & Lauck.
+ *
+ * Four levels of 64 slots each. Timers are bucketed by their expiry tick, so
+ * both inserting and expiring a timer is O(1). Timers that do not fit the
+ * lowest level are cascaded down as the wheel turns.
+ *
+ * @note Not thread safe, the owner is expected to serialize access.
+ */
+class TimerWheel {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Timer {
+    uint64_t expiresAtTick = 0;
+    uint32_t periodTicks = 0;  // 0 for one-shot timers
+
+    // Cancelled timers release their callback right away, the empty record is
+    // dropped lazily once its slot comes up
+    std::atomic<bool> cancelled = false;
+
+    // Safe to call from any thread
+    void cancel();
+
+    /**
+     * @brief Hands out the callback for an expiry, moved out of one-shot
+     * timers and copied from periodic ones. Empty once cancelled.
+     */
+    std::function<void()> claimCallback();
+
+   private:
+    friend class TimerWheel;
+
+    // Guards the callback against a concurrent cancel
+    std::mutex callbackMutex;
+    std::function<void()> callback;
+  };
+
+  TimerWheel(uint32_t tickMs = 10);
+
+  /**
+   * @brief Schedules a new timer.
+   *
+   * @param delayMs time until the first expiry
+   * @param periodMs repeat interval, 0 for a one-shot timer
+   * @param callback invoked by the owner on every expiry
+   */
+  std::shared_ptr<Timer> schedule(uint32_t delayMs, uint32_t periodMs,
+                                  std::function<void()> callback);
+
+  /**
+   * @brief Turns the wheel up to the given time point. Timers that expired on
+   * the way are appended to `expired`, periodic ones are already re-armed.
+   */
+  void advance(Clock::time_point now,
+               std::vector<std::shared_ptr<Timer>>& expired);
+
+  /**
+   * @brief Returns the amount of milliseconds the owner can sleep for, before
+   * it has to advance the wheel again. -1 when no timers are pending.
+   */
+  int msUntilNextExpiry(Clock::time_point now) const;
+
+  bool empty() const { return timerCount == 0; }
+
+ private:
+  static constexpr uint32_t slotBits = 6;
+  static constexpr uint32_t slotCount = 1 << slotBits;
+  static constexpr uint32_t slotMask = slotCount - 1;
+  static constexpr uint32_t levelCount = 4;
+
+  using Slot = std::vector<std::shared_ptr<Timer>>;
+
+  uint32_t tickMs;
+  Clock::time_point startTime;
+  uint64_t currentTick = 0;
+  size_t timerCount = 0;
+
+  std::array<std::array<Slot, slotCount>, levelCount> levels;
+
+  uint64_t tickAt(Clock::time_point time) const;
+
+  void insert(std::shared_ptr<Timer> timer);
+
+  // Moves the timers of the given level's current slot one level down
+  void cascade(uint32_t level);
+};
+}  // namespace cspot
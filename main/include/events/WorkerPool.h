@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "events/EventLoop.h"
+
+namespace cspot {
+
+/**
+ * @brief Fixed-size work-stealing executor, used to keep blocking work (HTTP,
+ * crypto, large JSON documents) off the EventLoop thread.
+ *
+ * Every worker owns a deque. Jobs submitted from a worker go to the back of its
+ * own deque and are popped LIFO, for cache locality. Idle workers steal from
+ * the front of the other deques, oldest job first.
+ */
+class WorkerPool {
+ public:
+  using Job = std::function<void()>;
+
+  /**
+   * @param eventLoop loop that job completions are posted to
+   * @param workerCount amount of workers, 0 to use one per core
+   * @param pinWorkers pin every worker to its own core
+   */
+  WorkerPool(std::shared_ptr<EventLoop> eventLoop, size_t workerCount = 0,
+             bool pinWorkers = false);
+
+  // Runs the jobs that are still queued, then joins the workers
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Queue a job, safe to call from any thread
+  void submit(Job job);
+
+  /**
+   * @brief Runs the job on a worker, and its completion on the EventLoop
+   * thread, receiving the job's return value.
+   */
+  template <typename JobT, typename CompletionT>
+  void submit(JobT&& job, CompletionT&& completion) {
+    submit([loop = eventLoop, job = std::forward<JobT>(job),
+            completion = std::forward<CompletionT>(completion)]() mutable {
+      if constexpr (std::is_void_v<std::invoke_result_t<JobT&>>) {
+        job();
+        loop->postCallback(std::move(completion));
+      } else {
+        loop->postCallback(
+            [completion = std::move(completion), result = job()]() mutable {
+              completion(std::move(result));
+            });
+      }
+    });
+  }
+
+  size_t size() const { return workers.size(); }
+
+  // Loop that job completions are posted to
+  EventLoop& getEventLoop() const { return *eventLoop; }
+
+ private:
+  const char* LOG_TAG = "WorkerPool";
+
+  // Stack of every worker thread on ESP32, matches the EventLoop task
+  static constexpr size_t workerStackSize = 8 * 1024;
+
+  struct Worker {
+    std::deque<Job> jobs;
+    std::mutex jobsMutex;
+    std::thread thread;
+  };
+
+  std::shared_ptr<EventLoop> eventLoop;
+  std::vector<std::unique_ptr<Worker>> workers;
+
+  std::atomic<bool> isRunning = true;
+
+  // Jobs queued, but not yet taken by any worker
+  std::atomic<size_t> pendingJobs = 0;
+
+  // Round-robin target for jobs submitted from outside the pool
+  std::atomic<size_t> nextWorker = 0;
+
+  // Idle workers sleep here
+  std::mutex idleMutex;
+  std::condition_variable idleCondition;
+  std::atomic<size_t> idleWorkers = 0;
+
+  void startWorker(size_t workerIdx, bool pin);
+
+  void workerLoop(size_t workerIdx);
+
+  // Pops from the worker's own deque, or steals from another one
+  bool takeJob(size_t workerIdx, Job& job);
+};
+}  // namespace cspot
@@ -325,7 +325,8 @@ NANOPB_STRUCT(cspot_proto::Session, Session_fields)
 
 namespace cspot_proto {
 struct Device {
-  cspot_proto::DeviceInfo deviceInfo;
+  // Only changes on setup, so its encoding is kept
+  nanopb_helper::CachedMessage<cspot_proto::DeviceInfo> deviceInfo;
   cspot_proto::PlayerState playerState;
 
   static auto bindFields(Device* self, bool isDecode) {
@@ -345,23 +346,21 @@ struct PutStateRequest {
   cspot_proto::Device device;
   MemberType memberType;
   bool isActive = false;
-  PutStateReason putStateReason;
   uint32_t messageId = 0;
   std::string lastCommandSentByDeviceId;
   uint32_t lastCommandMessageId = 0;
   uint64_t startedPlayingAt = 0;
   uint64_t hasBeenPlayingForMs = 0;
-  uint64_t clientSideTimestamp = 0;
   bool onlyWritePlayerState = false;
 
+  // put_state_reason and client_side_timestamp change on every PUT, they're
+  // appended to the encoded request so the rest of it can be compared
   static auto bindFields(PutStateRequest* self, bool isDecode) {
     _PutStateRequest rawProto = PutStateRequest_init_zero;
     nanopb_helper::bindField(rawProto.device, self->device, isDecode);
     nanopb_helper::bindVarintField(rawProto.member_type, self->memberType,
                                    isDecode);
     nanopb_helper::bindField(rawProto.is_active, self->isActive, isDecode);
-    nanopb_helper::bindVarintField(rawProto.put_state_reason,
-                                   self->putStateReason, isDecode);
     nanopb_helper::bindVarintField(rawProto.message_id, self->messageId,
                                    isDecode);
     nanopb_helper::bindField(rawProto.last_command_sent_by_device_id,
@@ -372,8 +371,6 @@ struct PutStateRequest {
                                    self->startedPlayingAt, isDecode);
     nanopb_helper::bindVarintField(rawProto.has_been_playing_for_ms,
                                    self->hasBeenPlayingForMs, isDecode);
-    nanopb_helper::bindVarintField(rawProto.client_side_timestamp,
-                                   self->clientSideTimestamp, isDecode);
     nanopb_helper::bindField(rawProto.only_write_player_state,
                              self->onlyWritePlayerState, isDecode);
     return rawProto;
@@ -403,3 +400,67 @@ struct TransferState {
 }  // namespace cspot_proto
 
 NANOPB_STRUCT(cspot_proto::TransferState, TransferState_fields)
+
+namespace cspot_proto {
+// Entry of the cluster's device map, only the device ID is kept
+struct ClusterDevice {
+  std::string deviceId;
+
+  static auto bindFields(ClusterDevice* self, bool isDecode) {
+    _Cluster_DeviceEntry rawProto = Cluster_DeviceEntry_init_zero;
+    nanopb_helper::bindField(rawProto.key, self->deviceId, isDecode);
+    return rawProto;
+  }
+};
+}  // namespace cspot_proto
+
+NANOPB_STRUCT(cspot_proto::ClusterDevice, Cluster_DeviceEntry_fields)
+
+namespace cspot_proto {
+struct Cluster {
+  int64_t changedTimestampMs = 0;
+  std::string activeDeviceId;
+  cspot_proto::PlayerState playerState;
+  std::vector<cspot_proto::ClusterDevice> devices;
+  bool needFullPlayerState = false;
+  int64_t serverTimestampMs = 0;
+
+  static auto bindFields(Cluster* self, bool isDecode) {
+    _Cluster rawProto = Cluster_init_zero;
+    nanopb_helper::bindVarintField(rawProto.changed_timestamp_ms,
+                                   self->changedTimestampMs, isDecode);
+    nanopb_helper::bindField(rawProto.active_device_id, self->activeDeviceId,
+                             isDecode);
+    nanopb_helper::bindField(rawProto.player_state, self->playerState,
+                             isDecode);
+    nanopb_helper::bindField(rawProto.device, self->devices, isDecode);
+    nanopb_helper::bindField(rawProto.need_full_player_state,
+                             self->needFullPlayerState, isDecode);
+    nanopb_helper::bindVarintField(rawProto.server_timestamp_ms,
+                                   self->serverTimestampMs, isDecode);
+    return rawProto;
+  }
+};
+}  // namespace cspot_proto
+
+NANOPB_STRUCT(cspot_proto::Cluster, Cluster_fields)
+
+namespace cspot_proto {
+struct ClusterUpdate {
+  cspot_proto::Cluster cluster;
+  ClusterUpdateReason updateReason;
+  std::vector<std::string> devicesThatChanged;
+
+  static auto bindFields(ClusterUpdate* self, bool isDecode) {
+    _ClusterUpdate rawProto = ClusterUpdate_init_zero;
+    nanopb_helper::bindField(rawProto.cluster, self->cluster, isDecode);
+    nanopb_helper::bindVarintField(rawProto.update_reason, self->updateReason,
+                                   isDecode);
+    nanopb_helper::bindField(rawProto.devices_that_changed,
+                             self->devicesThatChanged, isDecode);
+    return rawProto;
+  }
+};
+}  // namespace cspot_proto
+
+NANOPB_STRUCT(cspot_proto::ClusterUpdate, ClusterUpdate_fields)
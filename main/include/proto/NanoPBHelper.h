@@ -3,6 +3,7 @@
 // System includes
 #include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
 // NanoPB includes
@@ -338,6 +339,76 @@ bool encodeToVector(MessageT& message, std::vector<uint8_t>& output) {
                                                       &messagePtr);
 }
 
+// Appends a varint field to an encoded message. Fields may come in any order,
+// so a message can be extended after the fact.
+bool appendVarintField(std::vector<uint8_t>& output, uint32_t tag,
+                       uint64_t value);
+
+/**
+ * @brief Sub-message that rarely changes, keeping its encoded bytes. Once
+ * frozen, encoding splices the bytes in verbatim instead of walking the
+ * message's fields again. Mutable access drops the cached bytes.
+ */
+template <typename MessageT>
+class CachedMessage {
+ public:
+  const MessageT& get() const { return value; }
+
+  MessageT& mutableValue() {
+    encoded.clear();
+    isFrozen = false;
+    return value;
+  }
+
+  // Encodes the message once, call after it's filled in
+  bool freeze() {
+    encoded.clear();
+    isFrozen = encodeToVector(value, encoded);
+    return isFrozen;
+  }
+
+  bool frozen() const { return isFrozen; }
+
+  static bool decode(pb_istream_t* stream, const pb_field_t* field,
+                     void** arg) {
+    auto* self = static_cast<CachedMessage<MessageT>*>(*arg);
+    void* valuePtr = &self->mutableValue();
+    return StructCodec<MessageT>::decode(stream, field, &valuePtr);
+  }
+
+  static bool encode(pb_ostream_t* stream, const pb_field_t* field,
+                     void* const* arg) {
+    auto* self = static_cast<CachedMessage<MessageT>*>(*arg);
+    if (!self->isFrozen) {
+      void* valuePtr = &self->value;
+      return StructCodec<MessageT>::encodeSubmessage(stream, field, &valuePtr);
+    }
+
+    // A sub-message is encoded as length delimited bytes
+    if (!pb_encode_tag_for_field(stream, field)) {
+      return false;
+    }
+    return pb_encode_string(stream, self->encoded.data(),
+                            self->encoded.size());
+  }
+
+ private:
+  MessageT value{};
+  std::vector<uint8_t> encoded;
+  bool isFrozen = false;
+};
+
+template <typename MessageT>
+inline void bindField(pb_callback_t& pbField, CachedMessage<MessageT>& field,
+                      bool isDecode) {
+  if (isDecode) {
+    pbField.funcs.decode = &CachedMessage<MessageT>::decode;
+  } else {
+    pbField.funcs.encode = &CachedMessage<MessageT>::encode;
+  }
+  pbField.arg = &field;
+}
+
 template <typename MessageT>
 bool decodeFromBuffer(MessageT& message, const uint8_t* buffer,
                       size_t bufferLen) {
@@ -354,4 +425,27 @@ bool decodeFromVector(MessageT& message, const std::vector<uint8_t>& input) {
   return decodeFromBuffer(message, input.data(), input.size());
 }
 
+// Position of a stream decoding base64 text as it is read
+struct Base64StreamState {
+  const char* next;
+  const char* end;
+  uint32_t bits = 0;
+  uint8_t bitCount = 0;
+};
+
+// Input stream over base64 text, state must outlive the stream
+pb_istream_t pbIstreamFromBase64(std::string_view encoded,
+                                 Base64StreamState& state);
+
+template <typename MessageT>
+bool decodeFromBase64(MessageT& message, std::string_view encoded) {
+  message = MessageT();  // Reset the message to its default state
+
+  Base64StreamState state;
+  pb_istream_t stream = pbIstreamFromBase64(encoded, state);
+  void* messagePtr = &message;
+  return nanopb_helper::StructCodec<MessageT>::decode(&stream, nullptr,
+                                                      &messagePtr);
+}
+
 }  // namespace nanopb_helper
\ No newline at end of file
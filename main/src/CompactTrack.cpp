@@ -0,0 +1,180 @@
+#include "CompactTrack.h"
+
+#include <limits>
+#include <utility>
+
+using namespace cspot;
+
+namespace {
+const std::string_view trackPrefix = "spotify:track:";
+const std::string_view episodePrefix = "spotify:episode:";
+
+const std::string_view base62Alphabet =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+const size_t base62GidLength = 22;
+
+// Fixed width variant of base62Decode, without heap allocations
+bool decodeBase62Gid(std::string_view encoded, std::array<uint8_t, 16>& gid) {
+  if (encoded.size() != base62GidLength) {
+    return false;
+  }
+
+  gid.fill(0);
+  for (char c : encoded) {
+    size_t digit = base62Alphabet.find(c);
+    if (digit == std::string_view::npos) {
+      return false;
+    }
+
+    // gid = gid * 62 + digit, big endian
+    uint32_t carry = static_cast<uint32_t>(digit);
+    for (size_t i = gid.size(); i-- > 0;) {
+      uint32_t value = (gid[i] * 62U) + carry;
+      gid[i] = static_cast<uint8_t>(value & 0xFF);
+      carry = value >> 8;
+    }
+
+    if (carry != 0) {
+      return false;  // Doesn't fit in 128 bits
+    }
+  }
+
+  return true;
+}
+
+// Fixed width variant of base62Encode, zero padded to 22 characters
+void encodeBase62Gid(const std::array<uint8_t, 16>& gid, char* out) {
+  std::array<uint8_t, 16> number = gid;
+  for (size_t pos = base62GidLength; pos-- > 0;) {
+    // number /= 62, the remainder is the next digit
+    uint32_t remainder = 0;
+    for (auto& byte : number) {
+      uint32_t value = (remainder << 8) | byte;
+      byte = static_cast<uint8_t>(value / 62);
+      remainder = value % 62;
+    }
+    out[pos] = base62Alphabet[remainder];
+  }
+}
+}  // namespace
+
+CompactTrack TrackArena::intern(std::string_view uid, std::string_view uri,
+                                const cspot_proto::ContextIndex& index) {
+  CompactTrack track;
+  track.index = index;
+
+  if (!append(uid, track.uidOffset, track.uidLength)) {
+    track.uidLength = 0;
+  }
+
+  if (uri.empty()) {
+    return track;
+  }
+
+  if (uri.starts_with(trackPrefix) &&
+      decodeBase62Gid(uri.substr(trackPrefix.size()), track.gid)) {
+    track.kind = CompactTrack::Kind::Track;
+  } else if (uri.starts_with(episodePrefix) &&
+             decodeBase62Gid(uri.substr(episodePrefix.size()), track.gid)) {
+    track.kind = CompactTrack::Kind::Episode;
+  } else if (append(uri, track.uriOffset, track.uriLength)) {
+    track.kind = CompactTrack::Kind::Raw;
+  }
+
+  return track;
+}
+
+CompactTrack TrackArena::intern(const CompactTrack& track,
+                                const TrackArena& source) {
+  CompactTrack copy = track;
+  append(source.uid(track), copy.uidOffset, copy.uidLength);
+  if (track.kind == CompactTrack::Kind::Raw) {
+    UriBuffer unused;
+    append(source.uri(track, unused), copy.uriOffset, copy.uriLength);
+  }
+  return copy;
+}
+
+std::string_view TrackArena::uid(const CompactTrack& track) const {
+  return std::string_view(buffer).substr(track.uidOffset, track.uidLength);
+}
+
+std::string_view TrackArena::uri(const CompactTrack& track,
+                                 UriBuffer& uriBuffer) const {
+  std::string_view prefix;
+  switch (track.kind) {
+    case CompactTrack::Kind::None:
+      return {};
+    case CompactTrack::Kind::Raw:
+      return std::string_view(buffer).substr(track.uriOffset,
+                                             track.uriLength);
+    case CompactTrack::Kind::Track:
+      prefix = trackPrefix;
+      break;
+    case CompactTrack::Kind::Episode:
+      prefix = episodePrefix;
+      break;
+  }
+
+  prefix.copy(uriBuffer.data(), prefix.size());
+  encodeBase62Gid(track.gid, uriBuffer.data() + prefix.size());
+  return {uriBuffer.data(), prefix.size() + base62GidLength};
+}
+
+cspot_proto::ContextTrack TrackArena::materialize(
+    const CompactTrack& track) const {
+  UriBuffer uriBuffer;
+
+  cspot_proto::ContextTrack contextTrack;
+  contextTrack.uid = uid(track);
+  contextTrack.uri = uri(track, uriBuffer);
+  if (track.kind == CompactTrack::Kind::Track ||
+      track.kind == CompactTrack::Kind::Episode) {
+    contextTrack.gid.assign(track.gid.begin(), track.gid.end());
+  }
+  contextTrack.index = track.index;
+  return contextTrack;
+}
+
+void TrackArena::compact(RingBuffer<CompactTrack>& liveTracks) {
+  size_t liveSize = 0;
+  for (size_t i = 0; i < liveTracks.size(); i++) {
+    const auto& track = liveTracks[i];
+    liveSize += track.uidLength;
+    if (track.kind == CompactTrack::Kind::Raw) {
+      liveSize += track.uriLength;
+    }
+  }
+
+  if (liveSize * 2 >= buffer.size()) {
+    return;
+  }
+
+  std::string oldBuffer;
+  std::swap(buffer, oldBuffer);
+  buffer.reserve(liveSize);
+
+  std::string_view oldView(oldBuffer);
+  for (size_t i = 0; i < liveTracks.size(); i++) {
+    auto& track = liveTracks[i];
+    append(oldView.substr(track.uidOffset, track.uidLength), track.uidOffset,
+           track.uidLength);
+    if (track.kind == CompactTrack::Kind::Raw) {
+      append(oldView.substr(track.uriOffset, track.uriLength),
+             track.uriOffset, track.uriLength);
+    }
+  }
+}
+
+bool TrackArena::append(std::string_view text, uint32_t& offset,
+                        uint16_t& length) {
+  if (text.size() > std::numeric_limits<uint16_t>::max() ||
+      buffer.size() + text.size() > std::numeric_limits<uint32_t>::max()) {
+    return false;
+  }
+
+  offset = static_cast<uint32_t>(buffer.size());
+  length = static_cast<uint16_t>(text.size());
+  buffer.append(text);
+  return true;
+}
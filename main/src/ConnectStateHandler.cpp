@@ -1,6 +1,5 @@
 #include "ConnectStateHandler.h"
 
-#include <cJSON.h>
 #include "ContextTrackResolver.h"
 #include "SessionContext.h"
 #include "api/SpClient.h"
@@ -8,7 +7,6 @@
 #include "bell/Result.h"
 #include "connect.pb.h"
 #include "events/EventLoop.h"
-#include "mbedtls/base64.h"
 #include "metadata.pb.h"
 #include "proto/SpotifyId.h"
 
@@ -36,6 +34,36 @@ std::string generateSessionId() {
   });
   return sessionId;
 }
+
+// FNV-1a hash, to tell encoded requests apart without keeping their bytes
+uint32_t hashBytes(const std::vector<uint8_t>& bytes) {
+  uint32_t hash = 2166136261u;
+  for (uint8_t byte : bytes) {
+    hash = (hash ^ byte) * 16777619u;
+  }
+  return hash;
+}
+
+// Ranks reasons when merging pending changes, the higher one is sent
+int reasonPriority(PutStateReason reason) {
+  switch (reason) {
+    case PutStateReason_NEW_CONNECTION:
+      return 3;
+    case PutStateReason_NEW_DEVICE:
+    case PutStateReason_BECAME_INACTIVE:
+      return 2;
+    case PutStateReason_UNKNOWN_PUT_STATE_REASON:
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+// Reasons the server has to learn about without any delay
+bool flushesImmediately(PutStateReason reason) {
+  return reason == PutStateReason_NEW_CONNECTION ||
+         reason == PutStateReason_NEW_DEVICE;
+}
 };  // namespace
 
 ConnectStateHandler::ConnectStateHandler(
@@ -55,27 +83,15 @@ ConnectStateHandler::ConnectStateHandler(
   //       playerState.duration = currentTrackMetadata.durationMs;
   //     });
 
-  // this->sessionContext->eventLoop->registerHandler(
-  //     EventLoop::EventType::TRACKPROVIDER_UPDATED,
-  //     [this](cspot::EventLoop::Event&& event) {
-  //       auto& playerState = putStateRequestProto.device.playerState;
-  //       // playerState.track = trackProvider->getCurrentTrack();
-  //       playerState.nextTracks = trackProvider->getNextTracks();
-  //       playerState.prevTracks = trackProvider->getPreviousTracks();
-
-  //       auto currentContextIndex = trackProvider->getCurrentContextIndex();
-  //       if (currentContextIndex.has_value()) {
-  //         playerState.index.value = currentContextIndex.value();
-  //         playerState.index.hasValue = true;
-  //       } else {
-  //         playerState.index.hasValue = false;
-  //       }
-
-  //       BELL_LOG(info, LOG_TAG, "Updated player state with current track: {}",
-  //                playerState.track.uri);
-  //       // Update state
-  //       this->putState();
-  //     });
+  // A background refill landed, top the published next tracks back up
+  this->sessionContext->eventLoop->registerHandler(
+      EventLoop::EventType::TRACKPROVIDER_UPDATED,
+      [this](cspot::EventLoop::Event&& event) {
+        if (trackProvider->refreshNextTracks() &&
+            putStateRequestProto.isActive) {
+          markStateDirty();
+        }
+      });
 
   initialize();
 }
@@ -83,7 +99,7 @@ ConnectStateHandler::ConnectStateHandler(
 void ConnectStateHandler::initialize() {
   auto& deviceProto = putStateRequestProto.device;
 
-  auto& deviceInfo = deviceProto.deviceInfo;
+  auto& deviceInfo = deviceProto.deviceInfo.mutableValue();
   deviceInfo.canPlay = true;
   deviceInfo.volume = 100;
   deviceInfo.name = sessionContext->loginBlob->getDeviceName();
@@ -117,11 +133,16 @@ void ConnectStateHandler::initialize() {
   capabilities.is_voice_enabled = false;
   capabilities.needs_full_player_state = false;
   capabilities.supports_set_options_command = true;
-  capabilities.supports_gzip_pushes = false;  // TODO: Should we support this?
+  capabilities.supports_gzip_pushes = true;
   capabilities.has_supports_hifi = false;
 
   deviceInfo.capabilities.supportedTypes = supportedTypes;
 
+  // Device info stays as is from now on, every PUT reuses its encoding
+  if (!deviceProto.deviceInfo.freeze()) {
+    BELL_LOG(error, LOG_TAG, "Failed to pre-encode device info");
+  }
+
   auto& playerState = deviceProto.playerState;
   playerState.isSystemInitiated = true;
 
@@ -132,92 +153,289 @@ void ConnectStateHandler::initialize() {
   playerState.prevTracks.arg = trackProvider.get();
 }
 
-bell::Result<> ConnectStateHandler::handlePlayerCommand(cJSON* messageJson) {
-  cJSON* payload = cJSON_GetObjectItem(messageJson, "payload");
-  cJSON* command = cJSON_GetObjectItem(payload, "command");
-  cJSON* endpointItem = cJSON_GetObjectItem(command, "endpoint");
-  if (!cJSON_IsString(endpointItem)) {
+bell::Result<ConnectStateHandler::PlayerCommand>
+ConnectStateHandler::acceptPlayerCommand(const DealerMessage& request) {
+  const auto& command = request.command;
+  if (command.endpoint.empty()) {
     return std::errc::bad_message;
   }
-  std::string endpoint = endpointItem->valuestring;
 
-  // Assign the last message ID and device ID
-  cJSON* msgId = cJSON_GetObjectItem(payload, "message_id");
-  cJSON* sentBy = cJSON_GetObjectItem(payload, "sent_by_device_id");
-  if (cJSON_IsNumber(msgId))
-    putStateRequestProto.lastCommandMessageId = msgId->valueint;
-  if (cJSON_IsString(sentBy))
-    putStateRequestProto.lastCommandSentByDeviceId = sentBy->valuestring;
-
-  if (endpoint == "transfer") {
+  PlayerCommand playerCommand;
+  if (command.endpoint == "transfer") {
     BELL_LOG(info, LOG_TAG, "Received transfer command");
-    cJSON* dataItem = cJSON_GetObjectItem(command, "data");
-    cJSON* optionsItem = cJSON_GetObjectItem(command, "options");
-    std::string payloadDataStr = cJSON_IsString(dataItem) ? dataItem->valuestring : "";
-    return handleTransferCommand(payloadDataStr, optionsItem);
-  } else if (endpoint == "skip_next") {
+    playerCommand.type = PlayerCommand::Type::TRANSFER;
+
+    // Base64 is decoded as nanopb reads, straight from the dealer frame
+    if (!nanopb_helper::decodeFromBase64(playerCommand.transferState,
+                                         command.data)) {
+      BELL_LOG(error, LOG_TAG, "Failed to decode transfer state");
+      return std::errc::bad_message;
+    }
+  } else if (command.endpoint == "skip_next") {
     BELL_LOG(info, LOG_TAG, "Received skip_next command");
-    return handleSkipNextCommand();
+    playerCommand.type = PlayerCommand::Type::SKIP_NEXT;
   } else {
-    BELL_LOG(info, LOG_TAG, "Received unknown command: {}", endpoint);
+    BELL_LOG(info, LOG_TAG, "Received unknown command: {}", command.endpoint);
     return std::errc::operation_not_supported;
   }
 
-  return {};
+  // Assign the last message ID and device ID
+  if (request.messageId.has_value())
+    putStateRequestProto.lastCommandMessageId = *request.messageId;
+  if (!request.sentByDeviceId.empty())
+    putStateRequestProto.lastCommandSentByDeviceId = request.sentByDeviceId;
+
+  return playerCommand;
 }
 
-bell::Result<> ConnectStateHandler::putState(PutStateReason reason) {
-  // get milliseconds since epoch;
-  putStateRequestProto.clientSideTimestamp =
+AsyncTask<> ConnectStateHandler::applyPlayerCommand(
+    PlayerCommand command, const DealerMessage& request) {
+  bell::Result<> res;
+  switch (command.type) {
+    case PlayerCommand::Type::TRANSFER:
+      res = co_await handleTransferCommand(command.transferState,
+                                           request.command.options);
+      break;
+    case PlayerCommand::Type::SKIP_NEXT:
+      res = handleSkipNextCommand();
+      break;
+  }
+
+  if (res) {
+    co_return;
+  }
+
+  if (res.getError() == std::errc::operation_canceled) {
+    // A newer command took over, it publishes the state instead
+    co_return;
+  }
+
+  BELL_LOG(error, LOG_TAG, "Failed to apply {} command: {}",
+           request.command.endpoint, res.errorMessage());
+
+  // The controller already got its ack, let it know through the state
+  if (command.type == PlayerCommand::Type::TRANSFER) {
+    putStateRequestProto.isActive = false;
+    putStateRequestProto.device.playerState.isPlaying = false;
+    playbackClock.pause(sessionContext->serverClock->nowMs());
+    updatePlaybackPosition();
+    markStateDirty(PutStateReason_BECAME_INACTIVE);
+  } else {
+    markStateDirty();
+  }
+}
+
+void ConnectStateHandler::markStateDirty(PutStateReason reason) {
+  if (!stateDirty || reasonPriority(reason) > reasonPriority(pendingReason)) {
+    pendingReason = reason;
+  }
+  stateDirty = true;
+
+  if (flushesImmediately(reason)) {
+    flushState();
+  } else if (!flushScheduled && !putInFlight) {
+    scheduleFlush();
+  }
+}
+
+void ConnectStateHandler::scheduleFlush() {
+  // The window starts with the first change, so a steady stream of changes
+  // still gets published every putStateDebounceMs
+  flushScheduled = true;
+  flushTimer = sessionContext->eventLoop->postDelayed(
+      EventLoop::EventType::CALLBACK,
+      EventLoop::Callback(
+          [this, lifetime = std::weak_ptr<bool>(lifetimeToken)]() {
+            if (!lifetime.lock()) {
+              return;
+            }
+            flushScheduled = false;
+            flushState();
+          }),
+      putStateDebounceMs);
+}
+
+void ConnectStateHandler::flushState() {
+  if (!stateDirty) {
+    return;
+  }
+
+  if (putInFlight) {
+    flushAfterPut = true;
+    return;
+  }
+
+  if (flushScheduled) {
+    flushTimer.cancel();
+    flushScheduled = false;
+  }
+
+  putStateRequestProto.memberType = MemberType_CONNECT_STATE;
+
+  // Encoded on the loop, as the state keeps changing while the PUT runs. The
+  // job owns its copy, nothing on the loop can touch it meanwhile.
+  std::vector<uint8_t> encodedState;
+  encodedState.reserve(encodedStateSize);
+  if (!nanopb_helper::encodeToVector(putStateRequestProto, encodedState)) {
+    // The change stays pending, along with its reason, and is tried again
+    BELL_LOG(error, LOG_TAG, "Failed to encode connect state");
+    scheduleFlush();
+    return;
+  }
+
+  // Plain state changes the server already knows about are dropped, a
+  // presence change is always sent
+  uint32_t stateHash = hashBytes(encodedState);
+  if (reasonPriority(pendingReason) <= 1 && serverHasState(stateHash)) {
+    BELL_LOG(debug, LOG_TAG, "Cluster is up to date, skipping state PUT");
+    stateDirty = false;
+    pendingReason = PutStateReason_UNKNOWN_PUT_STATE_REASON;
+    return;
+  }
+
+  // Stamped after hashing, the bytes hashed above don't change per PUT
+  auto clientSideTimestamp =
       std::chrono::duration_cast<std::chrono::milliseconds>(
           std::chrono::system_clock::now().time_since_epoch())
           .count();
-  putStateRequestProto.memberType = MemberType_CONNECT_STATE;
-  putStateRequestProto.putStateReason = reason;
-
-  return this->spClient->putConnectState(putStateRequestProto);
-  return {};
+  if (!nanopb_helper::appendVarintField(
+          encodedState, PutStateRequest_put_state_reason_tag,
+          static_cast<uint64_t>(pendingReason)) ||
+      !nanopb_helper::appendVarintField(
+          encodedState, PutStateRequest_client_side_timestamp_tag,
+          static_cast<uint64_t>(clientSideTimestamp))) {
+    BELL_LOG(error, LOG_TAG, "Failed to encode connect state");
+    scheduleFlush();
+    return;
+  }
+  encodedStateSize = encodedState.size();
+
+  stateDirty = false;
+  pendingReason = PutStateReason_UNKNOWN_PUT_STATE_REASON;
+
+  publishedStateHash = stateHash;
+  putInFlight = true;
+  sessionContext->workerPool->submit(
+      [spClient = spClient, state = std::move(encodedState),
+       connectionId = sessionContext->sessionId]() {
+        return spClient->putConnectState(state, connectionId);
+      },
+      [this, lifetime = std::weak_ptr<bool>(lifetimeToken)](
+          bell::Result<> result) {
+        if (lifetime.lock()) {
+          onPutStateDone(std::move(result));
+        }
+      });
 }
 
-bell::Result<> ConnectStateHandler::handleTransferCommand(
-    std::string_view payloadDataStr, cJSON* options) {
-  size_t olen = 0;
-
-  // Get the size of the base64 decoded data
-  auto base64DecodeRes = mbedtls_base64_decode(
-      nullptr, 0, &olen,
-      reinterpret_cast<const uint8_t*>(payloadDataStr.data()),
-      payloadDataStr.size());
-  if (base64DecodeRes == 0) {
-    BELL_LOG(error, LOG_TAG, "Failed to base64 decode payload data");
-    return std::errc::bad_message;
+void ConnectStateHandler::onPutStateDone(bell::Result<> result) {
+  putInFlight = false;
+  if (!result) {
+    BELL_LOG(error, LOG_TAG, "Failed to put connect state: {}",
+             result.errorMessage());
+    // The server may not have it, the next flush sends it again
+    publishedStateHash.reset();
   }
 
-  std::vector<uint8_t> decodedData(olen);
-  // Decode the base64 data
-  base64DecodeRes = mbedtls_base64_decode(
-      decodedData.data(), decodedData.size(), &olen,
-      reinterpret_cast<const uint8_t*>(payloadDataStr.data()),
-      payloadDataStr.size());
-  if (base64DecodeRes != 0) {
-    BELL_LOG(error, LOG_TAG, "Failed to base64 decode payload data");
-    return std::errc::bad_message;
+  // Publish whatever changed while the PUT was running
+  if (flushAfterPut) {
+    flushAfterPut = false;
+    flushState();
+  } else if (stateDirty && !flushScheduled) {
+    scheduleFlush();
   }
+}
 
-  cspot_proto::TransferState transferState;
+void ConnectStateHandler::handleClusterUpdate(
+    cspot_proto::ClusterUpdate&& update) {
+  cluster = std::move(update.cluster);
 
-  bool res = nanopb_helper::decodeFromVector(transferState, decodedData);
-  if (!res) {
-    BELL_LOG(error, LOG_TAG, "Failed to decode transfer state");
-    return std::errc::bad_message;
+  if (!putStateRequestProto.isActive) {
+    return;
   }
 
-  BELL_LOG(info, LOG_TAG, "Transfer state decoded successfully");
+  const auto& deviceId = putStateRequestProto.device.deviceInfo.get().deviceId;
+  if (cluster->activeDeviceId == deviceId) {
+    activeConfirmed = true;
+    if (cluster->needFullPlayerState) {
+      markStateDirty();
+    }
+    return;
+  }
 
-  // Set active state
-  putStateRequestProto.isActive = true;
+  // Until the server lists us as active, the cluster may still be older than
+  // our own transfer
+  if (!activeConfirmed || cluster->activeDeviceId.empty()) {
+    return;
+  }
+
+  BELL_LOG(info, LOG_TAG, "Playback moved to device {}",
+           cluster->activeDeviceId);
+
+  // Cancels a transfer that is still resolving its context
+  transferGeneration++;
+
+  putStateRequestProto.isActive = false;
+  putStateRequestProto.device.playerState.isPlaying = false;
+  activeConfirmed = false;
+  playbackClock.pause(sessionContext->serverClock->nowMs());
+  updatePlaybackPosition();
+  markStateDirty(PutStateReason_BECAME_INACTIVE);
+}
+
+int64_t ConnectStateHandler::currentPositionMs() const {
+  return playbackClock.positionAt(sessionContext->serverClock->nowMs());
+}
 
+void ConnectStateHandler::updatePlaybackPosition() {
+  // Only the anchor is published, other devices extrapolate from it as well
   auto& playerState = putStateRequestProto.device.playerState;
+  playerState.timestamp = playbackClock.anchorTimestampMs();
+  playerState.positionAsOfTimestamp = playbackClock.anchorPositionMs();
+  playerState.playbackSpeed = playbackClock.rate();
+}
+
+bool ConnectStateHandler::serverHasState(uint32_t stateHash) const {
+  if (!cluster || !activeConfirmed || !putStateRequestProto.isActive) {
+    return false;
+  }
+
+  // Any field the last PUT didn't carry has to go out, down to the options,
+  // the track lists or a command that changed nothing
+  if (stateHash != publishedStateHash) {
+    return false;
+  }
+
+  // The cluster has to reflect that PUT, and not a newer change from elsewhere
+  const auto& ours = putStateRequestProto.device.playerState;
+  const auto& theirs = cluster->playerState;
+  if (ours.index.hasValue != theirs.index.hasValue ||
+      (ours.index.hasValue &&
+       (ours.index.value.page != theirs.index.value.page ||
+        ours.index.value.track != theirs.index.value.track))) {
+    return false;
+  }
+
+  return ours.timestamp == theirs.timestamp &&
+         ours.positionAsOfTimestamp == theirs.positionAsOfTimestamp &&
+         ours.isPlaying == theirs.isPlaying &&
+         ours.isPaused == theirs.isPaused &&
+         ours.isBuffering == theirs.isBuffering &&
+         ours.contextUri == theirs.contextUri &&
+         ours.track.uri == theirs.track.uri &&
+         ours.track.uid == theirs.track.uid &&
+         ours.sessionId == theirs.sessionId;
+}
+
+AsyncTask<bell::Result<>> ConnectStateHandler::handleTransferCommand(
+    const cspot_proto::TransferState& transferState,
+    const DealerMessage::CommandOptions& options) {
+  // Cancels an older transfer that is still resolving its context
+  uint32_t transferId = ++transferGeneration;
+
+  // The new state is built aside, the published one stays untouched until
+  // this transfer turns out to be the newest
+  auto playerState = putStateRequestProto.device.playerState;
 
   if (transferState.current_session.originalSessionId.hasValue) {
     playerState.sessionId =
@@ -230,14 +448,10 @@ bell::Result<> ConnectStateHandler::handleTransferCommand(
   // No playback yet
   playerState.isPlaying = true;
   playerState.isBuffering = false;
-  playerState.timestamp = transferState.playback.timestamp;
 
   bool shouldPause = transferState.playback.isPaused;
-  if (options) {
-    cJSON* restore = cJSON_GetObjectItem(options, "restore_paused");
-    if (cJSON_IsString(restore) && std::string(restore->valuestring) == "restore") {
-      shouldPause = true;
-    }
+  if (options.restorePaused == "restore") {
+    shouldPause = true;
   }
 
   playerState.isPaused = shouldPause;
@@ -246,27 +460,60 @@ bell::Result<> ConnectStateHandler::handleTransferCommand(
   playerState.options = transferState.options;
   playerState.track.uid = transferState.current_session.currentUid;
   playerState.position = 0;
-  playerState.positionAsOfTimestamp =
-      transferState.playback.positionAsOfTimestamp;
-  putStateRequestProto.startedPlayingAt = transferState.playback.timestamp;
-  putStateRequestProto.hasBeenPlayingForMs = 0;
 
-  trackProvider->setQueue(transferState.queue);
+  // The transferred anchor is in server time already, and stays valid
+  PlaybackClock transferClock;
+  transferClock.restore(transferState.playback.timestamp,
+                        transferState.playback.positionAsOfTimestamp,
+                        transferState.playback.playbackSpeed,
+                        transferState.playback.isPaused);
+
+  // A source that was playing kept advancing since its anchor, it's paused
+  // where it got to. Pausing an already paused clock keeps its anchor.
+  if (shouldPause) {
+    transferClock.pause(sessionContext->serverClock->nowMs());
+  }
 
   SpotifyIdType trackType =
       SpotifyId::getTypeFromContext(transferState.current_session.context.uri);
   SpotifyId trackId =
       SpotifyId(trackType, transferState.playback.currentTrack.gid);
 
-  auto provideRes = trackProvider->loadTrackAndContext(
-      transferState.current_session.currentUid, trackId.uri,
-      transferState.current_session.context);
+  // Resolving the context blocks on HTTP, so it is loaded into a fresh provider
+  // on a worker, while the loop keeps serving the current one
+  auto newTrackProvider =
+      std::make_shared<TrackProvider>(sessionContext, spClient);
+  newTrackProvider->setQueue(transferState.queue);
+
+  auto provideRes = co_await runOnWorker(
+      *sessionContext->workerPool,
+      [newTrackProvider, trackUid = transferState.current_session.currentUid,
+       trackUri = trackId.uri,
+       context = transferState.current_session.context]() {
+        return newTrackProvider->loadTrackAndContext(trackUid, trackUri,
+                                                     context);
+      });
+
+  // Checked before anything else, a superseded transfer must not report its
+  // failure over the newer one's state
+  if (transferId != transferGeneration) {
+    BELL_LOG(info, LOG_TAG, "Transfer superseded by a newer one");
+    co_return std::errc::operation_canceled;
+  }
+
   if (!provideRes) {
     BELL_LOG(error, LOG_TAG, "Failed to provide current track: {}",
              provideRes.errorMessage());
-    return provideRes.getError();
+    co_return provideRes.getError();
   }
 
+  trackProvider = std::move(newTrackProvider);
+  playerState.nextTracks.arg = trackProvider.get();
+  playerState.prevTracks.arg = trackProvider.get();
+
+  // A refill may have finished while the provider was still loading
+  trackProvider->refreshNextTracks();
+
   auto track = trackProvider->currentTrack();
   if (track) {
     playerState.track = *track;
@@ -276,9 +523,18 @@ bell::Result<> ConnectStateHandler::handleTransferCommand(
     playerState.index.hasValue = false;
   }
 
-  putState();
+  // Set active state, confirmed once the cluster lists us
+  putStateRequestProto.isActive = true;
+  activeConfirmed = false;
+  putStateRequestProto.device.playerState = std::move(playerState);
+  playbackClock = transferClock;
+  updatePlaybackPosition();
+  putStateRequestProto.startedPlayingAt = transferState.playback.timestamp;
+  putStateRequestProto.hasBeenPlayingForMs = 0;
+
+  markStateDirty();
 
-  return {};
+  co_return bell::Result<>();
 }
 
 bell::Result<> ConnectStateHandler::handleSkipNextCommand() {
@@ -298,13 +554,10 @@ bell::Result<> ConnectStateHandler::handleSkipNextCommand() {
     playerState.index.hasValue = false;
   }
 
-  playerState.positionAsOfTimestamp = 0;
-  playerState.timestamp =
-      std::chrono::duration_cast<std::chrono::milliseconds>(
-          std::chrono::system_clock::now().time_since_epoch())
-          .count();
+  playbackClock.seek(0, sessionContext->serverClock->nowMs());
+  updatePlaybackPosition();
 
-  putState();
+  markStateDirty();
 
   return {};
 }
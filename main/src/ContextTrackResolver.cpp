@@ -1,5 +1,6 @@
 #include "ContextTrackResolver.h"
 
+#include <algorithm>
 #include <span>
 #include <system_error>
 
@@ -51,7 +52,15 @@ class ContextPageParseContext : public picojson::null_parse_context {
       ContextTrackResolver::ContextTrackParseState* parseState,
       ContextTrackResolver::ResolvedContextPage* contextPage,
       bool isRoot = false)
-      : parseState(parseState), contextPage(contextPage), isRoot(isRoot) {}
+      : parseState(parseState), contextPage(contextPage), isRoot(isRoot) {
+    const auto& targetId = parseState->targetTrackId;
+    if (targetId.uid.has_value()) {
+      targetUidKey = TrackIndex::uidKey(targetId.uid.value());
+    }
+    if (targetId.uri.has_value()) {
+      targetUriKey = TrackIndex::uriKey(targetId.uri.value());
+    }
+  }
 
   template <typename Iter>
   bool parse_array_item(picojson::input<Iter>& in, size_t idx) {
@@ -64,8 +73,10 @@ class ContextPageParseContext : public picojson::null_parse_context {
         // Keep track of the index of each track in the context page
         contextPage->trackIndexes.push_back(idx);
 
-        if ((contextPage->fetchWindowEnd - contextPage->fetchWindowStart) <
-            (parseState->maxWindowSize)) {
+        // Until the target is found the window slides along, below
+        if (!parseState->foundTrackIndex ||
+            (contextPage->fetchWindowEnd - contextPage->fetchWindowStart) <
+                (parseState->maxWindowSize)) {
           contextPage->fetchWindowEnd++;  // Expand the fetch window
         }
       }
@@ -91,41 +102,40 @@ class ContextPageParseContext : public picojson::null_parse_context {
         contextPage->fetchWindowEnd++;
 
         // Remove the oldest track from the cache
-        parseState->tracks.erase(parseState->tracks.begin());
+        parseState->tracks.popFront();
       }
 
-      if ((trackId == parseState->targetTrackId) &&
-          !parseState->foundTrackIndex) {
+      if (!parseState->foundTrackIndex && isTargetTrack()) {
         uint32_t previousTracksInWindow = (idx - contextPage->fetchWindowStart);
         uint32_t maxPreviousTracks = (parseState->maxWindowSize - 1) / 2;
         if (previousTracksInWindow > maxPreviousTracks) {
           uint32_t tracksToRemove = previousTracksInWindow - maxPreviousTracks;
           contextPage->fetchWindowStart += tracksToRemove;
-          parseState->tracks.erase(parseState->tracks.begin(),
-                                   parseState->tracks.begin() + tracksToRemove);
+          parseState->tracks.popFront(tracksToRemove);
         }
 
         // If this is the current track, update the index in the cache
         parseState->foundTrackIndex.emplace(
             static_cast<uint32_t>(parseState->tracks.size()));
+        parseState->pageIndex = contextPage->pageIndex;
       }
 
-      // Construct the fetch window
-      tcb::span<uint32_t> fetchWindowIds = {
-          contextPage->trackIndexes.data() + contextPage->fetchWindowStart,
-          contextPage->trackIndexes.data() + contextPage->fetchWindowEnd};
-
-      auto* idxInWindow =
-          std::find(fetchWindowIds.begin(), fetchWindowIds.end(), idx);
-      if (idxInWindow != fetchWindowIds.end()) {
-        uint32_t indexToInsert =
-            std::distance(fetchWindowIds.begin(), idxInWindow);
-        if (parseState->tracks.size() < indexToInsert + 1) {
-          parseState->tracks.resize(indexToInsert + 1);
+      // Track indexes are consecutive, so the fetch window is a plain range
+      uint32_t windowStart = contextPage->fetchWindowStart;
+      uint32_t windowEnd = contextPage->fetchWindowEnd;
+      if (isCollectedPage() && windowStart < windowEnd &&
+          windowStart < contextPage->trackIndexes.size() &&
+          idx >= contextPage->trackIndexes[windowStart] &&
+          idx - contextPage->trackIndexes[windowStart] <
+              windowEnd - windowStart) {
+        uint32_t indexToInsert = idx - contextPage->trackIndexes[windowStart];
+        while (parseState->tracks.size() < indexToInsert + 1) {
+          parseState->tracks.pushBack(CompactTrack());
         }
 
         // Insert the current track at the correct index
-        parseState->tracks[indexToInsert] = currentTrack;
+        parseState->tracks[indexToInsert] = parseState->arena->intern(
+            currentTrack.uid, currentTrack.uri, currentTrack.index);
       }
 
       return true;
@@ -164,6 +174,31 @@ class ContextPageParseContext : public picojson::null_parse_context {
   ContextTrackResolver::ResolvedContextPage* contextPage;
   bool isRoot = false;
 
+  // Keys of the target track, 0 when the ID part is missing
+  uint64_t targetUidKey = 0;
+  uint64_t targetUriKey = 0;
+
+  // Other pages of the root are parsed along, but their tracks are skipped
+  bool isCollectedPage() const {
+    return !parseState->pageIndex.has_value() ||
+           parseState->pageIndex.value() ==
+               static_cast<uint32_t>(contextPage->pageIndex);
+  }
+
+  // Same rules as TrackId::operator==, strings are only compared on a hit
+  bool isTargetTrack() const {
+    const auto& targetId = parseState->targetTrackId;
+    if (targetUidKey != 0 && !currentTrack.uid.empty()) {
+      return TrackIndex::uidKey(currentTrack.uid) == targetUidKey &&
+             currentTrack.uid == targetId.uid.value();
+    }
+    if (targetUriKey != 0 && !currentTrack.uri.empty()) {
+      return TrackIndex::uriKey(currentTrack.uri) == targetUriKey &&
+             currentTrack.uri == targetId.uri.value();
+    }
+    return false;
+  }
+
   cspot_proto::ContextTrack currentTrack;
   ContextTrackParseContext contextTrackParser{&currentTrack};
 };
@@ -188,6 +223,11 @@ class ContextRootParseContext : public picojson::null_parse_context {
       std::cout << "Assigning page index " << idx << " to context page " << std::endl;
       contextPages->at(idx).pageIndex = static_cast<int>(idx);
 
+      // Only the page of the target track is kept, so restart until it shows
+      if (!parseState->foundTrackIndex) {
+        parseState->tracks.clear();
+      }
+
       auto pageCtx =
           ContextPageParseContext(parseState, &(*contextPages)[idx], true);
 
@@ -215,14 +255,65 @@ class ContextRootParseContext : public picojson::null_parse_context {
   ContextTrackResolver::ContextTrackParseState* parseState;
   std::vector<ContextTrackResolver::ResolvedContextPage>* contextPages;
 };
+
+// Fetches and parses into the fetch alone, so it is safe to run on a worker
+bell::Result<> runContextFetch(SpClient& spClient,
+                               ContextTrackResolver::ContextFetch& fetch) {
+  auto reader =
+      fetch.isRoot ? spClient.contextResolve(fetch.url)
+                   : spClient.doRequest(bell::http::Method::GET,
+                                        fetch.url.substr(5));  // remove hm://
+  if (!reader) {
+    return reader.getError();
+  }
+
+  auto* rawDataStream = reader.getValue().getStream();
+
+  // Set here, as the fetch may have moved since it was planned
+  fetch.parseState.arena = &fetch.arena;
+
+  std::string parseError;
+  if (fetch.isRoot) {
+    auto parseCtx = ContextRootParseContext(&fetch.parseState, &fetch.pages);
+    picojson::_parse(parseCtx,
+                     std::istreambuf_iterator<char>(rawDataStream->rdbuf()),
+                     std::istreambuf_iterator<char>(), &parseError);
+  } else {
+    auto parseCtx = ContextPageParseContext(&fetch.parseState,
+                                            &fetch.pages[fetch.pageIndex]);
+    picojson::_parse(parseCtx,
+                     std::istreambuf_iterator<char>(rawDataStream->rdbuf()),
+                     std::istreambuf_iterator<char>(), &parseError);
+  }
+
+  if (!parseError.empty()) {
+    BELL_LOG(error, "ContextTrackResolver", "Failed to parse context data: {}",
+             parseError);
+    return std::errc::invalid_argument;
+  }
+  return {};
+}
+
+// Whether the track at after directly follows the one at before
+bool isAdjacent(const cspot_proto::ContextIndex& before,
+                const cspot_proto::ContextIndex& after) {
+  if (after.page == before.page) {
+    return after.track == before.track + 1;
+  }
+  return after.page == before.page + 1 && after.track == 0;
+}
 }  // namespace
 
-ContextTrackResolver::ContextTrackResolver(std::shared_ptr<SpClient> spClient,
-                                           uint32_t maxWindowSize,
-                                           uint32_t trackUpdateThreshold)
+ContextTrackResolver::ContextTrackResolver(
+    std::shared_ptr<SpClient> spClient, std::shared_ptr<WorkerPool> workerPool,
+    uint32_t maxWindowSize, uint32_t trackUpdateThreshold)
     : spClient(std::move(spClient)),
+      workerPool(std::move(workerPool)),
       maxWindowSize(maxWindowSize),
-      trackUpdateThreshold(trackUpdateThreshold) {}
+      trackUpdateThreshold(trackUpdateThreshold),
+      cacheCapacity(2 * maxWindowSize) {
+  trackCache.reserve(cacheCapacity);
+}
 
 void ContextTrackResolver::updateContext(
     const std::string& rootContextUrl,
@@ -231,6 +322,9 @@ void ContextTrackResolver::updateContext(
   this->rootContextUrl = rootContextUrl.substr(10);  // remove context://
   this->currentTrackId.uid = currentTrackUid;
   this->currentTrackId.uri = currentTrackUri;
+
+  // A fetch still running belongs to the previous context
+  pendingFetch.reset();
 }
 
 bell::Result<cspot_proto::ContextTrack>
@@ -242,22 +336,23 @@ ContextTrackResolver::getCurrentTrack() {
     return res.getError();
   }
 
-  return trackCache[currentTrackInCacheIndex.value()];
+  return trackArena.materialize(trackCache[currentTrackInCacheIndex.value()]);
 }
 
-tcb::span<cspot_proto::ContextTrack> ContextTrackResolver::previousTracks() {
+ContextTrackResolver::TrackView ContextTrackResolver::previousTracks() {
   if (!currentTrackInCacheIndex.has_value()) {
     return {};
   }
-  return {trackCache.data(), currentTrackInCacheIndex.value()};
+  return trackCache.view(0, currentTrackInCacheIndex.value());
 }
 
-tcb::span<cspot_proto::ContextTrack> ContextTrackResolver::nextTracks() {
+ContextTrackResolver::TrackView ContextTrackResolver::nextTracks() {
   if (!currentTrackInCacheIndex.has_value()) {
     return {};
   }
-  return {trackCache.data() + currentTrackInCacheIndex.value() + 1,
-          trackCache.size() - currentTrackInCacheIndex.value() - 1};
+  return trackCache.view(
+      currentTrackInCacheIndex.value() + 1,
+      trackCache.size() - currentTrackInCacheIndex.value() - 1);
 }
 
 bell::Result<cspot_proto::ContextTrack> ContextTrackResolver::next() {
@@ -269,18 +364,24 @@ bell::Result<cspot_proto::ContextTrack> ContextTrackResolver::next() {
   }
 
   if (currentTrackInCacheIndex.value() + 1 >= trackCache.size()) {
+    if (pendingFetch) {
+      BELL_LOG(info, LOG_TAG, "Next tracks are still being fetched");
+      return std::errc::resource_unavailable_try_again;
+    }
     BELL_LOG(error, LOG_TAG, "No next track available");
     return std::errc::no_message_available;
   }
 
   if (currentTrackInCacheIndex.value() > trackUpdateThreshold) {
     // Erase oldest track
-    trackCache.erase(trackCache.begin());
+    dropFromCacheFront(1);
   } else {
     currentTrackInCacheIndex.value()++;
   }
 
-  return trackCache[currentTrackInCacheIndex.value()];
+  prefetchIfLow();
+
+  return trackArena.materialize(trackCache[currentTrackInCacheIndex.value()]);
 }
 
 bell::Result<cspot_proto::ContextTrack> ContextTrackResolver::previous() {
@@ -291,295 +392,455 @@ bell::Result<cspot_proto::ContextTrack> ContextTrackResolver::previous() {
     return res.getError();
   }
 
-  if (currentTrackInCacheIndex.value() + 1 >= trackCache.size()) {
-    BELL_LOG(error, LOG_TAG, "No next track available");
+  if (currentTrackInCacheIndex.value() == 0) {
+    if (pendingFetch) {
+      BELL_LOG(info, LOG_TAG, "Previous tracks are still being fetched");
+      return std::errc::resource_unavailable_try_again;
+    }
+    BELL_LOG(error, LOG_TAG, "No previous track available");
     return std::errc::no_message_available;
   }
 
-  trackCache.erase(trackCache.end());
-
   // Go to previous track
   currentTrackInCacheIndex.value() -= 1;
 
-  return trackCache[currentTrackInCacheIndex.value()];
+  prefetchIfLow();
+
+  return trackArena.materialize(trackCache[currentTrackInCacheIndex.value()]);
 }
 
-bell::Result<> ContextTrackResolver::ensureContextTracks() {
-  if (!currentTrackInCacheIndex.has_value()) {
-    // No track index yet, resolve root context
-    auto res = resolveRootContext();
-    if (!res) {
-      BELL_LOG(error, LOG_TAG, "Failed to resolve root context: {}",
-               res.errorMessage());
-      return res.getError();
-    }
+bell::Result<cspot_proto::ContextTrack> ContextTrackResolver::skipTo(
+    const std::string& uid, const std::string& uri) {
+  auto position = findInCache(TrackId(uid, uri));
+  if (!position.has_value()) {
+    BELL_LOG(error, LOG_TAG, "Track to skip to is not cached");
+    return std::errc::invalid_argument;
   }
 
-  if (((trackCache.size() - currentTrackInCacheIndex.value()) <
-       trackUpdateThreshold)) {
-    auto& lastTrackIndex = trackCache.back().index;
-    uint32_t pageIndex = lastTrackIndex.page;
-    if (resolvedContextPages[pageIndex].fetchWindowEnd ==
-        resolvedContextPages[pageIndex].trackIndexes.size()) {
-      // Skip page, as we are on the last track
-      pageIndex++;
-    }
-    if (pageIndex >= resolvedContextPages.size()) {
-      return {};  // No more pages to resolve
-    }
-
-    BELL_LOG(debug, LOG_TAG,
-             "Not enough tracks after current track, resolving more tracks");
-
-    auto res = resolvedContextPages[pageIndex].isInRoot
-                   ? resolveRootContext()
-                   : resolveContextPage(resolvedContextPages[pageIndex]);
-    if (!res) {
-      BELL_LOG(error, LOG_TAG, "Failed to resolve context page: {}",
-               res.errorMessage());
-      return res.getError();
-    }
+  currentTrackInCacheIndex = position;
 
-  } else if (currentTrackInCacheIndex.value() < trackUpdateThreshold &&
-             !(trackCache.front().index.page == 0 &&
-               resolvedContextPages[0].fetchWindowStart == 0)) {
-    BELL_LOG(
-        debug, LOG_TAG,
-        "Not enough tracks before current track, resolving more tracks, {} - {}",
-        resolvedContextPages[0].fetchWindowStart,
-        trackCache.front().index.page);
-
-    auto& firstTrackIndex = trackCache.front().index;
+  auto res = ensureContextTracks();
+  if (!res) {
+    BELL_LOG(error, LOG_TAG, "Failed to ensure context tracks: {}",
+             res.errorMessage());
+    return res.getError();
+  }
 
-    uint32_t pageIndex = firstTrackIndex.page;
+  return trackArena.materialize(trackCache[currentTrackInCacheIndex.value()]);
+}
 
-    if (resolvedContextPages[firstTrackIndex.page].firstId ==
-        trackCache.front()) {
-      // Skip page, as we are on the first track
-      if (firstTrackIndex.page == 0) {
-        return {};  // No previous page to resolve
+std::optional<uint32_t> ContextTrackResolver::findInCache(
+    const TrackId& trackId) const {
+  // The first cached copy wins when a context holds the track more than once
+  auto confirm = [&](uint64_t key) -> std::optional<uint32_t> {
+    std::optional<uint32_t> first;
+    trackCacheIndex.forEachPosition(key, [&](uint32_t indexed) {
+      uint32_t position = indexed - trackCache.frontIndex();
+      if (position < trackCache.size() &&
+          (!first.has_value() || position < first.value()) &&
+          isSameTrack(trackId, trackCache[position])) {
+        first = position;
       }
-      pageIndex = firstTrackIndex.page - 1;
-    }
+    });
+    return first;
+  };
 
-    auto res = resolvedContextPages[pageIndex].isInRoot
-                   ? resolveRootContext()
-                   : resolveContextPage(resolvedContextPages[pageIndex]);
-    if (!res) {
-      BELL_LOG(error, LOG_TAG, "Failed to resolve context page: {}",
-               res.errorMessage());
-      return res.getError();
+  if (trackId.uid.has_value()) {
+    auto position = confirm(TrackIndex::uidKey(trackId.uid.value()));
+    if (position.has_value()) {
+      return position;
     }
   }
 
-  return {};
-}
+  if (trackId.uri.has_value()) {
+    return confirm(TrackIndex::uriKey(trackId.uri.value()));
+  }
 
-bool ContextTrackResolver::prepareParseState() {
-  if (!currentTrackInCacheIndex.has_value()) {
-    contextParseState = {.foundTrackIndex = std::nullopt,
-                         .maxWindowSize = maxWindowSize,
-                         .targetTrackId = currentTrackId,
-                         .tracks = {},
-                         .fetchMode = FetchMode::AddNext};
-  } else if ((trackCache.size() - currentTrackInCacheIndex.value()) <
-             trackUpdateThreshold) {
-    uint32_t pageIdx = trackCache.front().index.page;
-    auto& page = resolvedContextPages[trackCache.front().index.page];
-
-    if (page.fetchWindowEnd == page.trackIndexes.size()) {
-      // Already at end of the window, go up one page
-      if (resolvedContextPages.size() < pageIdx + 2) {
-        BELL_LOG(error, LOG_TAG, "Already at end of context");
-        return false;
-      }
+  return std::nullopt;
+}
 
-      page = resolvedContextPages[pageIdx + 1];
-      page.fetchWindowStart = page.fetchWindowEnd - maxWindowSize;
-    } else {
-      uint32_t windowSize = std::min(
-          maxWindowSize, static_cast<uint32_t>(page.trackIndexes.size()) -
-                             page.fetchWindowEnd);
-      page.fetchWindowStart += windowSize;
-      page.fetchWindowEnd += windowSize;
-    }
+bool ContextTrackResolver::isSameTrack(const TrackId& trackId,
+                                       const CompactTrack& track) const {
+  auto uid = trackArena.uid(track);
+  if (!uid.empty() && trackId.uid.has_value()) {
+    return uid == trackId.uid.value();
+  }
 
-    // If we are close to the end of the cache, we need to fetch more tracks
-    contextParseState = {
-        .foundTrackIndex = currentTrackInCacheIndex,
-        .maxWindowSize = page.fetchWindowEnd - page.fetchWindowStart,
-        .tracks = {},
-        .fetchMode = FetchMode::AddNext};
-  } else if (currentTrackInCacheIndex.value() < trackUpdateThreshold) {
-    uint32_t pageIdx = trackCache.back().index.page;
-    auto& page = resolvedContextPages[trackCache.back().index.page];
-
-    if (page.fetchWindowStart == 0) {
-      // Already at beginning of the window, go back one page
-      if (trackCache.back().index.page == 0) {
-        BELL_LOG(error, LOG_TAG, "Already at beginning of cache");
-        return false;
-      }
+  TrackArena::UriBuffer uriBuffer;
+  auto uri = trackArena.uri(track, uriBuffer);
+  if (!uri.empty() && trackId.uri.has_value()) {
+    return uri == trackId.uri.value();
+  }
+  return false;
+}
 
-      page = resolvedContextPages[pageIdx - 1];
-      page.fetchWindowStart = page.fetchWindowEnd - maxWindowSize;
-    } else {
-      uint32_t windowSize = std::min(maxWindowSize, page.fetchWindowStart);
-      page.fetchWindowStart -= windowSize;
-      page.fetchWindowEnd -= windowSize;
-    }
+void ContextTrackResolver::indexCachedTrack(size_t position) {
+  const auto& track = trackCache[position];
+  uint32_t indexed = trackCache.frontIndex() + static_cast<uint32_t>(position);
 
-    // If we are close to the end of the cache, we need to fetch more tracks
-    contextParseState = {
-        .foundTrackIndex = currentTrackInCacheIndex,
-        .maxWindowSize = page.fetchWindowEnd - page.fetchWindowStart,
-        .tracks = {},
-        .fetchMode = FetchMode::AddPrevious};
-  } else {
-    BELL_LOG(error, LOG_TAG, "Reset context called without tracks to fill");
+  TrackArena::UriBuffer uriBuffer;
+  auto uid = trackArena.uid(track);
+  auto uri = trackArena.uri(track, uriBuffer);
+  if (!uid.empty()) {
+    trackCacheIndex.insert(TrackIndex::uidKey(uid), indexed);
+  }
+  if (!uri.empty()) {
+    trackCacheIndex.insert(TrackIndex::uriKey(uri), indexed);
   }
+}
 
-  return true;
+void ContextTrackResolver::unindexCachedTrack(size_t position) {
+  const auto& track = trackCache[position];
+  uint32_t indexed = trackCache.frontIndex() + static_cast<uint32_t>(position);
+
+  TrackArena::UriBuffer uriBuffer;
+  auto uid = trackArena.uid(track);
+  auto uri = trackArena.uri(track, uriBuffer);
+  if (!uid.empty()) {
+    trackCacheIndex.erase(TrackIndex::uidKey(uid), indexed);
+  }
+  if (!uri.empty()) {
+    trackCacheIndex.erase(TrackIndex::uriKey(uri), indexed);
+  }
 }
 
-void ContextTrackResolver::updateTracksFromParseState() {
-  BELL_LOG(debug, LOG_TAG, "Updating tracks from parse state, found index: {}",
-           contextParseState.foundTrackIndex.has_value()
-               ? std::to_string(contextParseState.foundTrackIndex.value())
-               : "N/A");
-  if (contextParseState.fetchMode == FetchMode::AddNext) {
-    if (!currentTrackInCacheIndex.has_value() && (trackCache.size() + contextParseState.tracks.size() > maxWindowSize)) {
-      uint32_t tracksToRemove =
-          trackCache.size() + contextParseState.tracks.size() - maxWindowSize;
-      trackCache.erase(trackCache.begin(), trackCache.begin() + tracksToRemove);
-      if (currentTrackInCacheIndex.has_value()) {
-        currentTrackInCacheIndex.value() -= tracksToRemove;
-      }
-    }
+void ContextTrackResolver::appendToCache(
+    const std::vector<CompactTrack>& tracks) {
+  for (const auto& track : tracks) {
+    trackCache.pushBack(track);
+    indexCachedTrack(trackCache.size() - 1);
+  }
+}
 
-    // If we are in add next, we only add tracks after the found index
-    trackCache.insert(trackCache.end(), contextParseState.tracks.begin(),
-                      contextParseState.tracks.end());
+void ContextTrackResolver::prependToCache(
+    const std::vector<CompactTrack>& tracks) {
+  for (auto it = tracks.rbegin(); it != tracks.rend(); ++it) {
+    trackCache.pushFront(*it);
+    indexCachedTrack(0);
+  }
+}
 
-    currentTrackInCacheIndex = contextParseState.foundTrackIndex;
-  } else if (contextParseState.fetchMode == FetchMode::AddPrevious) {
-    // If we are in add prev mode, we only add tracks before the found index
-    trackCache.insert(trackCache.begin(), contextParseState.tracks.begin(),
-                      contextParseState.tracks.end());
-    currentTrackInCacheIndex.value() += contextParseState.tracks.size();
+void ContextTrackResolver::dropFromCacheFront(size_t amount) {
+  amount = std::min(amount, trackCache.size());
+  for (size_t i = 0; i < amount; i++) {
+    unindexCachedTrack(i);
   }
+  trackCache.popFront(amount);
 }
 
-bell::Result<> ContextTrackResolver::resolveRootContext() {
-  BELL_LOG(info, LOG_TAG, "Resolving root context: {}", rootContextUrl);
+void ContextTrackResolver::dropFromCacheBack(size_t amount) {
+  amount = std::min(amount, trackCache.size());
+  for (size_t i = trackCache.size() - amount; i < trackCache.size(); i++) {
+    unindexCachedTrack(i);
+  }
+  trackCache.popBack(amount);
+}
 
-  auto reader = spClient->contextResolve(rootContextUrl);
-  if (!reader) {
-    BELL_LOG(error, LOG_TAG, "Failed to resolve root context: {}",
-             reader.errorMessage());
-    return reader.getError();
+bell::Result<> ContextTrackResolver::ensureContextTracks() {
+  if (!currentTrackInCacheIndex.has_value()) {
+    // Nothing to serve yet, so the root has to be resolved in place
+    return resolveRootContext();
   }
 
-  auto* rawDataStream = reader.getValue().getStream();
+  collectPrefetch();
 
-  if (!prepareParseState()) {
-    BELL_LOG(error, LOG_TAG, "Failed to prepare parse state");
+  if (workerPool) {
+    prefetchIfLow();
     return {};
   }
 
-  auto parseCtx =
-      ContextRootParseContext(&contextParseState, &resolvedContextPages);
-  std::string parseError;
-  picojson::_parse(parseCtx,
-                   std::istreambuf_iterator<char>(rawDataStream->rdbuf()),
-                   std::istreambuf_iterator<char>(), &parseError);
+  // Without a worker pool, refills block the caller
+  auto fetch = planRefill();
+  if (!fetch.has_value()) {
+    return {};
+  }
 
-  if (!parseError.empty()) {
-    BELL_LOG(error, LOG_TAG, "Failed to parse context data: {}", parseError);
-    return std::errc::invalid_argument;
+  BELL_LOG(debug, LOG_TAG, "Track window ran low, resolving more tracks");
+  auto res = runContextFetch(*spClient, fetch.value());
+  if (!res) {
+    BELL_LOG(error, LOG_TAG, "Failed to resolve context page: {}",
+             res.errorMessage());
+    return res.getError();
   }
 
-  if (resolvedContextPages.end()->nextPageUrl.has_value()) {
-    // If the last page has a next page URL, we need to add it to the resolved pages
-    resolvedContextPages.push_back({
-        .pageUrl = resolvedContextPages.end()->nextPageUrl.value(),
-    });
+  applyFetch(fetch.value());
+  return {};
+}
+
+void ContextTrackResolver::prefetchIfLow() {
+  if (!workerPool || pendingFetch) {
+    return;  // One fetch at a time
   }
 
-  updateTracksFromParseState();
+  auto fetch = planRefill();
+  if (!fetch.has_value()) {
+    return;
+  }
 
-  BELL_LOG(info, LOG_TAG, "Root context resolved successfully");
-  uint32_t nextPageIndex = contextParseState.tracks.back().index.page;
+  BELL_LOG(debug, LOG_TAG, "Track window ran low, prefetching more tracks");
+
+  auto pending = std::make_shared<PendingFetch>();
+  pending->fetch = std::move(fetch.value());
+  pendingFetch = pending;
+
+  // The job owns the fetch, the resolver may be gone once it finishes
+  workerPool->submit(
+      [spClient = spClient, pending = std::move(pending)]() {
+        pending->result = runContextFetch(*spClient, pending->fetch);
+        pending->done.store(true, std::memory_order_release);
+      },
+      [handler = prefetchHandler]() {
+        if (handler) {
+          handler();
+        }
+      });
+}
 
-  while (!contextParseState.foundTrackIndex.has_value()) {
-    nextPageIndex++;
-    BELL_LOG(info, LOG_TAG,
-             "Current track index not found, resolving next page");
-    BELL_LOG(info, LOG_TAG, "Next page index: {}", nextPageIndex);
-    if (nextPageIndex >= resolvedContextPages.size()) {
-      BELL_LOG(error, LOG_TAG,
-               "No more pages to resolve, cannot find current track index");
-      return std::errc::invalid_argument;
+bool ContextTrackResolver::collectPrefetch() {
+  if (!pendingFetch || !pendingFetch->done.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  auto pending = std::move(pendingFetch);
+  if (!pending->result) {
+    BELL_LOG(error, LOG_TAG, "Failed to prefetch context tracks: {}",
+             pending->result.errorMessage());
+    return false;
+  }
+
+  applyFetch(pending->fetch);
+  return true;
+}
+
+std::optional<ContextTrackResolver::ContextFetch>
+ContextTrackResolver::planRefill() const {
+  if (trackCache.empty() || !currentTrackInCacheIndex.has_value()) {
+    return std::nullopt;
+  }
+
+  size_t currentIdx = currentTrackInCacheIndex.value();
+
+  // The cache may still hold tracks of pages a context update dropped
+  if (trackCache.size() - currentIdx < trackUpdateThreshold &&
+      trackCache.back().index.page < resolvedContextPages.size()) {
+    // Continue after the last cached track
+    const auto& lastIndex = trackCache.back().index;
+    uint32_t pageIdx = lastIndex.page;
+    uint32_t windowStart = lastIndex.track + 1;
+    if (windowStart >= resolvedContextPages[pageIdx].trackIndexes.size()) {
+      pageIdx++;
+      windowStart = 0;
     }
 
-    auto res = resolveContextPage(resolvedContextPages[nextPageIndex]);
-    if (!res) {
-      BELL_LOG(error, LOG_TAG, "Failed to resolve context page: {}",
-               res.errorMessage());
-      return res.getError();
+    if (pageIdx < resolvedContextPages.size()) {
+      // A page never fetched has no track indexes, its window grows as parsed
+      auto pageSize = static_cast<uint32_t>(
+          resolvedContextPages[pageIdx].trackIndexes.size());
+      uint32_t windowEnd = std::min(windowStart + maxWindowSize,
+                                    std::max(pageSize, windowStart));
+      return makeFetch(pageIdx, windowStart, windowEnd, FetchMode::AddNext);
     }
+  }
 
-    if (resolvedContextPages.end()->nextPageUrl.has_value()) {
-      // If the last page has a next page URL, we need to add it to the resolved pages
-      resolvedContextPages.push_back({
-          .pageUrl = resolvedContextPages.end()->nextPageUrl.value(),
-      });
+  if (currentIdx < trackUpdateThreshold &&
+      trackCache.front().index.page < resolvedContextPages.size()) {
+    // Continue before the first cached track
+    const auto& firstIndex = trackCache.front().index;
+    uint32_t pageIdx = firstIndex.page;
+    uint32_t windowEnd = firstIndex.track;
+    if (windowEnd == 0 && pageIdx > 0) {
+      pageIdx--;
+      windowEnd = static_cast<uint32_t>(
+          resolvedContextPages[pageIdx].trackIndexes.size());
+    }
+
+    if (windowEnd > 0) {
+      uint32_t windowStart = windowEnd - std::min(maxWindowSize, windowEnd);
+      return makeFetch(pageIdx, windowStart, windowEnd,
+                       FetchMode::AddPrevious);
     }
   }
 
-  BELL_LOG(info, LOG_TAG, "Current track index found: {}",
-           contextParseState.foundTrackIndex.has_value()
-               ? std::to_string(contextParseState.foundTrackIndex.value())
-               : "N/A");
+  return std::nullopt;
+}
 
-  return {};
+std::optional<ContextTrackResolver::ContextFetch>
+ContextTrackResolver::makeFetch(uint32_t pageIdx, uint32_t windowStart,
+                                uint32_t windowEnd, FetchMode mode) const {
+  const auto& page = resolvedContextPages[pageIdx];
+  if (!page.isInRoot && !page.pageUrl.has_value()) {
+    BELL_LOG(error, LOG_TAG, "Context page {} has no URL", pageIdx);
+    return std::nullopt;
+  }
+
+  ContextFetch fetch;
+  fetch.isRoot = page.isInRoot;
+  fetch.url = page.isInRoot ? rootContextUrl : page.pageUrl.value();
+  fetch.pageIndex = pageIdx;
+  fetch.pages = resolvedContextPages;
+  fetch.pages[pageIdx].fetchWindowStart = windowStart;
+  fetch.pages[pageIdx].fetchWindowEnd = windowEnd;
+
+  // The current track is known, so only the window of the page is collected
+  fetch.parseState = {.targetTrackId = currentTrackId,
+                      .tracks = RingBuffer<CompactTrack>(maxWindowSize),
+                      .arena = nullptr,
+                      .foundTrackIndex = currentTrackInCacheIndex,
+                      .maxWindowSize = maxWindowSize,
+                      .fetchMode = mode,
+                      .pageIndex = pageIdx};
+  return fetch;
 }
 
-bell::Result<> ContextTrackResolver::resolveContextPage(
-    ResolvedContextPage& page) {
-  if (!page.pageUrl.has_value()) {
-    BELL_LOG(error, LOG_TAG, "Context page URL is not set");
+void ContextTrackResolver::applyFetch(ContextFetch& fetch) {
+  const auto& parseState = fetch.parseState;
+  resolvedContextPages = std::move(fetch.pages);
+
+  if (!resolvedContextPages.empty() &&
+      resolvedContextPages.back().nextPageUrl.has_value()) {
+    // The last page links the next one, queue it up
+    ResolvedContextPage nextPage;
+    nextPage.pageIndex = static_cast<int>(resolvedContextPages.size());
+    nextPage.pageUrl = resolvedContextPages.back().nextPageUrl;
+    resolvedContextPages.push_back(std::move(nextPage));
   }
-  BELL_LOG(info, LOG_TAG, "Resolving context page: {}", page.pageUrl.value());
 
-  if (!prepareParseState()) {
-    BELL_LOG(error, LOG_TAG, "Failed to prepare parse state");
-    return std::errc::invalid_argument;
+  if (parseState.tracks.empty()) {
+    return;
   }
 
-  auto reader = spClient->doRequest(bell::http::Method::GET,
-                                    page.pageUrl.value().substr(5));
-  if (!reader) {
-    BELL_LOG(error, LOG_TAG, "Failed to resolve context page: {}",
-             reader.errorMessage());
-    return reader.getError();
+  // Only trackCache strings are live in the arena at this point
+  trackArena.compact(trackCache);
+
+  std::vector<CompactTrack> tracks;
+  tracks.reserve(parseState.tracks.size());
+  for (size_t i = 0; i < parseState.tracks.size(); i++) {
+    tracks.push_back(trackArena.intern(parseState.tracks[i], fetch.arena));
   }
 
-  auto* rawDataStream = reader.getValue().getStream();
+  if (parseState.fetchMode == FetchMode::AddNext) {
+    if (!trackCache.empty() &&
+        !isAdjacent(trackCache.back().index, tracks.front().index)) {
+      if (currentTrackInCacheIndex.has_value()) {
+        // The cache moved on while the fetch was running
+        BELL_LOG(debug, LOG_TAG, "Fetched tracks don't follow the cache");
+        return;
+      }
+      dropFromCacheFront(trackCache.size());
+    }
 
-  auto parseCtx = ContextPageParseContext(&contextParseState, &page);
-  std::string parseError;
-  picojson::_parse(parseCtx,
-                   std::istreambuf_iterator<char>(rawDataStream->rdbuf()),
-                   std::istreambuf_iterator<char>(), &parseError);
+    if (!currentTrackInCacheIndex.has_value() &&
+        (trackCache.size() + tracks.size() > maxWindowSize)) {
+      dropFromCacheFront(trackCache.size() + tracks.size() - maxWindowSize);
+    }
 
-  if (!parseError.empty()) {
-    BELL_LOG(error, LOG_TAG, "Failed to parse context page data: {}",
-             parseError);
+    // If we are in add next, we only add tracks after the found index
+    size_t firstNewIdx = trackCache.size();
+    appendToCache(tracks);
+
+    if (!currentTrackInCacheIndex.has_value() &&
+        parseState.foundTrackIndex.has_value()) {
+      currentTrackInCacheIndex = static_cast<uint32_t>(
+          firstNewIdx + parseState.foundTrackIndex.value());
+    }
+
+    // Keep the window within capacity, without passing the current track
+    if (trackCache.size() > cacheCapacity &&
+        currentTrackInCacheIndex.has_value()) {
+      uint32_t excess = std::min(
+          static_cast<uint32_t>(trackCache.size()) - cacheCapacity,
+          currentTrackInCacheIndex.value());
+      dropFromCacheFront(excess);
+      currentTrackInCacheIndex.value() -= excess;
+    }
+  } else if (parseState.fetchMode == FetchMode::AddPrevious) {
+    if (!trackCache.empty() &&
+        !isAdjacent(tracks.back().index, trackCache.front().index)) {
+      BELL_LOG(debug, LOG_TAG, "Fetched tracks don't precede the cache");
+      return;
+    }
+
+    // If we are in add prev mode, we only add tracks before the found index
+    prependToCache(tracks);
+    if (currentTrackInCacheIndex.has_value()) {
+      currentTrackInCacheIndex.value() += tracks.size();
+    }
+
+    // Keep the window within capacity, the tracks far ahead go first
+    if (trackCache.size() > cacheCapacity) {
+      size_t afterCurrent =
+          currentTrackInCacheIndex.has_value()
+              ? trackCache.size() - currentTrackInCacheIndex.value() - 1
+              : trackCache.size();
+      dropFromCacheBack(
+          std::min<size_t>(trackCache.size() - cacheCapacity, afterCurrent));
+    }
+  }
+}
+
+bell::Result<> ContextTrackResolver::resolveRootContext() {
+  BELL_LOG(info, LOG_TAG, "Resolving root context: {}", rootContextUrl);
+
+  ContextFetch fetch;
+  fetch.isRoot = true;
+  fetch.url = rootContextUrl;
+  fetch.pages = resolvedContextPages;
+  fetch.parseState = {.targetTrackId = currentTrackId,
+                      .tracks = RingBuffer<CompactTrack>(maxWindowSize),
+                      .maxWindowSize = maxWindowSize,
+                      .fetchMode = FetchMode::AddNext};
+
+  auto res = runContextFetch(*spClient, fetch);
+  if (!res) {
+    BELL_LOG(error, LOG_TAG, "Failed to resolve root context: {}",
+             res.errorMessage());
+    return res.getError();
+  }
+
+  applyFetch(fetch);
+  BELL_LOG(info, LOG_TAG, "Root context resolved successfully");
+
+  // The current track can be on a page the root only links to. Resolving one
+  // can link the next, so the size is checked on every iteration.
+  for (uint32_t pageIdx = 0; !currentTrackInCacheIndex.has_value() &&
+                             pageIdx < resolvedContextPages.size();
+       pageIdx++) {
+    const auto& page = resolvedContextPages[pageIdx];
+    if (page.isInRoot || !page.trackIndexes.empty() ||
+        !page.pageUrl.has_value()) {
+      continue;
+    }
+
+    BELL_LOG(info, LOG_TAG,
+             "Current track index not found, resolving page {}", pageIdx);
+
+    ContextFetch pageFetch;
+    pageFetch.url = page.pageUrl.value();
+    pageFetch.pageIndex = pageIdx;
+    pageFetch.pages = resolvedContextPages;
+    pageFetch.parseState = {.targetTrackId = currentTrackId,
+                            .tracks = RingBuffer<CompactTrack>(maxWindowSize),
+                            .maxWindowSize = maxWindowSize,
+                            .fetchMode = FetchMode::AddNext};
+
+    res = runContextFetch(*spClient, pageFetch);
+    if (!res) {
+      BELL_LOG(error, LOG_TAG, "Failed to resolve context page: {}",
+               res.errorMessage());
+      return res.getError();
+    }
+
+    applyFetch(pageFetch);
+  }
+
+  if (!currentTrackInCacheIndex.has_value()) {
+    BELL_LOG(error, LOG_TAG,
+             "No more pages to resolve, cannot find current track index");
     return std::errc::invalid_argument;
   }
 
-  updateTracksFromParseState();
-  BELL_LOG(info, LOG_TAG, "Context page resolved successfully");
+  BELL_LOG(info, LOG_TAG, "Current track index found: {}",
+           currentTrackInCacheIndex.value());
+
   return {};
 }
@@ -0,0 +1,155 @@
+#include "JsonWriter.h"
+
+#include <charconv>
+#include <cstring>
+
+using namespace cspot;
+
+void JsonWriter::put(char c) {
+  if (size == capacity) {
+    hasOverflowed = true;
+    return;
+  }
+  buffer[size++] = c;
+}
+
+JsonWriter& JsonWriter::raw(std::string_view json) {
+  if (json.size() > capacity - size) {
+    hasOverflowed = true;
+    return *this;
+  }
+
+  std::memcpy(buffer + size, json.data(), json.size());
+  size += json.size();
+  return *this;
+}
+
+void JsonWriter::beginValue() {
+  if (afterKey) {
+    afterKey = false;
+    return;
+  }
+
+  if (depth > 0) {
+    uint32_t levelBit = 1u << (depth - 1);
+    if (hasElements & levelBit) {
+      put(',');
+    }
+    hasElements |= levelBit;
+  }
+}
+
+void JsonWriter::open(char c) {
+  beginValue();
+  if (depth == maxDepth) {
+    hasOverflowed = true;
+    return;
+  }
+
+  put(c);
+  depth++;
+  hasElements &= ~(1u << (depth - 1));
+}
+
+void JsonWriter::close(char c) {
+  if (depth == 0) {
+    hasOverflowed = true;
+    return;
+  }
+
+  put(c);
+  depth--;
+}
+
+JsonWriter& JsonWriter::beginObject() {
+  open('{');
+  return *this;
+}
+
+JsonWriter& JsonWriter::endObject() {
+  close('}');
+  return *this;
+}
+
+JsonWriter& JsonWriter::beginArray() {
+  open('[');
+  return *this;
+}
+
+JsonWriter& JsonWriter::endArray() {
+  close(']');
+  return *this;
+}
+
+JsonWriter& JsonWriter::key(std::string_view key) {
+  string(key);
+  put(':');
+  afterKey = true;
+  return *this;
+}
+
+JsonWriter& JsonWriter::string(std::string_view value) {
+  beginValue();
+  put('"');
+  escaped(value);
+  put('"');
+  return *this;
+}
+
+JsonWriter& JsonWriter::escaped(std::string_view value) {
+  static constexpr char hexDigits[] = "0123456789abcdef";
+
+  // Copy runs of plain characters at once
+  size_t runStart = 0;
+  for (size_t i = 0; i < value.size(); i++) {
+    auto c = static_cast<unsigned char>(value[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+
+    raw(value.substr(runStart, i - runStart));
+    runStart = i + 1;
+
+    switch (c) {
+      case '"':
+        raw("\\\"");
+        break;
+      case '\\':
+        raw("\\\\");
+        break;
+      case '\n':
+        raw("\\n");
+        break;
+      case '\r':
+        raw("\\r");
+        break;
+      case '\t':
+        raw("\\t");
+        break;
+      default: {
+        char unicodeEscape[] = {'\\', 'u', '0', '0', hexDigits[c >> 4],
+                                hexDigits[c & 0xf]};
+        raw({unicodeEscape, sizeof(unicodeEscape)});
+        break;
+      }
+    }
+  }
+
+  raw(value.substr(runStart));
+  return *this;
+}
+
+JsonWriter& JsonWriter::number(int64_t value) {
+  beginValue();
+
+  char digits[24];
+  auto [end, error] = std::to_chars(digits, digits + sizeof(digits), value);
+  raw({digits, static_cast<size_t>(end - digits)});
+  return *this;
+}
+
+JsonWriter& JsonWriter::boolean(bool value) {
+  beginValue();
+  raw(value ? "true" : "false");
+  return *this;
+}
@@ -1,5 +1,6 @@
 #include <LoginBlob.h>
 
+#include <array>
 #include <string_view>
 
 #include <bell/Logger.h>
@@ -8,7 +9,6 @@
 #include <mbedtls/aes.h>
 #include <mbedtls/base64.h>
 #include <mbedtls/pkcs5.h>
-#include <cJSON.h>
 #include "bell/net/URIParser.h"
 
 using namespace cspot;
@@ -28,6 +28,38 @@ LoginBlob::LoginBlob(const std::string& deviceName) : deviceName(deviceName) {
 
   // Cache it, so we don't have to recalculate it
   dhPublicKey = dhPair.getPublicKeyBase64();
+
+  // Everything but the active user is fixed, encode it once
+  std::array<char, 1024> buffer;
+  JsonWriter writer(buffer);
+  writer.beginObject()
+      .field("status", 101)
+      .field("statusString", "OK")
+      .field("version", protocolVersion)
+      .field("spotifyError", 0)
+      .field("libraryVersion", swVersion)
+      .field("accountReq", "PREMIUM")
+      .field("brandDisplayName", brandName)
+      .field("modelDisplayName", brandName)
+      .field("voiceSupport", "NO")
+      .field("productID", 0)
+      .field("tokenType", "default")
+      .field("groupStatus", "NONE")
+      .field("resolverVersion", "0")
+      .field("scope", "streaming,client-authorization-universal")
+      .field("deviceType", deviceType)
+      .field("availability", "")
+      .field("deviceID", deviceId)
+      .field("remoteName", deviceName)
+      .field("publicKey", dhPublicKey)
+      .key("activeUser")
+      .raw("\"");
+  if (writer.overflowed()) {
+    // Left empty, so responses fail instead of going out truncated
+    BELL_LOG(error, LOG_TAG, "Zeroconf response doesn't fit its buffer");
+    return;
+  }
+  zeroconfResponsePrefix = writer.view();
 }
 
 std::string LoginBlob::getUsername() {
@@ -51,37 +83,24 @@ bool LoginBlob::isAuthenticated() {
 }
 
 std::string LoginBlob::buildZeroconfJSONResponse() {
+  std::array<char, 1024> buffer;
+  JsonWriter writer(buffer);
+  if (!buildZeroconfJSONResponse(writer)) {
+    BELL_LOG(error, LOG_TAG, "Zeroconf response doesn't fit its buffer");
+    return {};
+  }
+
+  return std::string(writer.view());
+}
+
+bool LoginBlob::buildZeroconfJSONResponse(JsonWriter& writer) {
   std::scoped_lock lock(accessMutex);
+  if (zeroconfResponsePrefix.empty()) {
+    return false;
+  }
 
-  cJSON* root = cJSON_CreateObject();
-  cJSON_AddNumberToObject(root, "status", 101);
-  cJSON_AddStringToObject(root, "statusString", "OK");
-  cJSON_AddStringToObject(root, "version", protocolVersion.c_str());
-  cJSON_AddNumberToObject(root, "spotifyError", 0);
-  cJSON_AddStringToObject(root, "libraryVersion", swVersion.c_str());
-  cJSON_AddStringToObject(root, "accountReq", "PREMIUM");
-  cJSON_AddStringToObject(root, "brandDisplayName", brandName.c_str());
-  cJSON_AddStringToObject(root, "modelDisplayName", brandName.c_str());
-  cJSON_AddStringToObject(root, "voiceSupport", "NO");
-  cJSON_AddNumberToObject(root, "productID", 0);
-  cJSON_AddStringToObject(root, "tokenType", "default");
-  cJSON_AddStringToObject(root, "groupStatus", "NONE");
-  cJSON_AddStringToObject(root, "resolverVersion", "0");
-  cJSON_AddStringToObject(root, "scope",
-                          "streaming,client-authorization-universal");
-  cJSON_AddStringToObject(root, "deviceType", deviceType.c_str());
-  cJSON_AddStringToObject(root, "availability", "");
-
-  cJSON_AddStringToObject(root, "deviceID", deviceId.c_str());
-  cJSON_AddStringToObject(root, "remoteName", deviceName.c_str());
-  cJSON_AddStringToObject(root, "publicKey", dhPublicKey.c_str());
-  cJSON_AddStringToObject(root, "activeUser", username.c_str());
-
-  char* str = cJSON_PrintUnformatted(root);
-  std::string out(str);
-  free(str);
-  cJSON_Delete(root);
-  return out;
+  writer.raw(zeroconfResponsePrefix).escaped(username).raw("\"}");
+  return !writer.overflowed();
 }
 
 bell::Result<> LoginBlob::authenticateZeroconfString(
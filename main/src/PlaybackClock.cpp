@@ -0,0 +1,58 @@
+#include "PlaybackClock.h"
+
+#include <algorithm>
+
+using namespace cspot;
+
+void PlaybackClock::restore(int64_t anchorTimestampMs,
+                            int64_t anchorPositionMs, double rate,
+                            bool paused) {
+  timestampMs = anchorTimestampMs;
+  positionMs = std::max<int64_t>(anchorPositionMs, 0);
+  playbackRate = rate > 0 ? rate : 1.0;
+  this->paused = paused;
+}
+
+void PlaybackClock::seek(int64_t positionMs, int64_t nowMs) {
+  timestampMs = nowMs;
+  this->positionMs = std::max<int64_t>(positionMs, 0);
+}
+
+void PlaybackClock::pause(int64_t nowMs) {
+  if (paused) {
+    return;
+  }
+  rebase(nowMs);
+  paused = true;
+}
+
+void PlaybackClock::resume(int64_t nowMs) {
+  if (!paused) {
+    return;
+  }
+  // Paused time doesn't count, the anchor just moves to now
+  timestampMs = nowMs;
+  paused = false;
+}
+
+void PlaybackClock::setRate(double rate, int64_t nowMs) {
+  if (rate <= 0 || rate == playbackRate) {
+    return;
+  }
+  rebase(nowMs);
+  playbackRate = rate;
+}
+
+int64_t PlaybackClock::positionAt(int64_t nowMs) const {
+  if (paused || nowMs <= timestampMs) {
+    return positionMs;
+  }
+  return positionMs +
+         static_cast<int64_t>(static_cast<double>(nowMs - timestampMs) *
+                              playbackRate);
+}
+
+void PlaybackClock::rebase(int64_t nowMs) {
+  positionMs = positionAt(nowMs);
+  timestampMs = nowMs;
+}
@@ -0,0 +1,123 @@
+#include "ServerClock.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+using namespace cspot;
+
+namespace {
+constexpr std::array<std::string_view, 12> monthNames = {
+    "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+    "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+bool parseDigits(std::string_view text, size_t offset, size_t count,
+                 int& out) {
+  if (offset + count > text.size()) {
+    return false;
+  }
+
+  out = 0;
+  for (size_t i = offset; i < offset + count; i++) {
+    if (text[i] < '0' || text[i] > '9') {
+      return false;
+    }
+    out = out * 10 + (text[i] - '0');
+  }
+  return true;
+}
+
+// Days since 1970-01-01 of a proleptic gregorian date
+int64_t daysFromCivil(int year, unsigned month, unsigned day) {
+  year -= month <= 2;
+  const int era = (year >= 0 ? year : year - 399) / 400;
+  const unsigned yearOfEra = static_cast<unsigned>(year - era * 400);
+  const unsigned dayOfYear =
+      (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  const unsigned dayOfEra =
+      yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return static_cast<int64_t>(era) * 146097 + dayOfEra - 719468;
+}
+}  // namespace
+
+std::optional<int64_t> ServerClock::parseHttpDate(std::string_view date) {
+  // "Sun, 06 Nov 1994 08:49:37 GMT", fixed positions after the day name
+  auto comma = date.find(", ");
+  if (comma == std::string_view::npos) {
+    return std::nullopt;
+  }
+  date.remove_prefix(comma + 2);
+  if (date.size() < 24 || date.substr(20, 4) != " GMT") {
+    return std::nullopt;
+  }
+
+  int day, year, hour, minute, second;
+  if (!parseDigits(date, 0, 2, day) || !parseDigits(date, 7, 4, year) ||
+      !parseDigits(date, 12, 2, hour) || !parseDigits(date, 15, 2, minute) ||
+      !parseDigits(date, 18, 2, second)) {
+    return std::nullopt;
+  }
+
+  auto monthIt =
+      std::find(monthNames.begin(), monthNames.end(), date.substr(3, 3));
+  if (monthIt == monthNames.end() || day < 1 || day > 31 || hour > 23 ||
+      minute > 59 || second > 60) {
+    return std::nullopt;
+  }
+  unsigned month = static_cast<unsigned>(monthIt - monthNames.begin()) + 1;
+
+  int64_t days = daysFromCivil(year, month, static_cast<unsigned>(day));
+  return ((days * 24 + hour) * 60 + minute) * 60000 + second * 1000;
+}
+
+void ServerClock::addSample(std::string_view dateHeader, int64_t sentAtMs,
+                            int64_t receivedAtMs) {
+  auto serverSecondMs = parseHttpDate(dateHeader);
+  if (!serverSecondMs || receivedAtMs < sentAtMs) {
+    return;
+  }
+
+  // The server clock read somewhere in [date, date + 1s), at a local time
+  // somewhere in [sent, received]
+  int64_t sampleMin = *serverSecondMs - receivedAtMs;
+  int64_t sampleMax = *serverSecondMs + 999 - sentAtMs;
+
+  std::scoped_lock lock(boundsMutex);
+  if (hasBounds) {
+    int64_t newMin = std::max(minOffsetMs, sampleMin);
+    int64_t newMax = std::min(maxOffsetMs, sampleMax);
+    if (newMin <= newMax) {
+      minOffsetMs = newMin;
+      maxOffsetMs = newMax;
+      return;
+    }
+  }
+
+  // First sample, or one of the clocks jumped, start over from this one
+  hasBounds = true;
+  minOffsetMs = sampleMin;
+  maxOffsetMs = sampleMax;
+}
+
+int64_t ServerClock::nowMs() const {
+  return localNowMs() + offsetMs();
+}
+
+int64_t ServerClock::offsetMs() const {
+  std::scoped_lock lock(boundsMutex);
+  if (!hasBounds) {
+    return 0;
+  }
+  return minOffsetMs + (maxOffsetMs - minOffsetMs) / 2;
+}
+
+bool ServerClock::isSynced() const {
+  std::scoped_lock lock(boundsMutex);
+  return hasBounds;
+}
+
+int64_t ServerClock::localNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
@@ -1,7 +1,8 @@
 #include "Session.h"
 
+#include <algorithm>
+#include <optional>
 #include <string>
-#include <cJSON.h>
 #include "bell/Logger.h"
 #include "connect.pb.h"
 #include "events/EventLoop.h"
@@ -14,8 +15,11 @@ cspot::Session::Session(std::shared_ptr<LoginBlob> loginBlob)
   sessionContext = std::make_shared<SessionContext>();
   sessionContext->loginBlob = this->loginBlob;
   sessionContext->eventLoop = std::make_shared<cspot::EventLoop>();
+  sessionContext->workerPool =
+      std::make_shared<cspot::WorkerPool>(sessionContext->eventLoop);
   sessionContext->credentialsResolver =
       std::make_shared<CredentialsResolver>(this->loginBlob);
+  sessionContext->serverClock = std::make_shared<ServerClock>();
 
   // Prepare the dealer client
   dealerClient = std::make_shared<DealerClient>(sessionContext);
@@ -23,6 +27,17 @@ cspot::Session::Session(std::shared_ptr<LoginBlob> loginBlob)
   connectStateHandler =
       std::make_shared<ConnectStateHandler>(sessionContext, spClient);
 
+  // Only frames we handle make it past the dealer client
+  dealerClient->addRoute(DealerRouter::Field::URI,
+                         "hm://pusher/v1/connections",
+                         EventLoop::EventType::DEALER_MESSAGE);
+  dealerClient->addRoute(DealerRouter::Field::URI,
+                         "hm://connect-state/v1/cluster",
+                         EventLoop::EventType::DEALER_MESSAGE);
+  dealerClient->addRoute(DealerRouter::Field::MESSAGE_IDENT,
+                         "hm://connect-state/v1/",
+                         EventLoop::EventType::DEALER_REQUEST);
+
   sessionContext->eventLoop->registerHandler(
       EventLoop::EventType::DEALER_MESSAGE,
       std::bind(&cspot::Session::handleDealerMessage, this,
@@ -35,93 +50,121 @@ cspot::Session::Session(std::shared_ptr<LoginBlob> loginBlob)
 }
 
 void cspot::Session::handleDealerMessage(EventLoop::Event&& event) {
-  auto dealerMessageEvent = std::move(event);
-  std::string messageStr = std::get<std::string>(dealerMessageEvent.payload);
-  cJSON* messageJson = cJSON_Parse(messageStr.c_str());
-  if (!messageJson) {
+  auto messageRes = DealerMessage::parse(
+      std::get<DealerFrame>(std::move(event.payload)).payload);
+  if (!messageRes) {
     BELL_LOG(error, LOG_TAG, "Invalid JSON message");
     return;
   }
+  DealerMessage message = messageRes.takeValue();
 
-  cJSON* uriItem = cJSON_GetObjectItem(messageJson, "uri");
-  if (!cJSON_IsString(uriItem)) {
+  if (message.uri.empty()) {
     BELL_LOG(info, LOG_TAG, "Received message without URI");
-    cJSON_Delete(messageJson);
     return;
   }
-  std::string uri = uriItem->valuestring;
 
-  if (uri.rfind("hm://pusher/v1/connections", 0) == 0) {
+  if (message.uri.rfind("hm://pusher/v1/connections", 0) == 0) {
     // Extract session ID
-    cJSON* headers = cJSON_GetObjectItem(messageJson, "headers");
-    cJSON* sessionIdItem =
-        cJSON_GetObjectItem(headers, "Spotify-Connection-Id");
-    if (!cJSON_IsString(sessionIdItem)) {
+    if (message.headers.connectionId.empty()) {
       BELL_LOG(info, LOG_TAG, "Received message without session ID");
-      cJSON_Delete(messageJson);
       return;
     }
 
-    sessionContext->sessionId = sessionIdItem->valuestring;
-    BELL_LOG(info, LOG_TAG, "Session ID: %s", sessionIdItem->valuestring);
+    sessionContext->sessionId = message.headers.connectionId;
+    BELL_LOG(info, LOG_TAG, "Session ID: {}", sessionContext->sessionId);
 
-    // Announce spotify connect state
-    auto res = connectStateHandler->putState(PutStateReason_NEW_CONNECTION);
-    if (!res) {
-      BELL_LOG(error, LOG_TAG, "Failed to announce connect state: {}",
-               res.errorMessage());
+    // Announce spotify connect state, sent right away
+    connectStateHandler->markStateDirty(PutStateReason_NEW_CONNECTION);
+  } else {
+    auto payloadRes = message.decodePayload(pushInflater);
+    if (!payloadRes) {
+      BELL_LOG(error, LOG_TAG, "Failed to decode payload of {}: {}",
+               message.uri, payloadRes.errorMessage());
       return;
     }
-  } else {
-    BELL_LOG(info, LOG_TAG, "Received message with URI: %s", uri.c_str());
+
+    const auto& payload = payloadRes.getValue();
+    if (message.uri.rfind("hm://connect-state/v1/cluster", 0) == 0) {
+      cspot_proto::ClusterUpdate clusterUpdate;
+      if (!nanopb_helper::decodeFromBuffer(clusterUpdate, payload.data(),
+                                           payload.size())) {
+        BELL_LOG(error, LOG_TAG, "Failed to decode cluster update");
+        return;
+      }
+
+      connectStateHandler->handleClusterUpdate(std::move(clusterUpdate));
+    } else {
+      BELL_LOG(info, LOG_TAG, "Received message with URI: {}, {} bytes",
+               message.uri, payload.size());
+    }
   }
-  cJSON_Delete(messageJson);
 }
 
 void cspot::Session::handleDealerRequest(EventLoop::Event&& event) {
-  auto dealerRequestEvent = std::move(event);
-  std::string messageStr = std::get<std::string>(dealerRequestEvent.payload);
-  cJSON* messageJson = cJSON_Parse(messageStr.c_str());
-  if (!messageJson) {
+  // Latency counts from the socket, including time spent queued on the loop
+  auto frame = std::get<DealerFrame>(std::move(event.payload));
+  auto requestRes = DealerMessage::parse(std::move(frame.payload));
+  if (!requestRes) {
     BELL_LOG(error, LOG_TAG, "Invalid JSON request");
     return;
   }
 
-  cJSON* identItem = cJSON_GetObjectItem(messageJson, "message_ident");
-  if (!cJSON_IsString(identItem)) {
+  // Commands may wait on the network, run them as a task so the loop keeps
+  // dispatching meanwhile
+  spawn(processDealerRequest(requestRes.takeValue(), frame.receivedAt));
+}
+
+AsyncTask<> cspot::Session::processDealerRequest(
+    DealerMessage request, std::chrono::steady_clock::time_point receivedAt) {
+  if (request.messageIdent.empty()) {
     BELL_LOG(info, LOG_TAG, "Received message without message_ident");
-    cJSON_Delete(messageJson);
-    return;
+    co_return;
   }
-  std::string messageIdent = identItem->valuestring;
 
-  cJSON* keyItem = cJSON_GetObjectItem(messageJson, "key");
-  if (!cJSON_IsString(keyItem)) {
+  if (request.key.empty()) {
     BELL_LOG(info, LOG_TAG, "Received message without request key");
-    cJSON_Delete(messageJson);
-    return;
+    co_return;
   }
-  std::string requestKey = keyItem->valuestring;
-
-  bool requestSuccess = false;
 
-  if (messageIdent == "hm://connect-state/v1/player/command") {
-    auto res = connectStateHandler->handlePlayerCommand(messageJson);
-    if (!res) {
-      BELL_LOG(error, LOG_TAG, "Failed to handle player command: {}",
-               res.errorMessage());
-      requestSuccess = false;
+  std::optional<ConnectStateHandler::PlayerCommand> command;
+  if (request.messageIdent == "hm://connect-state/v1/player/command") {
+    auto commandRes = connectStateHandler->acceptPlayerCommand(request);
+    if (!commandRes) {
+      BELL_LOG(error, LOG_TAG, "Rejected player command: {}",
+               commandRes.errorMessage());
     } else {
-      requestSuccess = true;
+      command = commandRes.takeValue();
     }
   }
 
-  auto replyRes = dealerClient->replyToRequest(requestSuccess, requestKey);
+  // The controller waits on the ack, so it goes out before the slow part
+  auto replyRes =
+      dealerClient->replyToRequest(command.has_value(), request.key);
   if (!replyRes) {
     BELL_LOG(error, LOG_TAG, "Failed to reply to dealer request: {}",
              replyRes.errorMessage());
   }
-  cJSON_Delete(messageJson);
+  recordCommandAck(receivedAt);
+
+  if (command) {
+    co_await connectStateHandler->applyPlayerCommand(std::move(*command),
+                                                     request);
+  }
+}
+
+void cspot::Session::recordCommandAck(
+    std::chrono::steady_clock::time_point receivedAt) {
+  auto latencyUs = static_cast<uint32_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - receivedAt)
+          .count());
+
+  commandAckStats.count++;
+  commandAckStats.lastUs = latencyUs;
+  commandAckStats.maxUs = std::max(commandAckStats.maxUs, latencyUs);
+  commandAckStats.totalUs += latencyUs;
+
+  BELL_LOG(debug, LOG_TAG, "Command acked after {}us", latencyUs);
 }
 
 bell::Result<> cspot::Session::start() {
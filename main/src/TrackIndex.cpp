@@ -0,0 +1,99 @@
+#include "TrackIndex.h"
+
+#include <utility>
+
+using namespace cspot;
+
+namespace {
+// FNV-1a, with a tag byte first so a UID never collides with an equal URI
+uint64_t hashTagged(char tag, std::string_view text) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  auto mix = [&hash](uint8_t byte) {
+    hash ^= byte;
+    hash *= 0x100000001b3ULL;
+  };
+
+  mix(static_cast<uint8_t>(tag));
+  for (char c : text) {
+    mix(static_cast<uint8_t>(c));
+  }
+
+  // FNV leaves the low bits weak, fold the high ones in for the probe index
+  hash ^= hash >> 32;
+  return hash == 0 ? 1 : hash;
+}
+}  // namespace
+
+uint64_t TrackIndex::uidKey(std::string_view uid) {
+  return hashTagged('u', uid);
+}
+
+uint64_t TrackIndex::uriKey(std::string_view uri) {
+  return hashTagged('r', uri);
+}
+
+void TrackIndex::insert(uint64_t key, uint32_t position) {
+  reserveForInsert();
+
+  size_t slotIdx = key & mask();
+  while (slots[slotIdx].key != 0) {
+    if (slots[slotIdx].key == key && slots[slotIdx].position == position) {
+      return;
+    }
+    slotIdx = (slotIdx + 1) & mask();
+  }
+
+  slots[slotIdx] = {key, position};
+  count++;
+}
+
+void TrackIndex::erase(uint64_t key, uint32_t position) {
+  if (slots.empty()) {
+    return;
+  }
+
+  size_t slotIdx = key & mask();
+  while (slots[slotIdx].key != key || slots[slotIdx].position != position) {
+    if (slots[slotIdx].key == 0) {
+      return;
+    }
+    slotIdx = (slotIdx + 1) & mask();
+  }
+
+  // Shift back every following entry that probed past the freed slot
+  size_t freeIdx = slotIdx;
+  size_t nextIdx = (freeIdx + 1) & mask();
+  while (slots[nextIdx].key != 0) {
+    size_t homeIdx = slots[nextIdx].key & mask();
+    if (((nextIdx - homeIdx) & mask()) >= ((nextIdx - freeIdx) & mask())) {
+      slots[freeIdx] = slots[nextIdx];
+      freeIdx = nextIdx;
+    }
+    nextIdx = (nextIdx + 1) & mask();
+  }
+
+  slots[freeIdx] = Slot();
+  count--;
+}
+
+void TrackIndex::clear() {
+  slots.assign(slots.size(), Slot());
+  count = 0;
+}
+
+void TrackIndex::reserveForInsert() {
+  if (!slots.empty() && (count + 1) * 4 <= slots.size() * 3) {
+    return;
+  }
+
+  std::vector<Slot> oldSlots(
+      slots.empty() ? initialCapacity : slots.size() * 2);
+  std::swap(slots, oldSlots);
+  count = 0;
+
+  for (const auto& slot : oldSlots) {
+    if (slot.key != 0) {
+      insert(slot.key, slot.position);
+    }
+  }
+}
@@ -18,8 +18,18 @@ const uint32_t maxEncodedTracksWindow = 5;
 TrackProvider::TrackProvider(std::shared_ptr<SessionContext> sessionContext,
                              std::shared_ptr<SpClient> spClient)
     : sessionContext(std::move(sessionContext)), spClient(std::move(spClient)) {
-  this->contextTrackResolver =
-      std::make_unique<ContextTrackResolver>(this->spClient);
+  this->contextTrackResolver = std::make_unique<ContextTrackResolver>(
+      this->spClient, this->sessionContext->workerPool);
+
+  // The refill lands after the skip that asked for it, so the next tracks
+  // are topped up once it finishes
+  this->contextTrackResolver->setPrefetchHandler(
+      [eventLoop = this->sessionContext->eventLoop]() {
+        if (!eventLoop->post(EventLoop::EventType::TRACKPROVIDER_UPDATED,
+                             std::monostate{})) {
+          BELL_LOG(error, "TrackProvider", "Failed to post track update");
+        }
+      });
 }
 
 void TrackProvider::setQueue(const cspot_proto::Queue& queue) {
@@ -72,18 +82,34 @@ bell::Result<> TrackProvider::skipToNextTrack(
     previousTracks.erase(previousTracks.begin());
   }
 
-  nextTracks.erase(nextTracks.begin());
-
-  if (contextTrackResolver->nextTracks().size() >= maxEncodedTracksWindow) {
-    auto& ctxNext =
-        contextTrackResolver->nextTracks()[maxEncodedTracksWindow - 1];
-    nextTracks.push_back(
-        {.uri = ctxNext.uri, .uid = ctxNext.uid, .provider = "context"});
+  if (!nextTracks.empty()) {
+    nextTracks.erase(nextTracks.begin());
   }
+  fillNextTracks();
 
   return {};
 }
 
+bool TrackProvider::refreshNextTracks() {
+  contextTrackResolver->collectPrefetch();
+  return fillNextTracks();
+}
+
+bool TrackProvider::fillNextTracks() {
+  // nextTracks always mirrors the front of the resolver's next tracks
+  auto nextCtx = contextTrackResolver->nextTracks();
+  bool changed = false;
+  for (size_t i = nextTracks.size();
+       i < nextCtx.size() && nextTracks.size() < maxEncodedTracksWindow; i++) {
+    auto ctxTrack = contextTrackResolver->materialize(nextCtx[i]);
+    nextTracks.push_back({.uri = std::move(ctxTrack.uri),
+                          .uid = std::move(ctxTrack.uid),
+                          .provider = "context"});
+    changed = true;
+  }
+  return changed;
+}
+
 bell::Result<> TrackProvider::skipToPreviousTrack(
     cspot_proto::ContextTrack* track) {
   return {};
@@ -130,9 +156,11 @@ bell::Result<> TrackProvider::loadTrackAndContext(
   }
 
   auto prevCtx = contextTrackResolver->previousTracks();
-  for (auto it = prevCtx.rbegin(); it != prevCtx.rend(); ++it) {
-    previousTracks.push_back(
-        {.uri = it->uri, .uid = it->uid, .provider = "context"});
+  for (size_t i = prevCtx.size(); i-- > 0;) {
+    auto ctxTrack = contextTrackResolver->materialize(prevCtx[i]);
+    previousTracks.push_back({.uri = std::move(ctxTrack.uri),
+                              .uid = std::move(ctxTrack.uid),
+                              .provider = "context"});
 
     if (previousTracks.size() >= maxEncodedTracksWindow) {
       break;
@@ -142,15 +170,7 @@ bell::Result<> TrackProvider::loadTrackAndContext(
   // Reverse the previous tracks
   std::reverse(previousTracks.begin(), previousTracks.end());
 
-  auto nextCtx = contextTrackResolver->nextTracks();
-  for (auto* it = nextCtx.begin(); it != nextCtx.end(); ++it) {
-    nextTracks.push_back(
-        {.uri = it->uri, .uid = it->uid, .provider = "context"});
-
-    if (nextTracks.size() >= maxEncodedTracksWindow) {
-      break;
-    }
-  }
+  fillNextTracks();
 
   return {};
 }
@@ -1,12 +1,14 @@
 #include "api/DealerClient.h"
+#include "JsonWriter.h"
 #include "SessionContext.h"
-#include <cJSON.h>
+#include <algorithm>
+#include <array>
 #include <fmt/format.h>
 
 using namespace cspot;
 
 DealerClient::DealerClient(std::shared_ptr<SessionContext> ctx)
-    : sessionContext(std::move(ctx)) {}
+    : sessionContext(std::move(ctx)), wsClient(WebsocketClient::create()) {}
 
 bell::Result<> DealerClient::connect() {
   auto accessKey = sessionContext->credentialsResolver->getAccessKey();
@@ -17,42 +19,212 @@ bell::Result<> DealerClient::connect() {
 
   std::string url = fmt::format("wss://{}/?access_token={}", dealerAddr.getValue(),
                                accessKey.getValue());
-  esp_websocket_client_config_t cfg = {};
-  cfg.uri = url.c_str();
-  wsClient = esp_websocket_client_init(&cfg);
-  if (!wsClient) return std::errc::not_enough_memory;
-  esp_websocket_register_events(wsClient, WEBSOCKET_EVENT_ANY, websocketHandler,
-                                this);
-  esp_websocket_client_start(wsClient);
-  return {};
+  wsClient->setConnectionHandler(
+      [this](bool connected) { handleConnectionChange(connected); });
+  wsClient->setFragmentHandler(
+      [this](const WebsocketClient::Fragment& fragment) {
+        handleFragment(fragment);
+      });
+  return wsClient->connect(url);
 }
 
 bell::Result<> DealerClient::replyToRequest(bool success,
-                                            const std::string& requestKey) {
-  cJSON* root = cJSON_CreateObject();
-  cJSON_AddStringToObject(root, "type", "reply");
-  cJSON_AddStringToObject(root, "key", requestKey.c_str());
-  cJSON* payload = cJSON_AddObjectToObject(root, "payload");
-  cJSON_AddBoolToObject(payload, "success", success);
-  char* str = cJSON_PrintUnformatted(root);
-  cJSON_Delete(root);
-  esp_websocket_client_send_text(wsClient, str, strlen(str), portMAX_DELAY);
-  free(str);
-  return {};
-}
-
-void DealerClient::websocketHandler(void* arg, esp_event_base_t, int32_t id,
-                                    void* data) {
-  auto* self = static_cast<DealerClient*>(arg);
-  if (id == WEBSOCKET_EVENT_CONNECTED) {
-    self->connectionReady = true;
-    BELL_LOG(info, self->LOG_TAG, "Dealer websocket connected");
-  } else if (id == WEBSOCKET_EVENT_DATA) {
-    auto* event = static_cast<esp_websocket_event_data_t*>(data);
-    std::string payload(event->data_ptr, event->data_len);
-    self->sessionContext->eventLoop->post(EventLoop::EventType::DEALER_MESSAGE,
-                                          payload);
+                                            std::string_view requestKey) {
+  // Replies only differ in key and success, the rest is written verbatim
+  static constexpr std::string_view replyPrefix = R"({"type":"reply","key":")";
+  static constexpr std::string_view successSuffix =
+      R"(","payload":{"success":true}})";
+  static constexpr std::string_view failureSuffix =
+      R"(","payload":{"success":false}})";
+
+  std::array<char, 512> buffer;
+  JsonWriter writer(buffer);
+  writer.raw(replyPrefix)
+      .escaped(requestKey)
+      .raw(success ? successSuffix : failureSuffix);
+  if (writer.overflowed()) {
+    return std::errc::message_size;
+  }
+
+  return wsClient->sendText(writer.view());
+}
+
+void DealerClient::addRoute(DealerRouter::Field field, std::string_view prefix,
+                            EventLoop::EventType eventType) {
+  router.addRoute(field, prefix, eventType);
+}
+
+void DealerClient::handleConnectionChange(bool connected) {
+  connectionReady = connected;
+  if (connected) {
+    BELL_LOG(info, LOG_TAG, "Dealer websocket connected");
+  } else {
+    pendingMessage.reset();
+    discardingMessage = false;
+    isRouteDecided = false;
+    pendingEventType.reset();
+  }
+}
+
+void DealerClient::handleFragment(const WebsocketClient::Fragment& fragment) {
+  using Opcode = WebsocketClient::Opcode;
+
+  // A frame larger than the receive buffer arrives in several fragments,
+  // carrying the offset of their data within the frame
+  bool frameStart = fragment.payloadOffset == 0;
+  bool frameEnd =
+      fragment.payloadOffset + fragment.size >= fragment.payloadLength;
+
+  bool messageEnd = frameEnd && fragment.fin;
+  bool messageStart = false;
+
+  if (frameStart) {
+    if (fragment.opcode == Opcode::TEXT || fragment.opcode == Opcode::BINARY) {
+      messageStart = true;
+      pendingReceivedAt = std::chrono::steady_clock::now();
+      pendingMessage.reset();
+      discardingMessage = false;
+      isRouteDecided = false;
+      pendingEventType.reset();
+      if (fragment.payloadLength > maxMessageSize) {
+        BELL_LOG(error, LOG_TAG, "Dropping oversized dealer message");
+        discardingMessage = true;
+      } else if (!routeMessage(fragment.data, fragment.size, messageEnd)) {
+        // Nothing subscribes to it, the rest is skipped without buffering
+        discardingMessage = true;
+      } else {
+        // First frame of a message, size the buffer for all of it up front
+        pendingMessage.emplace(fragment.payloadLength);
+      }
+    } else if (fragment.opcode == Opcode::CONTINUATION) {
+      // Continuation frame of a fragmented message, its size wasn't known
+      if (!discardingMessage && !reserveFragment(fragment.payloadLength)) {
+        BELL_LOG(error, LOG_TAG, "Dropping oversized dealer message");
+        pendingMessage.reset();
+        discardingMessage = true;
+      }
+    } else {
+      // Control frames are answered by the websocket client
+      return;
+    }
+  }
+
+  if (discardingMessage || !pendingMessage) {
+    discardingMessage = !messageEnd;
+    return;
+  }
+
+  if (!pendingMessage->append(fragment.data, fragment.size)) {
+    BELL_LOG(error, LOG_TAG, "Dealer fragment exceeds its frame, dropping");
+    pendingMessage.reset();
+    discardingMessage = !messageEnd;
+    return;
+  }
+
+  // The first fragment didn't settle the route, try again with more of it
+  if (!isRouteDecided && !messageStart &&
+      (messageEnd || pendingMessage->size() <= routeWindow) &&
+      !routeMessage(pendingMessage->data(), pendingMessage->size(),
+                    messageEnd)) {
+    pendingMessage.reset();
+    discardingMessage = !messageEnd;
+    return;
+  }
+
+  if (!messageEnd) {
+    return;
+  }
+
+  if (pendingEventType) {
+    postMessage(*pendingEventType,
+                DealerFrame{std::move(*pendingMessage).freeze(),
+                            pendingReceivedAt});
   }
+  pendingMessage.reset();
+}
+
+bool DealerClient::routeMessage(const uint8_t* data, size_t size,
+                                bool isComplete) {
+  pendingEventType = isComplete
+                         ? router.match(data, size)
+                         : router.matchPartial(data, size, isRouteDecided);
+  isRouteDecided = isRouteDecided || isComplete;
+  return !isRouteDecided || pendingEventType.has_value();
+}
+
+void DealerClient::postMessage(EventLoop::EventType eventType,
+                               DealerFrame frame) {
+  // Copies share the block, the frame is kept in case the post is refused
+  if (sessionContext->eventLoop->post(eventType, DealerFrame(frame))) {
+    return;
+  }
+
+  BELL_LOG(info, LOG_TAG, "Event loop is backed up, pausing dealer reads");
+  {
+    std::scoped_lock lock(parkedMutex);
+    parkedMessage.emplace(ParkedMessage{eventType, std::move(frame)});
+  }
+  wsClient->setReadsPaused(true);
+  scheduleParkedRetry();
+}
+
+void DealerClient::scheduleParkedRetry() {
+  // Runs after the loop went through the events queued before it
+  sessionContext->eventLoop->postCallback(
+      [this, lifetime = std::weak_ptr<bool>(lifetimeToken)]() {
+        if (lifetime.lock()) {
+          retryParkedMessage();
+        }
+      },
+      EventLoop::Priority::BACKGROUND);
+}
+
+void DealerClient::retryParkedMessage() {
+  std::optional<ParkedMessage> message;
+  {
+    std::scoped_lock lock(parkedMutex);
+    std::swap(message, parkedMessage);
+  }
+  if (!message) {
+    return;
+  }
+
+  if (!sessionContext->eventLoop->post(message->eventType,
+                                       DealerFrame(message->frame))) {
+    // Still full, try again on the next pass
+    {
+      std::scoped_lock lock(parkedMutex);
+      parkedMessage = std::move(message);
+    }
+    scheduleParkedRetry();
+    return;
+  }
+
+  BELL_LOG(info, LOG_TAG, "Event loop caught up, resuming dealer reads");
+  wsClient->setReadsPaused(false);
+}
+
+bool DealerClient::reserveFragment(size_t size) {
+  if (!pendingMessage) {
+    return false;
+  }
+
+  size_t required = pendingMessage->size() + size;
+  if (required > maxMessageSize) {
+    return false;
+  }
+  if (required <= pendingMessage->capacity()) {
+    return true;
+  }
+
+  // Grow geometrically, so a message split into many frames is moved rarely
+  PayloadWriter grown(
+      std::min(maxMessageSize,
+               std::max(required, pendingMessage->capacity() * 2)));
+  grown.append(pendingMessage->data(), pendingMessage->size());
+  pendingMessage.reset();
+  pendingMessage.emplace(std::move(grown));
+  return true;
 }
 
 void DealerClient::doHousekeeping() {}
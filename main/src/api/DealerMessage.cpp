@@ -0,0 +1,363 @@
+#include "api/DealerMessage.h"
+
+#include <system_error>
+
+#include "mbedtls/base64.h"
+#include "picojson.h"
+
+using namespace cspot;
+
+namespace {
+using StringStorage = std::list<std::string>;
+
+// Receives the characters of a JSON string. As long as no escape shows up the
+// characters match the source, so only its length is tracked.
+class StringViewSink {
+ public:
+  StringViewSink(const char* source, StringStorage* storage)
+      : source(source), storage(storage) {}
+
+  void push_back(char c) {
+    if (!unescaped && source[length] != '\\') {
+      length++;
+      return;
+    }
+
+    if (!unescaped) {
+      unescaped = &storage->emplace_back(source, length);
+    }
+    unescaped->push_back(c);
+  }
+
+  std::string_view view() const {
+    return unescaped ? std::string_view(*unescaped)
+                     : std::string_view(source, length);
+  }
+
+ private:
+  const char* source;
+  StringStorage* storage;
+  std::string* unescaped = nullptr;
+  size_t length = 0;
+};
+
+// Parses the string the input is positioned at, right after its opening
+// quote. Skips it if there is no field to store it in.
+bool parseStringView(picojson::input<const char*>& in, std::string_view* out,
+                     StringStorage* storage) {
+  if (out == nullptr) {
+    picojson::null_parse_context::dummy_str ignored;
+    return picojson::_parse_string(ignored, in);
+  }
+
+  StringViewSink sink(in.cur(), storage);
+  if (!picojson::_parse_string(sink, in)) {
+    return false;
+  }
+
+  *out = sink.view();
+  return true;
+}
+
+DealerMessage::Type typeFromString(std::string_view type) {
+  if (type == "message") {
+    return DealerMessage::Type::MESSAGE;
+  }
+  if (type == "request") {
+    return DealerMessage::Type::REQUEST;
+  }
+  if (type == "ping") {
+    return DealerMessage::Type::PING;
+  }
+  if (type == "pong") {
+    return DealerMessage::Type::PONG;
+  }
+  return DealerMessage::Type::UNKNOWN;
+}
+
+// Skips over a value we don't route on, whatever its type
+template <typename Iter>
+bool skipValue(picojson::input<Iter>& in) {
+  picojson::null_parse_context skipContext;
+  return picojson::_parse(skipContext, in);
+}
+
+// PicoJSON parser for command options
+class CommandOptionsParseContext : public picojson::null_parse_context {
+ public:
+  CommandOptionsParseContext(DealerMessage::CommandOptions* options,
+                             StringStorage* storage)
+      : options(options), storage(storage) {}
+
+  template <typename Iter>
+  bool parse_string(picojson::input<Iter>& in) {
+    return parseStringView(in, currentField, storage);
+  }
+
+  template <typename Iter>
+  bool parse_object_item(picojson::input<Iter>& in, const std::string& key) {
+    if (key == "restore_paused") {
+      currentField = &options->restorePaused;
+    } else if (key == "restore_position") {
+      currentField = &options->restorePosition;
+    } else if (key == "restore_track") {
+      currentField = &options->restoreTrack;
+    } else {
+      return skipValue(in);
+    }
+
+    return _parse(*this, in);
+  }
+
+ private:
+  DealerMessage::CommandOptions* options;
+  StringStorage* storage;
+  std::string_view* currentField = nullptr;
+};
+
+// PicoJSON parser for the command of a request
+class CommandParseContext : public picojson::null_parse_context {
+ public:
+  CommandParseContext(DealerMessage::Command* command, StringStorage* storage)
+      : command(command), storage(storage) {}
+
+  template <typename Iter>
+  bool parse_string(picojson::input<Iter>& in) {
+    return parseStringView(in, currentField, storage);
+  }
+
+  template <typename Iter>
+  bool parse_object_item(picojson::input<Iter>& in, const std::string& key) {
+    if (key == "endpoint") {
+      currentField = &command->endpoint;
+    } else if (key == "data") {
+      currentField = &command->data;
+    } else if (key == "options") {
+      auto optionsCtx = CommandOptionsParseContext(&command->options, storage);
+      return _parse(optionsCtx, in);
+    } else {
+      return skipValue(in);
+    }
+
+    return _parse(*this, in);
+  }
+
+ private:
+  DealerMessage::Command* command;
+  StringStorage* storage;
+  std::string_view* currentField = nullptr;
+};
+
+// PicoJSON parser for the payload object of a request
+class RequestPayloadParseContext : public picojson::null_parse_context {
+ public:
+  RequestPayloadParseContext(DealerMessage* message, StringStorage* storage)
+      : message(message), storage(storage) {}
+
+  bool set_number(double value) {
+    if (isMessageId) {
+      message->messageId = static_cast<uint32_t>(value);
+    }
+    return true;
+  }
+
+#ifdef PICOJSON_USE_INT64
+  bool set_int64(int64_t value) {
+    if (isMessageId) {
+      message->messageId = static_cast<uint32_t>(value);
+    }
+    return true;
+  }
+#endif
+
+  template <typename Iter>
+  bool parse_string(picojson::input<Iter>& in) {
+    return parseStringView(in, currentField, storage);
+  }
+
+  template <typename Iter>
+  bool parse_object_item(picojson::input<Iter>& in, const std::string& key) {
+    isMessageId = key == "message_id";
+    currentField = nullptr;
+
+    if (key == "sent_by_device_id") {
+      currentField = &message->sentByDeviceId;
+    } else if (key == "command") {
+      auto commandCtx = CommandParseContext(&message->command, storage);
+      return _parse(commandCtx, in);
+    } else if (!isMessageId) {
+      return skipValue(in);
+    }
+
+    return _parse(*this, in);
+  }
+
+ private:
+  DealerMessage* message;
+  StringStorage* storage;
+  std::string_view* currentField = nullptr;
+  bool isMessageId = false;
+};
+
+// PicoJSON parser for the headers of a message
+class HeadersParseContext : public picojson::null_parse_context {
+ public:
+  HeadersParseContext(DealerMessage::Headers* headers, StringStorage* storage)
+      : headers(headers), storage(storage) {}
+
+  template <typename Iter>
+  bool parse_string(picojson::input<Iter>& in) {
+    return parseStringView(in, currentField, storage);
+  }
+
+  template <typename Iter>
+  bool parse_object_item(picojson::input<Iter>& in, const std::string& key) {
+    if (key == "Spotify-Connection-Id") {
+      currentField = &headers->connectionId;
+    } else if (key == "Content-Type") {
+      currentField = &headers->contentType;
+    } else if (key == "Transfer-Encoding") {
+      currentField = &headers->transferEncoding;
+    } else {
+      return skipValue(in);
+    }
+
+    return _parse(*this, in);
+  }
+
+ private:
+  DealerMessage::Headers* headers;
+  StringStorage* storage;
+  std::string_view* currentField = nullptr;
+};
+
+// PicoJSON parser for the payloads array of a message, keeps string entries
+class PayloadsParseContext : public picojson::null_parse_context {
+ public:
+  PayloadsParseContext(std::vector<std::string_view>* payloads,
+                       StringStorage* storage)
+      : payloads(payloads), storage(storage) {}
+
+  template <typename Iter>
+  bool parse_string(picojson::input<Iter>& in) {
+    return parseStringView(in, &payloads->emplace_back(), storage);
+  }
+
+  template <typename Iter>
+  bool parse_array_item(picojson::input<Iter>& in, size_t) {
+    return _parse(*this, in);
+  }
+
+  template <typename Iter>
+  bool parse_object_item(picojson::input<Iter>& in, const std::string&) {
+    return skipValue(in);
+  }
+
+ private:
+  std::vector<std::string_view>* payloads;
+  StringStorage* storage;
+};
+
+// PicoJSON parser for the root object of a dealer frame
+class DealerMessageParseContext : public picojson::null_parse_context {
+ public:
+  DealerMessageParseContext(DealerMessage* message, StringStorage* storage)
+      : message(message), storage(storage) {}
+
+  template <typename Iter>
+  bool parse_string(picojson::input<Iter>& in) {
+    return parseStringView(in, currentField, storage);
+  }
+
+  template <typename Iter>
+  bool parse_object_item(picojson::input<Iter>& in, const std::string& key) {
+    if (key == "type") {
+      std::string_view type;
+      currentField = &type;
+      if (!_parse(*this, in)) {
+        return false;
+      }
+
+      message->type = typeFromString(type);
+      currentField = nullptr;
+      return true;
+    } else if (key == "uri") {
+      currentField = &message->uri;
+    } else if (key == "message_ident") {
+      currentField = &message->messageIdent;
+    } else if (key == "key") {
+      currentField = &message->key;
+    } else if (key == "headers") {
+      auto headersCtx = HeadersParseContext(&message->headers, storage);
+      return _parse(headersCtx, in);
+    } else if (key == "payloads") {
+      auto payloadsCtx = PayloadsParseContext(&message->payloads, storage);
+      return _parse(payloadsCtx, in);
+    } else if (key == "payload") {
+      auto payloadCtx = RequestPayloadParseContext(message, storage);
+      return _parse(payloadCtx, in);
+    } else {
+      return skipValue(in);
+    }
+
+    return _parse(*this, in);
+  }
+
+ private:
+  DealerMessage* message;
+  StringStorage* storage;
+  std::string_view* currentField = nullptr;
+};
+}  // namespace
+
+bell::Result<DealerMessage> DealerMessage::parse(PayloadBuffer frame) {
+  DealerMessage message;
+  message.frame = std::move(frame);
+
+  const char* begin = reinterpret_cast<const char*>(message.frame.data());
+  const char* end = begin + message.frame.size();
+  if (begin == nullptr) {
+    return std::errc::bad_message;
+  }
+
+  auto parseCtx = DealerMessageParseContext(&message, &message.unescapedStrings);
+  std::string parseError;
+  picojson::_parse(parseCtx, begin, end, &parseError);
+
+  if (!parseError.empty()) {
+    return std::errc::bad_message;
+  }
+
+  return std::move(message);
+}
+
+bell::Result<PayloadBuffer> DealerMessage::decodePayload(
+    GzipInflater& inflater) const {
+  size_t encodedSize = 0;
+  for (auto payload : payloads) {
+    encodedSize += payload.size();
+  }
+
+  // Every payload is a base64 encoded part of the body
+  PayloadWriter decoded(encodedSize / 4 * 3 + 3);
+  for (auto payload : payloads) {
+    size_t olen = 0;
+    auto res = mbedtls_base64_decode(
+        decoded.data() + decoded.size(), decoded.capacity() - decoded.size(),
+        &olen, reinterpret_cast<const uint8_t*>(payload.data()),
+        payload.size());
+    if (res != 0) {
+      return std::errc::bad_message;
+    }
+    decoded.setSize(decoded.size() + olen);
+  }
+
+  if (headers.transferEncoding != "gzip") {
+    if (decoded.size() > maxPayloadSize) {
+      return std::errc::message_size;
+    }
+    return std::move(decoded).freeze();
+  }
+
+  return inflater.inflate(decoded.data(), decoded.size(), maxPayloadSize);
+}
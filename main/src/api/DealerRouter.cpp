@@ -0,0 +1,237 @@
+#include "api/DealerRouter.h"
+
+#include <algorithm>
+
+using namespace cspot;
+
+namespace {
+// Returned by skipString for a string running past the end of the data
+constexpr size_t unterminatedString = SIZE_MAX;
+
+// Returns the position right after the closing quote of the string starting
+// at pos, right after its opening quote
+size_t skipString(const uint8_t* frame, size_t size, size_t pos) {
+  while (pos < size) {
+    if (frame[pos] == '\\') {
+      pos += 2;
+    } else if (frame[pos] == '"') {
+      return pos + 1;
+    } else {
+      pos++;
+    }
+  }
+  return unterminatedString;
+}
+
+bool isWhitespace(uint8_t c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+}  // namespace
+
+void DealerRouter::addRoute(Field field, std::string_view prefix,
+                            EventLoop::EventType eventType) {
+  auto& trie = tries[static_cast<size_t>(field)];
+
+  auto it = std::lower_bound(
+      trie.routes.begin(), trie.routes.end(), prefix,
+      [](const Route& route, std::string_view p) { return route.prefix < p; });
+  if (it != trie.routes.end() && it->prefix == prefix) {
+    it->eventType = eventType;
+  } else {
+    trie.routes.insert(it, Route{std::string(prefix), eventType});
+  }
+
+  compile(trie);
+}
+
+void DealerRouter::compile(Trie& trie) {
+  trie.nodes.clear();
+  trie.edges.clear();
+  compileNode(trie, 0, trie.routes.size(), 0);
+}
+
+uint16_t DealerRouter::compileNode(Trie& trie, size_t first, size_t last,
+                                   size_t depth) {
+  auto nodeIdx = static_cast<uint16_t>(trie.nodes.size());
+  trie.nodes.emplace_back();
+
+  // Routes are sorted, so one ending at this depth comes first
+  if (first < last && trie.routes[first].prefix.size() == depth) {
+    trie.nodes[nodeIdx].hasRoute = true;
+    trie.nodes[nodeIdx].eventType = trie.routes[first].eventType;
+    first++;
+  }
+
+  // One edge per distinct byte at this depth
+  size_t edgeCount = 0;
+  for (size_t i = first; i < last; edgeCount++) {
+    char byte = trie.routes[i].prefix[depth];
+    while (i < last && trie.routes[i].prefix[depth] == byte) {
+      i++;
+    }
+  }
+
+  auto firstEdge = trie.edges.size();
+  trie.edges.resize(firstEdge + edgeCount);
+  trie.nodes[nodeIdx].firstEdge = static_cast<uint16_t>(firstEdge);
+  trie.nodes[nodeIdx].edgeCount = static_cast<uint16_t>(edgeCount);
+
+  for (size_t i = first, edgeIdx = firstEdge; i < last; edgeIdx++) {
+    char byte = trie.routes[i].prefix[depth];
+    size_t groupEnd = i;
+    while (groupEnd < last && trie.routes[groupEnd].prefix[depth] == byte) {
+      groupEnd++;
+    }
+
+    auto childIdx = compileNode(trie, i, groupEnd, depth + 1);
+    trie.edges[edgeIdx] = Edge{byte, childIdx};
+    i = groupEnd;
+  }
+
+  return nodeIdx;
+}
+
+std::optional<EventLoop::EventType> DealerRouter::match(const uint8_t* frame,
+                                                        size_t size) const {
+  bool isDecided = true;
+  return matchFrame(frame, size, true, isDecided);
+}
+
+std::optional<EventLoop::EventType> DealerRouter::matchPartial(
+    const uint8_t* frame, size_t size, bool& isDecided) const {
+  return matchFrame(frame, size, false, isDecided);
+}
+
+std::optional<EventLoop::EventType> DealerRouter::matchFrame(
+    const uint8_t* frame, size_t size, bool isComplete,
+    bool& isDecided) const {
+  static constexpr std::string_view uriKey = "uri";
+  static constexpr std::string_view messageIdentKey = "message_ident";
+
+  // Only keys of the root object are considered, so nested payloads carrying
+  // an "uri" of their own don't confuse the router
+  size_t depth = 0;
+  bool expectKey = false;
+
+  // Running out of data before the routed field settles leaves it undecided
+  isDecided = isComplete;
+
+  size_t pos = 0;
+  while (pos < size) {
+    uint8_t c = frame[pos];
+
+    if (c == '"') {
+      size_t stringEnd = skipString(frame, size, pos + 1);
+      if (stringEnd == unterminatedString) {
+        return std::nullopt;
+      }
+      if (depth != 1 || !expectKey) {
+        pos = stringEnd;
+        continue;
+      }
+      expectKey = false;
+
+      std::string_view key(reinterpret_cast<const char*>(frame + pos + 1),
+                           stringEnd - pos - 2);
+      const Trie* trie = nullptr;
+      if (key == uriKey) {
+        trie = &tries[static_cast<size_t>(Field::URI)];
+      } else if (key == messageIdentKey) {
+        trie = &tries[static_cast<size_t>(Field::MESSAGE_IDENT)];
+      }
+
+      pos = stringEnd;
+      if (trie == nullptr) {
+        continue;
+      }
+
+      // Move over the colon to the opening quote of the value
+      while (pos < size && (isWhitespace(frame[pos]) || frame[pos] == ':')) {
+        pos++;
+      }
+      if (pos >= size) {
+        return std::nullopt;
+      }
+      isDecided = true;
+      if (frame[pos] != '"') {
+        return std::nullopt;
+      }
+
+      bool isTruncated = false;
+      auto eventType = matchValue(*trie, frame, size, pos + 1, isTruncated);
+      isDecided = isComplete || !isTruncated;
+      return eventType;
+    }
+
+    switch (c) {
+      case '{':
+        depth++;
+        expectKey = depth == 1;
+        break;
+      case '[':
+        depth++;
+        break;
+      case '}':
+      case ']':
+        depth--;
+        break;
+      case ',':
+        expectKey = depth == 1;
+        break;
+      default:
+        break;
+    }
+    pos++;
+  }
+
+  // Neither routed field is present, pings and the like
+  return std::nullopt;
+}
+
+std::optional<EventLoop::EventType> DealerRouter::matchValue(
+    const Trie& trie, const uint8_t* frame, size_t size, size_t pos,
+    bool& isTruncated) {
+  if (trie.nodes.empty()) {
+    return std::nullopt;
+  }
+
+  std::optional<EventLoop::EventType> longestMatch;
+  const Node* node = &trie.nodes[0];
+  if (node->hasRoute) {
+    longestMatch = node->eventType;
+  }
+
+  isTruncated = true;
+  while (pos < size && frame[pos] != '"') {
+    char byte = static_cast<char>(frame[pos++]);
+    if (byte == '\\') {
+      // Escaped slashes are common in URIs, other escapes never are in routes
+      if (pos >= size) {
+        return longestMatch;
+      }
+      byte = static_cast<char>(frame[pos++]);
+      if (byte != '/' && byte != '\\' && byte != '"') {
+        isTruncated = false;
+        return longestMatch;
+      }
+    }
+
+    auto edgesBegin = trie.edges.begin() + node->firstEdge;
+    auto edgesEnd = edgesBegin + node->edgeCount;
+    auto edge = std::find_if(edgesBegin, edgesEnd,
+                             [byte](const Edge& e) { return e.byte == byte; });
+    if (edge == edgesEnd) {
+      // No longer route can match, whatever follows
+      isTruncated = false;
+      return longestMatch;
+    }
+
+    node = &trie.nodes[edge->node];
+    if (node->hasRoute) {
+      longestMatch = node->eventType;
+    }
+  }
+
+  isTruncated = pos >= size;
+  return longestMatch;
+}
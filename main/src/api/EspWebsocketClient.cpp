@@ -0,0 +1,134 @@
+#ifdef ESP_PLATFORM
+
+#include "api/EspWebsocketClient.h"
+
+#include "bell/Logger.h"
+
+using namespace cspot;
+
+EspWebsocketClient::~EspWebsocketClient() {
+  disconnect();
+}
+
+bell::Result<> EspWebsocketClient::connect(const std::string& url) {
+  esp_websocket_client_config_t cfg = {};
+  cfg.uri = url.c_str();
+  wsClient = esp_websocket_client_init(&cfg);
+  if (!wsClient) return std::errc::not_enough_memory;
+  esp_websocket_register_events(wsClient, WEBSOCKET_EVENT_ANY, websocketHandler,
+                                this);
+  esp_websocket_client_start(wsClient);
+  return {};
+}
+
+bell::Result<> EspWebsocketClient::sendText(std::string_view text) {
+  if (!wsClient) return std::errc::not_connected;
+  int sent = esp_websocket_client_send_text(wsClient, text.data(), text.size(),
+                                            pdMS_TO_TICKS(sendTimeoutMs));
+  if (sent < 0) return std::errc::io_error;
+  return {};
+}
+
+void EspWebsocketClient::disconnect() {
+  if (wsClient) {
+    esp_websocket_client_stop(wsClient);
+    esp_websocket_client_destroy(wsClient);
+    wsClient = nullptr;
+  }
+
+  std::scoped_lock lock(deliveryMutex);
+  clearHeldFragments();
+  readsPaused = false;
+}
+
+void EspWebsocketClient::setReadsPaused(bool paused) {
+  readsPaused = paused;
+  if (paused) {
+    return;
+  }
+
+  // A resume from within the handler leaves the held fragments to the
+  // release already running, so they keep their order
+  std::scoped_lock lock(deliveryMutex);
+  if (isReleasing) {
+    return;
+  }
+
+  isReleasing = true;
+  while (!readsPaused && !heldFragments.empty()) {
+    auto held = std::move(heldFragments.front());
+    heldFragments.pop_front();
+    heldBytes -= held.data.size();
+
+    if (fragmentHandler) {
+      fragmentHandler(Fragment{held.data.data(), held.data.size(),
+                               held.payloadOffset, held.payloadLength,
+                               held.opcode, held.fin});
+    }
+  }
+  isReleasing = false;
+}
+
+void EspWebsocketClient::deliverFragment(const Fragment& fragment) {
+  bool messageStart =
+      fragment.payloadOffset == 0 &&
+      (fragment.opcode == Opcode::TEXT || fragment.opcode == Opcode::BINARY);
+  bool isHolding = readsPaused || !heldFragments.empty();
+
+  // Whole messages are dropped, a partial one would only fail to parse
+  if (messageStart) {
+    droppingMessage = isHolding && heldBytes >= maxHeldBytes;
+    if (droppingMessage) {
+      BELL_LOG(error, LOG_TAG, "Receive backlog is full, dropping a message");
+    }
+  }
+  if (droppingMessage) {
+    return;
+  }
+
+  if (!isHolding) {
+    fragmentHandler(fragment);
+    return;
+  }
+
+  heldFragments.push_back(HeldFragment{
+      std::vector<uint8_t>(fragment.data, fragment.data + fragment.size),
+      fragment.payloadOffset, fragment.payloadLength, fragment.opcode,
+      fragment.fin});
+  heldBytes += fragment.size;
+}
+
+void EspWebsocketClient::clearHeldFragments() {
+  heldFragments.clear();
+  heldBytes = 0;
+  droppingMessage = false;
+}
+
+void EspWebsocketClient::websocketHandler(void* arg, esp_event_base_t,
+                                          int32_t id, void* data) {
+  auto* self = static_cast<EspWebsocketClient*>(arg);
+
+  // Serialized with the release of held fragments on resume
+  std::scoped_lock lock(self->deliveryMutex);
+  if (id == WEBSOCKET_EVENT_CONNECTED) {
+    if (self->connectionHandler) self->connectionHandler(true);
+  } else if (id == WEBSOCKET_EVENT_DISCONNECTED) {
+    // Held fragments belong to the lost connection
+    self->clearHeldFragments();
+    if (self->connectionHandler) self->connectionHandler(false);
+  } else if (id == WEBSOCKET_EVENT_DATA) {
+    auto* event = static_cast<esp_websocket_event_data_t*>(data);
+    if (!self->fragmentHandler) return;
+
+    self->deliverFragment(Fragment{
+        reinterpret_cast<const uint8_t*>(event->data_ptr),
+        static_cast<size_t>(event->data_len),
+        static_cast<size_t>(event->payload_offset),
+        static_cast<size_t>(event->payload_len),
+        static_cast<Opcode>(event->op_code),
+        event->fin,
+    });
+  }
+}
+
+#endif
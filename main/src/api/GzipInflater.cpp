@@ -0,0 +1,193 @@
+#include "api/GzipInflater.h"
+
+#include <memory>
+#include <new>
+#include <system_error>
+
+#include "bell/Logger.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_rom_crc.h"
+#include "miniz.h"
+#else
+#include <zlib.h>
+#endif
+
+using namespace cspot;
+
+namespace {
+// RFC 1952 header flags
+constexpr uint8_t headerTextFlag = 0x01;
+constexpr uint8_t headerCrcFlag = 0x02;
+constexpr uint8_t headerExtraFlag = 0x04;
+constexpr uint8_t headerNameFlag = 0x08;
+constexpr uint8_t headerCommentFlag = 0x10;
+
+// Fixed part of the header, and the CRC32 and ISIZE trailer
+constexpr size_t headerSize = 10;
+constexpr size_t trailerSize = 8;
+
+uint32_t readLE32(const uint8_t* data) {
+  return static_cast<uint32_t>(data[0]) |
+         (static_cast<uint32_t>(data[1]) << 8) |
+         (static_cast<uint32_t>(data[2]) << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+}  // namespace
+
+#ifdef ESP_PLATFORM
+struct GzipInflater::State {
+  tinfl_decompressor decompressor;
+
+  // Back-references reach at most this far, so output streams through it
+  uint8_t window[TINFL_LZ_DICT_SIZE];
+};
+#endif
+
+size_t GzipInflater::parseHeader(const uint8_t* data, size_t size) {
+  // Magic, and deflate as the compression method
+  if (size < headerSize || data[0] != 0x1f || data[1] != 0x8b ||
+      data[2] != 8) {
+    return 0;
+  }
+
+  uint8_t flags = data[3];
+  if (flags & ~(headerTextFlag | headerCrcFlag | headerExtraFlag |
+                headerNameFlag | headerCommentFlag)) {
+    return 0;
+  }
+
+  size_t offset = headerSize;
+  if (flags & headerExtraFlag) {
+    if (size < offset + 2) {
+      return 0;
+    }
+    offset += 2 + (data[offset] | (data[offset + 1] << 8));
+  }
+
+  // Zero terminated file name and comment
+  for (uint8_t flag : {headerNameFlag, headerCommentFlag}) {
+    if (!(flags & flag)) {
+      continue;
+    }
+    while (offset < size && data[offset] != 0) {
+      offset++;
+    }
+    offset++;
+  }
+
+  if (flags & headerCrcFlag) {
+    offset += 2;
+  }
+
+  return offset < size ? offset : 0;
+}
+
+bell::Result<PayloadBuffer> GzipInflater::inflate(const uint8_t* data,
+                                                  size_t size,
+                                                  size_t maxSize) {
+  size_t streamOffset = parseHeader(data, size);
+  if (streamOffset == 0 || size < streamOffset + trailerSize) {
+    BELL_LOG(error, LOG_TAG, "Invalid gzip header");
+    return std::errc::bad_message;
+  }
+
+  // The trailer carries the inflated size, so the output is allocated once
+  uint32_t inflatedSize = readLE32(data + size - 4);
+  if (inflatedSize > maxSize) {
+    BELL_LOG(error, LOG_TAG, "Inflated payload too large: {} bytes",
+             inflatedSize);
+    return std::errc::message_size;
+  }
+
+  PayloadWriter writer(inflatedSize);
+  auto crc = inflateStream(data + streamOffset,
+                           size - streamOffset - trailerSize, writer);
+  if (!crc) {
+    return crc.getError();
+  }
+
+  if (writer.size() != inflatedSize) {
+    BELL_LOG(error, LOG_TAG, "Gzip stream size mismatch");
+    return std::errc::bad_message;
+  }
+
+  if (crc.getValue() != readLE32(data + size - trailerSize)) {
+    BELL_LOG(error, LOG_TAG, "Gzip stream CRC mismatch");
+    return std::errc::bad_message;
+  }
+
+  return std::move(writer).freeze();
+}
+
+#ifdef ESP_PLATFORM
+bell::Result<uint32_t> GzipInflater::inflateStream(const uint8_t* input,
+                                                   size_t size,
+                                                   PayloadWriter& writer) {
+  // Only held while inflating, pushes are rare and the state is large
+  std::unique_ptr<State> state(new (std::nothrow) State);
+  if (!state) {
+    BELL_LOG(error, LOG_TAG, "No memory for the gzip decoder");
+    return std::errc::not_enough_memory;
+  }
+  tinfl_init(&state->decompressor);
+
+  size_t windowPos = 0;
+  uint32_t crc = 0;
+
+  while (true) {
+    size_t inputBytes = size;
+    size_t outputBytes = TINFL_LZ_DICT_SIZE - windowPos;
+
+    // Raw deflate with all input present, output wraps around the window
+    auto status = tinfl_decompress(&state->decompressor, input, &inputBytes,
+                                   state->window, state->window + windowPos,
+                                   &outputBytes, 0);
+    input += inputBytes;
+    size -= inputBytes;
+
+    if (!writer.append(state->window + windowPos, outputBytes)) {
+      BELL_LOG(error, LOG_TAG, "Gzip stream inflates past its stated size");
+      return std::errc::bad_message;
+    }
+    crc = esp_rom_crc32_le(crc, state->window + windowPos, outputBytes);
+    windowPos = (windowPos + outputBytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+    if (status == TINFL_STATUS_DONE) {
+      return crc;
+    }
+
+    if (status != TINFL_STATUS_HAS_MORE_OUTPUT) {
+      BELL_LOG(error, LOG_TAG, "Failed to inflate gzip stream: {}",
+               static_cast<int>(status));
+      return std::errc::bad_message;
+    }
+  }
+}
+#else
+bell::Result<uint32_t> GzipInflater::inflateStream(const uint8_t* input,
+                                                   size_t size,
+                                                   PayloadWriter& writer) {
+  z_stream stream{};
+  if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+    BELL_LOG(error, LOG_TAG, "No memory for the gzip decoder");
+    return std::errc::not_enough_memory;
+  }
+
+  // Memory isn't scarce here, the output is inflated in place at once
+  stream.next_in = const_cast<Bytef*>(input);
+  stream.avail_in = static_cast<uInt>(size);
+  stream.next_out = writer.data();
+  stream.avail_out = static_cast<uInt>(writer.capacity());
+  int status = ::inflate(&stream, Z_FINISH);
+  writer.setSize(stream.total_out);
+  inflateEnd(&stream);
+
+  if (status != Z_STREAM_END) {
+    BELL_LOG(error, LOG_TAG, "Failed to inflate gzip stream: {}", status);
+    return std::errc::bad_message;
+  }
+
+  return static_cast<uint32_t>(crc32(0, writer.data(), writer.size()));
+}
+#endif
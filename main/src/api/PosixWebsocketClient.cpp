@@ -0,0 +1,953 @@
+#ifndef ESP_PLATFORM
+
+#include "api/PosixWebsocketClient.h"
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+#include <mbedtls/base64.h>
+#include <mbedtls/sha1.h>
+
+#include "bell/Logger.h"
+
+using namespace cspot;
+
+namespace {
+// Appended to the handshake key before hashing, see RFC 6455 section 4.2.2
+constexpr std::string_view websocketGuid =
+    "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Status code of a normal closure
+constexpr uint16_t closeNormal = 1000;
+
+// XORs the payload with the repeating 4 byte key, eight bytes at a time
+void maskPayload(uint8_t* out, const uint8_t* in, size_t size,
+                 const uint8_t key[4]) {
+  const uint8_t pattern[8] = {key[0], key[1], key[2], key[3],
+                              key[0], key[1], key[2], key[3]};
+  uint64_t mask;
+  std::memcpy(&mask, pattern, sizeof(mask));
+
+  size_t i = 0;
+  for (; i + sizeof(mask) <= size; i += sizeof(mask)) {
+    uint64_t word;
+    std::memcpy(&word, in + i, sizeof(word));
+    word ^= mask;
+    std::memcpy(out + i, &word, sizeof(word));
+  }
+
+  // i is a multiple of 8 here, so the key index lines up again
+  for (; i < size; i++) {
+    out[i] = in[i] ^ key[i & 3];
+  }
+}
+
+bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() &&
+         std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+           return std::tolower(static_cast<unsigned char>(x)) ==
+                  std::tolower(static_cast<unsigned char>(y));
+         });
+}
+
+std::string_view trim(std::string_view value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+    value.remove_prefix(1);
+  }
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+    value.remove_suffix(1);
+  }
+  return value;
+}
+}  // namespace
+
+WebsocketReactor& WebsocketReactor::instance() {
+  static WebsocketReactor reactor;
+  return reactor;
+}
+
+WebsocketReactor::WebsocketReactor()
+    : bell::Task("websocket_reactor", 8 * 1024) {
+  if (pipe(wakeFds) != 0) {
+    BELL_LOG(error, LOG_TAG, "Failed to create wake pipe: {}", errno);
+  }
+  for (int fd : wakeFds) {
+    if (fd >= 0) {
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+  }
+
+  startTask();
+}
+
+WebsocketReactor::~WebsocketReactor() {
+  isRunning = false;
+  wake();
+
+  // Wait for the loop to exit, before members get destroyed
+  stoppedSemaphore.take(-1);
+
+  for (int fd : wakeFds) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+}
+
+void WebsocketReactor::add(PosixWebsocketClient* client) {
+  {
+    std::scoped_lock lock(clientsMutex);
+    if (std::find(clients.begin(), clients.end(), client) == clients.end()) {
+      clients.push_back(client);
+    }
+  }
+  wake();
+}
+
+void WebsocketReactor::remove(PosixWebsocketClient* client) {
+  std::scoped_lock serviceLock(serviceMutex);
+  std::scoped_lock lock(clientsMutex);
+  clients.erase(std::remove(clients.begin(), clients.end(), client),
+                clients.end());
+}
+
+void WebsocketReactor::wake() {
+  uint8_t byte = 0;
+  if (wakeFds[1] >= 0) {
+    // A full pipe already guarantees a wakeup
+    (void)::write(wakeFds[1], &byte, 1);
+  }
+}
+
+void WebsocketReactor::taskLoop() {
+  std::vector<pollfd> pollFds;
+  std::vector<PosixWebsocketClient*> polledClients;
+
+  while (isRunning) {
+    pollFds.clear();
+    polledClients.clear();
+    pollFds.push_back({wakeFds[0], POLLIN, 0});
+
+    {
+      std::scoped_lock lock(clientsMutex);
+      for (auto* client : clients) {
+        // Without a socket poll() skips the entry, but the client's timers
+        // still run, to reconnect
+        short events = 0;
+        if (client->pollFd() >= 0) {
+          // A paused client is left unread, but still written to
+          events = client->readsPausedNow() ? 0 : POLLIN;
+          if (client->wantsWrite()) {
+            events |= POLLOUT;
+          }
+        }
+        pollFds.push_back({client->pollFd(), events, 0});
+        polledClients.push_back(client);
+      }
+    }
+
+    int ready = ::poll(pollFds.data(), pollFds.size(), pollTimeoutMs);
+    if (ready < 0 && errno != EINTR) {
+      BELL_LOG(error, LOG_TAG, "poll() failed: {}", errno);
+    }
+
+    if (pollFds[0].revents & POLLIN) {
+      uint8_t drain[64];
+      while (::read(wakeFds[0], drain, sizeof(drain)) > 0) {}
+    }
+
+    std::scoped_lock serviceLock(serviceMutex);
+    auto now = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < polledClients.size(); i++) {
+      auto* client = polledClients[i];
+
+      // The client might have been removed while we were polling
+      {
+        std::scoped_lock lock(clientsMutex);
+        if (std::find(clients.begin(), clients.end(), client) ==
+            clients.end()) {
+          continue;
+        }
+      }
+
+      auto revents = pollFds[i + 1].revents;
+      if (revents & (POLLOUT | POLLERR | POLLHUP)) {
+        client->onWritable();
+      }
+      if (client->readsPausedNow() && (revents & (POLLERR | POLLHUP))) {
+        // Would be reported by every poll() until the socket is read
+        client->fail("Connection closed while paused");
+      } else if ((revents & (POLLIN | POLLERR | POLLHUP)) ||
+                 client->takeResumeRequest()) {
+        client->onReadable();
+      }
+      client->onTick(now);
+    }
+  }
+
+  stoppedSemaphore.give();
+}
+
+PosixWebsocketClient::PosixWebsocketClient(std::string caPath)
+    : caPath(std::move(caPath)) {
+  mbedtls_net_init(&netContext);
+  mbedtls_entropy_init(&entropy);
+  mbedtls_ctr_drbg_init(&ctrDrbg);
+  mbedtls_ssl_init(&ssl);
+  mbedtls_ssl_config_init(&sslConfig);
+  mbedtls_x509_crt_init(&caChain);
+
+  const char* personalization = "cspot_websocket";
+  int res = mbedtls_ctr_drbg_seed(
+      &ctrDrbg, mbedtls_entropy_func, &entropy,
+      reinterpret_cast<const uint8_t*>(personalization),
+      std::strlen(personalization));
+  if (res != 0) {
+    BELL_LOG(error, LOG_TAG, "Failed to seed the random generator: -0x{:x}",
+             -res);
+  }
+}
+
+PosixWebsocketClient::~PosixWebsocketClient() {
+  disconnect();
+
+  mbedtls_x509_crt_free(&caChain);
+  mbedtls_ssl_config_free(&sslConfig);
+  mbedtls_ssl_free(&ssl);
+  mbedtls_ctr_drbg_free(&ctrDrbg);
+  mbedtls_entropy_free(&entropy);
+  mbedtls_net_free(&netContext);
+}
+
+bell::Result<> PosixWebsocketClient::connect(const std::string& url) {
+  if (state != State::IDLE && state != State::CLOSED) {
+    return std::errc::already_connected;
+  }
+
+  // Split the url into scheme, host, port and request path
+  std::string_view rest = url;
+  if (rest.rfind("wss://", 0) == 0) {
+    useTls = true;
+    rest.remove_prefix(6);
+  } else if (rest.rfind("ws://", 0) == 0) {
+    useTls = false;
+    rest.remove_prefix(5);
+  } else {
+    return std::errc::invalid_argument;
+  }
+
+  size_t pathStart = rest.find_first_of("/?");
+  std::string_view authority = rest.substr(0, pathStart);
+  requestPath = pathStart == std::string_view::npos
+                    ? "/"
+                    : std::string(rest.substr(pathStart));
+  if (requestPath[0] == '?') {
+    requestPath.insert(0, "/");
+  }
+
+  port = useTls ? 443 : 80;
+  size_t portStart = authority.rfind(':');
+  if (portStart != std::string_view::npos) {
+    auto portString = authority.substr(portStart + 1);
+    auto [end, error] = std::from_chars(
+        portString.data(), portString.data() + portString.size(), port);
+    if (error != std::errc() || end != portString.data() + portString.size()) {
+      return std::errc::invalid_argument;
+    }
+    authority = authority.substr(0, portStart);
+  }
+  host = authority;
+
+  // The first lookup runs on the caller's thread, so it can report failure
+  auto fdRes = startConnect(host, port);
+  if (!fdRes) {
+    return fdRes.getError();
+  }
+
+  auto res = openConnection(fdRes.getValue());
+  if (!res) {
+    return res;
+  }
+
+  WebsocketReactor::instance().add(this);
+  return {};
+}
+
+PosixWebsocketClient::PendingConnect::~PendingConnect() {
+  // Nobody took the socket over
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+bell::Result<int> PosixWebsocketClient::startConnect(const std::string& host,
+                                                     uint16_t port) {
+  const char* LOG_TAG = "PosixWebsocketClient";
+
+  // Resolving is the only blocking step, the connect itself runs on the
+  // reactor
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses = nullptr;
+  if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints,
+                  &addresses) != 0) {
+    BELL_LOG(error, LOG_TAG, "Failed to resolve {}", host);
+    return std::errc::host_unreachable;
+  }
+
+  int fd = -1;
+  for (auto* address = addresses; address != nullptr;
+       address = address->ai_next) {
+    fd = ::socket(address->ai_family, address->ai_socktype,
+                  address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    if (::connect(fd, address->ai_addr, address->ai_addrlen) == 0 ||
+        errno == EINPROGRESS) {
+      break;
+    }
+
+    ::close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addresses);
+
+  if (fd < 0) {
+    BELL_LOG(error, LOG_TAG, "Failed to connect to {}:{}", host, port);
+    return std::errc::connection_refused;
+  }
+  return fd;
+}
+
+bell::Result<> PosixWebsocketClient::openConnection(int fd) {
+  netContext.fd = fd;
+
+  if (useTls) {
+    auto res = setupTls();
+    if (!res) {
+      closeTransport();
+      return res;
+    }
+  }
+
+  receiveBuffer.resize(receiveBufferSize);
+  receivedBytes = 0;
+  inFrame = false;
+  awaitingPong = false;
+  {
+    std::scoped_lock lock(sendMutex);
+    sendBuffer.clear();
+    inFlightLength = 0;
+  }
+
+  connectStartedAt = std::chrono::steady_clock::now();
+  state = State::CONNECTING;
+  return {};
+}
+
+bell::Result<> PosixWebsocketClient::setupTls() {
+  int res = 0;
+  if (!tlsConfigured) {
+    struct stat caStat {};
+    if (::stat(caPath.c_str(), &caStat) == 0 && S_ISDIR(caStat.st_mode)) {
+      res = mbedtls_x509_crt_parse_path(&caChain, caPath.c_str());
+    } else {
+      res = mbedtls_x509_crt_parse_file(&caChain, caPath.c_str());
+    }
+
+    // Positive results count certificates that failed to parse
+    if (res < 0 || caChain.raw.p == nullptr) {
+      BELL_LOG(error, LOG_TAG, "No CA certificates loaded from {}", caPath);
+      return std::errc::operation_not_permitted;
+    }
+
+    res = mbedtls_ssl_config_defaults(&sslConfig, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (res != 0) {
+      return std::errc::protocol_error;
+    }
+
+    mbedtls_ssl_conf_authmode(&sslConfig, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&sslConfig, &caChain, nullptr);
+    mbedtls_ssl_conf_rng(&sslConfig, random, this);
+    tlsConfigured = true;
+  }
+
+  // Start every connection from a fresh session
+  mbedtls_ssl_free(&ssl);
+  mbedtls_ssl_init(&ssl);
+
+  res = mbedtls_ssl_setup(&ssl, &sslConfig);
+  if (res == 0) {
+    res = mbedtls_ssl_set_hostname(&ssl, host.c_str());
+  }
+  if (res != 0) {
+    BELL_LOG(error, LOG_TAG, "Failed to set up TLS: -0x{:x}", -res);
+    return std::errc::protocol_error;
+  }
+
+  mbedtls_ssl_set_bio(&ssl, &netContext, mbedtls_net_send, mbedtls_net_recv,
+                      nullptr);
+  handshakeWantsWrite = false;
+  return {};
+}
+
+bell::Result<> PosixWebsocketClient::sendText(std::string_view text) {
+  if (state != State::OPEN) {
+    return std::errc::not_connected;
+  }
+
+  queueFrame(Opcode::TEXT, reinterpret_cast<const uint8_t*>(text.data()),
+             text.size());
+  WebsocketReactor::instance().wake();
+  return {};
+}
+
+void PosixWebsocketClient::disconnect() {
+  WebsocketReactor::instance().remove(this);
+
+  // A lookup still running closes its socket once it's done
+  pendingConnect.reset();
+
+  if (state == State::OPEN) {
+    // Best effort close frame, the socket is ours alone now
+    uint8_t status[2] = {closeNormal >> 8, closeNormal & 0xff};
+    queueFrame(Opcode::CLOSE, status, sizeof(status));
+
+    std::scoped_lock lock(sendMutex);
+    writeSendBuffer();
+  }
+
+  closeTransport();
+  state = State::CLOSED;
+}
+
+void PosixWebsocketClient::setReadsPaused(bool paused) {
+  readsPaused = paused;
+  if (!paused) {
+    resumeRequested = true;
+    WebsocketReactor::instance().wake();
+  }
+}
+
+bool PosixWebsocketClient::wantsWrite() {
+  if (state == State::CONNECTING) {
+    return true;
+  }
+  if (state == State::HANDSHAKING) {
+    return handshakeWantsWrite;
+  }
+
+  std::scoped_lock lock(sendMutex);
+  return !sendBuffer.empty();
+}
+
+void PosixWebsocketClient::onWritable() {
+  if (state == State::CONNECTING) {
+    int error = 0;
+    socklen_t errorLength = sizeof(error);
+    getsockopt(netContext.fd, SOL_SOCKET, SO_ERROR, &error, &errorLength);
+    if (error != 0) {
+      BELL_LOG(error, LOG_TAG, "TCP connect failed: {}", std::strerror(error));
+      fail("Connect failed");
+      return;
+    }
+
+    if (useTls) {
+      state = State::HANDSHAKING;
+    } else {
+      state = State::UPGRADING;
+      queueUpgradeRequest();
+    }
+  }
+
+  if (state == State::HANDSHAKING) {
+    advanceHandshake();
+    return;
+  }
+
+  if (state != State::UPGRADING && state != State::OPEN) {
+    return;
+  }
+
+  bool writeFailed = false;
+  {
+    std::scoped_lock lock(sendMutex);
+    while (!sendBuffer.empty()) {
+      int written = writeSendBuffer();
+      if (written < 0) {
+        writeFailed = true;
+        break;
+      }
+      if (written == 0) {
+        break;
+      }
+    }
+  }
+
+  // Reported outside of the lock, the handler may queue frames
+  if (writeFailed) {
+    fail("Write failed");
+  }
+}
+
+void PosixWebsocketClient::onReadable() {
+  if (state == State::HANDSHAKING) {
+    advanceHandshake();
+    return;
+  }
+
+  // Frames left over from before a pause go first
+  if (state == State::OPEN) {
+    processFrames();
+  }
+
+  while ((state == State::UPGRADING || state == State::OPEN) && !readsPaused) {
+    if (receivedBytes == receiveBuffer.size()) {
+      // Only a header that doesn't fit can leave the buffer full
+      fail("Receive buffer overflow");
+      return;
+    }
+
+    int received = transportRead(receiveBuffer.data() + receivedBytes,
+                                 receiveBuffer.size() - receivedBytes);
+    if (received < 0) {
+      fail("Connection closed");
+      return;
+    }
+    if (received == 0) {
+      return;
+    }
+    receivedBytes += received;
+
+    if (state == State::UPGRADING && !parseUpgradeResponse()) {
+      continue;
+    }
+
+    processFrames();
+  }
+}
+
+void PosixWebsocketClient::onTick(std::chrono::steady_clock::time_point now) {
+  if (state == State::BACKOFF) {
+    if (now < reconnectAt) {
+      return;
+    }
+
+    BELL_LOG(info, LOG_TAG, "Reconnecting to {}", host);
+    auto pending = std::make_shared<PendingConnect>();
+    pendingConnect = pending;
+    connectStartedAt = now;
+    state = State::RESOLVING;
+
+    // Picked up by the next tick, the reactor isn't woken from the thread as
+    // it may be gone by then
+    std::thread([pending, host = host, port = port]() {
+      auto fdRes = startConnect(host, port);
+      if (fdRes) {
+        pending->fd = fdRes.getValue();
+      }
+      pending->isDone = true;
+    }).detach();
+    return;
+  }
+
+  if (state == State::RESOLVING) {
+    if (!pendingConnect->isDone) {
+      if (now - connectStartedAt > connectTimeout) {
+        BELL_LOG(error, LOG_TAG, "Resolving {} timed out", host);
+        pendingConnect.reset();
+        reconnectAt = now + reconnectDelay;
+        state = State::BACKOFF;
+      }
+      return;
+    }
+
+    int fd = std::exchange(pendingConnect->fd, -1);
+    pendingConnect.reset();
+    if (fd < 0 || !openConnection(fd)) {
+      reconnectAt = now + reconnectDelay;
+      state = State::BACKOFF;
+    }
+    return;
+  }
+
+  if (state == State::CONNECTING || state == State::HANDSHAKING ||
+      state == State::UPGRADING) {
+    if (now - connectStartedAt > connectTimeout) {
+      fail("Connect timed out");
+    }
+    return;
+  }
+
+  if (state == State::OPEN && readsPaused) {
+    // A pong can't be read while paused, restart the keepalive on resume
+    lastPingSent = now;
+    awaitingPong = false;
+    return;
+  }
+
+  if (state != State::OPEN || now - lastPingSent < pingInterval) {
+    return;
+  }
+
+  if (awaitingPong) {
+    fail("Keepalive timed out");
+    return;
+  }
+
+  queueFrame(Opcode::PING, nullptr, 0);
+  awaitingPong = true;
+  lastPingSent = now;
+}
+
+void PosixWebsocketClient::advanceHandshake() {
+  int res = mbedtls_ssl_handshake(&ssl);
+  if (res == MBEDTLS_ERR_SSL_WANT_READ || res == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    handshakeWantsWrite = res == MBEDTLS_ERR_SSL_WANT_WRITE;
+    return;
+  }
+
+  if (res != 0) {
+    BELL_LOG(error, LOG_TAG, "TLS handshake failed: -0x{:x}", -res);
+    fail("Handshake failed");
+    return;
+  }
+
+  state = State::UPGRADING;
+  queueUpgradeRequest();
+}
+
+void PosixWebsocketClient::queueUpgradeRequest() {
+  std::scoped_lock lock(sendMutex);
+
+  uint8_t keyBytes[16];
+  random(this, keyBytes, sizeof(keyBytes));
+
+  char key[32];
+  size_t keyLength = 0;
+  mbedtls_base64_encode(reinterpret_cast<uint8_t*>(key), sizeof(key),
+                        &keyLength, keyBytes, sizeof(keyBytes));
+  handshakeKey.assign(key, keyLength);
+
+  std::string hostHeader = host;
+  if (port != (useTls ? 443 : 80)) {
+    hostHeader += ":" + std::to_string(port);
+  }
+
+  std::string request = "GET " + requestPath +
+                        " HTTP/1.1\r\n"
+                        "Host: " +
+                        hostHeader +
+                        "\r\n"
+                        "Upgrade: websocket\r\n"
+                        "Connection: Upgrade\r\n"
+                        "Sec-WebSocket-Key: " +
+                        handshakeKey +
+                        "\r\n"
+                        "Sec-WebSocket-Version: 13\r\n\r\n";
+  sendBuffer.insert(sendBuffer.end(), request.begin(), request.end());
+}
+
+bool PosixWebsocketClient::parseUpgradeResponse() {
+  std::string_view received(reinterpret_cast<const char*>(receiveBuffer.data()),
+                            receivedBytes);
+  size_t headersEnd = received.find("\r\n\r\n");
+  if (headersEnd == std::string_view::npos) {
+    return false;
+  }
+
+  std::string_view headers = received.substr(0, headersEnd);
+  if (headers.rfind("HTTP/1.1 101", 0) != 0) {
+    BELL_LOG(error, LOG_TAG, "Upgrade rejected: {}",
+             headers.substr(0, headers.find("\r\n")));
+    fail("Upgrade rejected");
+    return false;
+  }
+
+  // Expected accept value, base64 of the SHA-1 of key and GUID
+  std::string acceptInput = handshakeKey + std::string(websocketGuid);
+  uint8_t digest[20];
+  mbedtls_sha1(reinterpret_cast<const uint8_t*>(acceptInput.data()),
+               acceptInput.size(), digest);
+  char expectedAccept[32];
+  size_t expectedLength = 0;
+  mbedtls_base64_encode(reinterpret_cast<uint8_t*>(expectedAccept),
+                        sizeof(expectedAccept), &expectedLength, digest,
+                        sizeof(digest));
+
+  bool acceptValid = false;
+  size_t lineStart = headers.find("\r\n");
+  while (lineStart != std::string_view::npos) {
+    lineStart += 2;
+    size_t lineEnd = headers.find("\r\n", lineStart);
+    auto line = headers.substr(lineStart, lineEnd - lineStart);
+
+    size_t colon = line.find(':');
+    if (colon != std::string_view::npos &&
+        equalsIgnoreCase(trim(line.substr(0, colon)), "Sec-WebSocket-Accept")) {
+      acceptValid = trim(line.substr(colon + 1)) ==
+                    std::string_view(expectedAccept, expectedLength);
+    }
+    lineStart = lineEnd;
+  }
+
+  if (!acceptValid) {
+    fail("Invalid Sec-WebSocket-Accept");
+    return false;
+  }
+
+  // Frames may already follow the response
+  size_t consumed = headersEnd + 4;
+  std::memmove(receiveBuffer.data(), receiveBuffer.data() + consumed,
+               receivedBytes - consumed);
+  receivedBytes -= consumed;
+
+  state = State::OPEN;
+  lastPingSent = std::chrono::steady_clock::now();
+  BELL_LOG(info, LOG_TAG, "Websocket connected to {}", host);
+
+  if (connectionHandler) {
+    connectionHandler(true);
+  }
+  return state == State::OPEN;
+}
+
+void PosixWebsocketClient::processFrames() {
+  size_t pos = 0;
+
+  while (state == State::OPEN && !readsPaused) {
+    const uint8_t* data = receiveBuffer.data() + pos;
+    size_t available = receivedBytes - pos;
+
+    if (!inFrame) {
+      if (available < 2) {
+        break;
+      }
+
+      size_t headerLength = 2;
+      uint64_t payloadLength = data[1] & 0x7f;
+      if (payloadLength == 126) {
+        headerLength += 2;
+      } else if (payloadLength == 127) {
+        headerLength += 8;
+      }
+
+      // Servers must not mask their frames
+      if (data[1] & 0x80) {
+        fail("Masked frame from server");
+        return;
+      }
+
+      if (available < headerLength) {
+        break;
+      }
+
+      if (payloadLength == 126) {
+        payloadLength = (data[2] << 8) | data[3];
+      } else if (payloadLength == 127) {
+        payloadLength = 0;
+        for (size_t i = 0; i < 8; i++) {
+          payloadLength = (payloadLength << 8) | data[2 + i];
+        }
+      }
+
+      auto opcode = static_cast<Opcode>(data[0] & 0x0f);
+      bool fin = data[0] & 0x80;
+
+      // Control frames are short and unfragmented, handle them whole
+      if (data[0] & 0x08) {
+        if (payloadLength > 125 || !fin) {
+          fail("Invalid control frame");
+          return;
+        }
+        if (available < headerLength + payloadLength) {
+          break;
+        }
+
+        handleControlFrame(opcode, data + headerLength, payloadLength);
+        pos += headerLength + payloadLength;
+        continue;
+      }
+
+      frameOpcode = opcode;
+      frameFin = fin;
+      framePayloadLength = payloadLength;
+      framePayloadOffset = 0;
+      inFrame = true;
+
+      pos += headerLength;
+      data += headerLength;
+      available -= headerLength;
+    }
+
+    size_t chunk =
+        std::min(available, framePayloadLength - framePayloadOffset);
+    if (chunk == 0 && framePayloadLength != 0) {
+      break;
+    }
+
+    // Whatever arrived of the payload is handed over right away
+    if (fragmentHandler) {
+      fragmentHandler(Fragment{data, chunk, framePayloadOffset,
+                               framePayloadLength, frameOpcode, frameFin});
+    }
+
+    pos += chunk;
+    framePayloadOffset += chunk;
+    if (framePayloadOffset == framePayloadLength) {
+      inFrame = false;
+    }
+  }
+
+  std::memmove(receiveBuffer.data(), receiveBuffer.data() + pos,
+               receivedBytes - pos);
+  receivedBytes -= pos;
+}
+
+void PosixWebsocketClient::handleControlFrame(Opcode opcode,
+                                              const uint8_t* payload,
+                                              size_t size) {
+  switch (opcode) {
+    case Opcode::PING:
+      queueFrame(Opcode::PONG, payload, size);
+      break;
+    case Opcode::PONG:
+      awaitingPong = false;
+      break;
+    case Opcode::CLOSE:
+      // Echo the status, then drop the connection
+      queueFrame(Opcode::CLOSE, payload, std::min<size_t>(size, 2));
+      onWritable();
+      fail("Closed by server");
+      break;
+    default:
+      fail("Unknown control frame");
+      break;
+  }
+}
+
+void PosixWebsocketClient::queueFrame(Opcode opcode, const uint8_t* payload,
+                                      size_t size) {
+  uint8_t header[14];
+  size_t headerLength = 2;
+
+  header[0] = 0x80 | static_cast<uint8_t>(opcode);
+  if (size < 126) {
+    header[1] = 0x80 | static_cast<uint8_t>(size);
+  } else if (size <= 0xffff) {
+    header[1] = 0x80 | 126;
+    header[2] = static_cast<uint8_t>(size >> 8);
+    header[3] = static_cast<uint8_t>(size);
+    headerLength = 4;
+  } else {
+    header[1] = 0x80 | 127;
+    for (size_t i = 0; i < 8; i++) {
+      header[2 + i] = static_cast<uint8_t>(static_cast<uint64_t>(size) >>
+                                           (56 - 8 * i));
+    }
+    headerLength = 10;
+  }
+
+  std::scoped_lock lock(sendMutex);
+
+  // Clients mask every frame with a fresh key
+  uint8_t* maskKey = header + headerLength;
+  random(this, maskKey, 4);
+  headerLength += 4;
+
+  sendBuffer.insert(sendBuffer.end(), header, header + headerLength);
+  size_t payloadStart = sendBuffer.size();
+  sendBuffer.resize(payloadStart + size);
+  maskPayload(sendBuffer.data() + payloadStart, payload, size, maskKey);
+}
+
+int PosixWebsocketClient::random(void* ctx, uint8_t* output, size_t len) {
+  auto* self = static_cast<PosixWebsocketClient*>(ctx);
+  std::scoped_lock lock(self->randomMutex);
+  return mbedtls_ctr_drbg_random(&self->ctrDrbg, output, len);
+}
+
+int PosixWebsocketClient::transportRead(uint8_t* buf, size_t len) {
+  int res = useTls ? mbedtls_ssl_read(&ssl, buf, len)
+                   : mbedtls_net_recv(&netContext, buf, len);
+  if (res == MBEDTLS_ERR_SSL_WANT_READ || res == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  }
+
+  // Zero means the peer closed the connection
+  return res > 0 ? res : -1;
+}
+
+int PosixWebsocketClient::transportWrite(const uint8_t* buf, size_t len) {
+  if (len == 0) {
+    return 0;
+  }
+
+  int res = useTls ? mbedtls_ssl_write(&ssl, buf, len)
+                   : mbedtls_net_send(&netContext, buf, len);
+  if (res == MBEDTLS_ERR_SSL_WANT_READ || res == MBEDTLS_ERR_SSL_WANT_WRITE) {
+    return 0;
+  }
+  return res > 0 ? res : -1;
+}
+
+int PosixWebsocketClient::writeSendBuffer() {
+  // Frames queued since a blocked write wait for its record to go out
+  size_t length = inFlightLength > 0 ? inFlightLength : sendBuffer.size();
+  int written = transportWrite(sendBuffer.data(), length);
+  if (written == 0) {
+    inFlightLength = length;
+    return 0;
+  }
+
+  inFlightLength = 0;
+  if (written > 0) {
+    sendBuffer.erase(sendBuffer.begin(), sendBuffer.begin() + written);
+  }
+  return written;
+}
+
+void PosixWebsocketClient::fail(const char* reason) {
+  if (state == State::CLOSED || state == State::BACKOFF ||
+      state == State::RESOLVING) {
+    return;
+  }
+
+  BELL_LOG(error, LOG_TAG, "Websocket to {} dropped: {}, reconnecting in {}s",
+           host, reason, reconnectDelay.count());
+  closeTransport();
+  reconnectAt = std::chrono::steady_clock::now() + reconnectDelay;
+  state = State::BACKOFF;
+
+  if (connectionHandler) {
+    connectionHandler(false);
+  }
+}
+
+void PosixWebsocketClient::closeTransport() {
+  mbedtls_net_free(&netContext);
+
+  std::scoped_lock lock(sendMutex);
+  sendBuffer.clear();
+  inFlightLength = 0;
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <memory>
 #include <cJSON.h>
 #include "NanoPBExtensions.h"
+#include "ServerClock.h"
 #include "Utils.h"
 #include "bell/Logger.h"
 #include "bell/http/Client.h"
@@ -34,6 +35,12 @@ bell::Result<> SpClient::putConnectState(
     return std::errc::bad_message;
   }
 
+  return putConnectState(freshBuffer, sessionContext->sessionId, retryCount);
+}
+
+bell::Result<> SpClient::putConnectState(
+    const std::vector<uint8_t>& encodedState, const std::string& connectionId,
+    int retryCount) {
   auto addrRes = sessionContext->credentialsResolver->getApAddress(
       CredentialsResolver::AddressType::SpClient);
 
@@ -52,6 +59,7 @@ bell::Result<> SpClient::putConnectState(
   // size_t encodedLength = encodeRes;
 
   uint32_t salt = std::rand();
+  int64_t sentAtMs = ServerClock::localNowMs();
   auto response = bell::http::requestWithBodyPtr(
       bell::http::Method::PUT,
       fmt::format(
@@ -62,11 +70,11 @@ bell::Result<> SpClient::putConnectState(
               "Content-Type",
               "application/x-protobuf",
           },
-          {"X-Spotify-Connection-Id", sessionContext->sessionId},
+          {"X-Spotify-Connection-Id", connectionId},
           {"Authorization", fmt::format("Bearer {}", accessToken)},
       },
-      reinterpret_cast<const std::byte*>(freshBuffer.data()),
-      freshBuffer.size());
+      reinterpret_cast<const std::byte*>(encodedState.data()),
+      encodedState.size());
 
   if (!response) {
     BELL_LOG(error, LOG_TAG, "Error while sending request: {}",
@@ -75,6 +83,7 @@ bell::Result<> SpClient::putConnectState(
   }
 
   auto httpResponse = response.takeValue();
+  sampleServerClock(httpResponse, sentAtMs);
   if (httpResponse.getStatusCode().unwrap() != 200) {
     BELL_LOG(error, LOG_TAG, "Error while sending request: {}",
              httpResponse.getStatusCode().unwrap());
@@ -83,6 +92,15 @@ bell::Result<> SpClient::putConnectState(
   return {};
 }
 
+void SpClient::sampleServerClock(const bell::HTTPReader& response,
+                                 int64_t sentAtMs) {
+  auto date = response.getHeader("Date");
+  if (date) {
+    sessionContext->serverClock->addSample(*date, sentAtMs,
+                                           ServerClock::localNowMs());
+  }
+}
+
 bell::Result<bell::HTTPReader> SpClient::contextResolve(
     const std::string& contextUri) {
   auto addrRes = sessionContext->credentialsResolver->getApAddress(
@@ -105,6 +123,7 @@ bell::Result<bell::HTTPReader> SpClient::contextResolve(
     return clientTokenRes.getError();
   }
   auto clientToken = clientTokenRes.takeValue();
+  int64_t sentAtMs = ServerClock::localNowMs();
   auto response = bell::http::request(
       bell::http::Method::GET,
       fmt::format("https://{}/context-resolve/v1/{}", spClientAddress,
@@ -120,6 +139,7 @@ bell::Result<bell::HTTPReader> SpClient::contextResolve(
     return response.getError();
   }
 
+  sampleServerClock(response.getValue(), sentAtMs);
   return response;
 }
 
@@ -148,6 +168,7 @@ bell::Result<bell::HTTPReader> SpClient::doRequest(
   }
   auto clientToken = clientTokenRes.takeValue();
 
+  int64_t sentAtMs = ServerClock::localNowMs();
   auto response = bell::http::request(
       method, fmt::format("https://{}/{}", spClientAddress, requestUrl),
       {
@@ -161,6 +182,7 @@ bell::Result<bell::HTTPReader> SpClient::doRequest(
     return response.getError();
   }
 
+  sampleServerClock(response.getValue(), sentAtMs);
   return response;
 }
 
@@ -0,0 +1,17 @@
+#include "api/WebsocketClient.h"
+
+#ifdef ESP_PLATFORM
+#include "api/EspWebsocketClient.h"
+#else
+#include "api/PosixWebsocketClient.h"
+#endif
+
+using namespace cspot;
+
+std::unique_ptr<WebsocketClient> WebsocketClient::create() {
+#ifdef ESP_PLATFORM
+  return std::make_unique<EspWebsocketClient>();
+#else
+  return std::make_unique<PosixWebsocketClient>();
+#endif
+}
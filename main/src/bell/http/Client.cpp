@@ -1,3 +1,5 @@
+#ifdef ESP_PLATFORM
+
 #include "bell/http/Reader.h"
 #include <esp_http_client.h>
 #include <cstring>
@@ -5,7 +7,14 @@
 namespace bell {
 namespace http {
 
-static esp_err_t event_handler(esp_http_client_event_t*) { return ESP_OK; }
+static esp_err_t event_handler(esp_http_client_event_t* event) {
+  if (event->event_id == HTTP_EVENT_ON_HEADER && event->user_data &&
+      isKeptHeader(event->header_key)) {
+    auto* headers = static_cast<Headers*>(event->user_data);
+    headers->emplace_back(event->header_key, event->header_value);
+  }
+  return ESP_OK;
+}
 
 static bell::Result<HTTPReader> perform(Method method, const std::string& url,
                                         const std::vector<std::pair<std::string, std::string>>& headers,
@@ -14,6 +23,8 @@ static bell::Result<HTTPReader> perform(Method method, const std::string& url,
   esp_http_client_config_t cfg = {};
   cfg.url = url.c_str();
   cfg.event_handler = event_handler;
+  Headers responseHeaders;
+  cfg.user_data = &responseHeaders;
   esp_http_client_handle_t client = esp_http_client_init(&cfg);
   if (!client) return std::errc::not_enough_memory;
   switch (method) {
@@ -46,7 +57,7 @@ static bell::Result<HTTPReader> perform(Method method, const std::string& url,
     esp_http_client_read(client, response.data(), len);
   }
   esp_http_client_cleanup(client);
-  return HTTPReader(status, std::move(response));
+  return HTTPReader(status, std::move(response), std::move(responseHeaders));
 }
 
 bell::Result<HTTPReader> request(Method method, const std::string& url,
@@ -68,3 +79,5 @@ bell::Result<HTTPReader> requestWithBodyPtr(Method method, const std::string& ur
 
 }  // namespace http
 }  // namespace bell
+
+#endif
@@ -0,0 +1,402 @@
+#ifndef ESP_PLATFORM
+
+#include "bell/http/Reader.h"
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <optional>
+
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+#include "bell/Logger.h"
+
+namespace bell {
+namespace http {
+
+namespace {
+const char* LOG_TAG = "HTTPClient";
+
+// Trusted CA certificates for https://
+constexpr const char* caPath = "/etc/ssl/certs";
+
+// Longest a request may stall on the socket
+constexpr uint32_t readTimeoutMs = 15000;
+
+struct Url {
+  bool useTls = false;
+  std::string host;
+  std::string port;
+  std::string path;
+};
+
+std::string_view trim(std::string_view value) {
+  while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) {
+    value.remove_prefix(1);
+  }
+  while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) {
+    value.remove_suffix(1);
+  }
+  return value;
+}
+
+std::optional<Url> parseUrl(std::string_view url) {
+  Url parsed;
+  if (url.rfind("https://", 0) == 0) {
+    parsed.useTls = true;
+    url.remove_prefix(8);
+  } else if (url.rfind("http://", 0) == 0) {
+    url.remove_prefix(7);
+  } else {
+    return std::nullopt;
+  }
+
+  size_t pathStart = url.find_first_of("/?");
+  std::string_view authority = url.substr(0, pathStart);
+  parsed.path = pathStart == std::string_view::npos
+                    ? "/"
+                    : std::string(url.substr(pathStart));
+  if (parsed.path[0] == '?') {
+    parsed.path.insert(0, "/");
+  }
+
+  parsed.port = parsed.useTls ? "443" : "80";
+  size_t portStart = authority.rfind(':');
+  if (portStart != std::string_view::npos) {
+    parsed.port = authority.substr(portStart + 1);
+    authority = authority.substr(0, portStart);
+  }
+  parsed.host = authority;
+
+  if (parsed.host.empty()) {
+    return std::nullopt;
+  }
+  return parsed;
+}
+
+// Blocking connection of a single request, TLS through mbedTLS
+class Connection {
+ public:
+  Connection() {
+    mbedtls_net_init(&netContext);
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&ctrDrbg);
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_config_init(&sslConfig);
+    mbedtls_x509_crt_init(&caChain);
+  }
+
+  ~Connection() {
+    mbedtls_x509_crt_free(&caChain);
+    mbedtls_ssl_config_free(&sslConfig);
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ctr_drbg_free(&ctrDrbg);
+    mbedtls_entropy_free(&entropy);
+    mbedtls_net_free(&netContext);
+  }
+
+  Connection(const Connection&) = delete;
+  Connection& operator=(const Connection&) = delete;
+
+  bell::Result<> open(const Url& url) {
+    useTls = url.useTls;
+    int res = mbedtls_net_connect(&netContext, url.host.c_str(),
+                                  url.port.c_str(), MBEDTLS_NET_PROTO_TCP);
+    if (res != 0) {
+      BELL_LOG(error, LOG_TAG, "Failed to connect to {}:{}: -0x{:x}",
+               url.host, url.port, -res);
+      return std::errc::connection_refused;
+    }
+
+    if (!useTls) {
+      return {};
+    }
+
+    const char* personalization = "cspot_http";
+    res = mbedtls_ctr_drbg_seed(
+        &ctrDrbg, mbedtls_entropy_func, &entropy,
+        reinterpret_cast<const uint8_t*>(personalization),
+        std::strlen(personalization));
+    if (res != 0) {
+      return std::errc::protocol_error;
+    }
+
+    struct stat caStat {};
+    if (::stat(caPath, &caStat) == 0 && S_ISDIR(caStat.st_mode)) {
+      res = mbedtls_x509_crt_parse_path(&caChain, caPath);
+    } else {
+      res = mbedtls_x509_crt_parse_file(&caChain, caPath);
+    }
+
+    // Positive results count certificates that failed to parse
+    if (res < 0 || caChain.raw.p == nullptr) {
+      BELL_LOG(error, LOG_TAG, "No CA certificates loaded from {}", caPath);
+      return std::errc::operation_not_permitted;
+    }
+
+    res = mbedtls_ssl_config_defaults(&sslConfig, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (res != 0) {
+      return std::errc::protocol_error;
+    }
+
+    mbedtls_ssl_conf_authmode(&sslConfig, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&sslConfig, &caChain, nullptr);
+    mbedtls_ssl_conf_rng(&sslConfig, mbedtls_ctr_drbg_random, &ctrDrbg);
+    mbedtls_ssl_conf_read_timeout(&sslConfig, readTimeoutMs);
+
+    res = mbedtls_ssl_setup(&ssl, &sslConfig);
+    if (res == 0) {
+      res = mbedtls_ssl_set_hostname(&ssl, url.host.c_str());
+    }
+    if (res != 0) {
+      BELL_LOG(error, LOG_TAG, "Failed to set up TLS: -0x{:x}", -res);
+      return std::errc::protocol_error;
+    }
+
+    mbedtls_ssl_set_bio(&ssl, &netContext, mbedtls_net_send, nullptr,
+                        mbedtls_net_recv_timeout);
+
+    res = mbedtls_ssl_handshake(&ssl);
+    if (res != 0) {
+      BELL_LOG(error, LOG_TAG, "TLS handshake with {} failed: -0x{:x}",
+               url.host, -res);
+      return std::errc::protocol_error;
+    }
+    return {};
+  }
+
+  bell::Result<> write(const void* data, size_t size) {
+    auto* bytes = static_cast<const uint8_t*>(data);
+    while (size > 0) {
+      int res = useTls ? mbedtls_ssl_write(&ssl, bytes, size)
+                       : mbedtls_net_send(&netContext, bytes, size);
+      if (res <= 0) {
+        return std::errc::io_error;
+      }
+      bytes += res;
+      size -= res;
+    }
+    return {};
+  }
+
+  // Amount of bytes read, 0 once the server closed the connection
+  bell::Result<size_t> read(uint8_t* buffer, size_t size) {
+    int res = useTls ? mbedtls_ssl_read(&ssl, buffer, size)
+                     : mbedtls_net_recv_timeout(&netContext, buffer, size,
+                                                readTimeoutMs);
+    if (res == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+      return size_t(0);
+    }
+    if (res == MBEDTLS_ERR_SSL_TIMEOUT) {
+      return std::errc::timed_out;
+    }
+    if (res < 0) {
+      return std::errc::io_error;
+    }
+    return static_cast<size_t>(res);
+  }
+
+ private:
+  bool useTls = false;
+  mbedtls_net_context netContext;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctrDrbg;
+  mbedtls_ssl_context ssl;
+  mbedtls_ssl_config sslConfig;
+  mbedtls_x509_crt caChain;
+};
+
+// Joins the chunks of a "Transfer-Encoding: chunked" body
+std::optional<std::string> decodeChunked(std::string_view body) {
+  std::string decoded;
+  while (true) {
+    size_t lineEnd = body.find("\r\n");
+    if (lineEnd == std::string_view::npos) {
+      return std::nullopt;
+    }
+
+    // Chunk extensions after a ';' are ignored
+    size_t chunkSize = 0;
+    auto [end, error] =
+        std::from_chars(body.data(), body.data() + lineEnd, chunkSize, 16);
+    if (error != std::errc() || end == body.data()) {
+      return std::nullopt;
+    }
+    body.remove_prefix(lineEnd + 2);
+
+    if (chunkSize == 0) {
+      return decoded;
+    }
+    if (body.size() < chunkSize + 2) {
+      return std::nullopt;
+    }
+    decoded.append(body.substr(0, chunkSize));
+    body.remove_prefix(chunkSize + 2);
+  }
+}
+
+bell::Result<HTTPReader> parseResponse(std::string response) {
+  size_t headersEnd = response.find("\r\n\r\n");
+  if (headersEnd == std::string::npos || response.rfind("HTTP/", 0) != 0) {
+    return std::errc::bad_message;
+  }
+
+  // "HTTP/1.1 200 OK"
+  std::string_view head(response.data(), headersEnd);
+  size_t statusStart = head.find(' ');
+  int status = 0;
+  if (statusStart == std::string_view::npos ||
+      std::from_chars(head.data() + statusStart + 1,
+                      head.data() + head.size(), status)
+              .ec != std::errc()) {
+    return std::errc::bad_message;
+  }
+
+  Headers headers;
+  bool isChunked = false;
+  std::optional<size_t> contentLength;
+
+  size_t lineStart = head.find("\r\n");
+  while (lineStart != std::string_view::npos) {
+    lineStart += 2;
+    size_t lineEnd = head.find("\r\n", lineStart);
+    auto line = head.substr(lineStart, lineEnd - lineStart);
+    lineStart = lineEnd;
+
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+      continue;
+    }
+    auto key = trim(line.substr(0, colon));
+    auto value = trim(line.substr(colon + 1));
+
+    if (equalsIgnoreCase(key, "Transfer-Encoding")) {
+      isChunked = equalsIgnoreCase(value, "chunked");
+    } else if (equalsIgnoreCase(key, "Content-Length")) {
+      size_t length = 0;
+      if (std::from_chars(value.data(), value.data() + value.size(), length)
+              .ec == std::errc()) {
+        contentLength = length;
+      }
+    } else if (isKeptHeader(key)) {
+      headers.emplace_back(key, value);
+    }
+  }
+
+  std::string body = response.substr(headersEnd + 4);
+  if (isChunked) {
+    auto decoded = decodeChunked(body);
+    if (!decoded) {
+      BELL_LOG(error, LOG_TAG, "Malformed chunked response body");
+      return std::errc::bad_message;
+    }
+    body = std::move(*decoded);
+  } else if (contentLength) {
+    if (body.size() < *contentLength) {
+      BELL_LOG(error, LOG_TAG, "Response body truncated");
+      return std::errc::bad_message;
+    }
+    body.resize(*contentLength);
+  }
+
+  return HTTPReader(status, std::move(body), std::move(headers));
+}
+
+const char* methodName(Method method) {
+  switch (method) {
+    case Method::POST:
+      return "POST";
+    case Method::PUT:
+      return "PUT";
+    default:
+      return "GET";
+  }
+}
+
+bell::Result<HTTPReader> perform(
+    Method method, const std::string& url,
+    const std::vector<std::pair<std::string, std::string>>& headers,
+    const std::byte* body = nullptr, size_t bodyLen = 0) {
+  auto parsedUrl = parseUrl(url);
+  if (!parsedUrl) {
+    return std::errc::invalid_argument;
+  }
+
+  Connection connection;
+  auto res = connection.open(*parsedUrl);
+  if (!res) {
+    return res.getError();
+  }
+
+  // One request per connection, the response ends when the server closes it
+  std::string request = std::string(methodName(method)) + " " +
+                        parsedUrl->path + " HTTP/1.1\r\nHost: " +
+                        parsedUrl->host + "\r\nConnection: close\r\n";
+  for (const auto& [key, value] : headers) {
+    request += key + ": " + value + "\r\n";
+  }
+  if (method != Method::GET || bodyLen > 0) {
+    request += "Content-Length: " + std::to_string(bodyLen) + "\r\n";
+  }
+  request += "\r\n";
+
+  res = connection.write(request.data(), request.size());
+  if (res && bodyLen > 0) {
+    res = connection.write(body, bodyLen);
+  }
+  if (!res) {
+    return res.getError();
+  }
+
+  std::string response;
+  uint8_t buffer[4096];
+  while (true) {
+    auto received = connection.read(buffer, sizeof(buffer));
+    if (!received) {
+      BELL_LOG(error, LOG_TAG, "Failed to read the response from {}",
+               parsedUrl->host);
+      return received.getError();
+    }
+    if (received.getValue() == 0) {
+      break;
+    }
+    response.append(reinterpret_cast<const char*>(buffer),
+                    received.getValue());
+  }
+
+  return parseResponse(std::move(response));
+}
+}  // namespace
+
+bell::Result<HTTPReader> request(
+    Method method, const std::string& url,
+    const std::vector<std::pair<std::string, std::string>>& headers) {
+  return perform(method, url, headers, nullptr, 0);
+}
+
+bell::Result<HTTPReader> requestWithBody(
+    Method method, const std::string& url,
+    const std::vector<std::pair<std::string, std::string>>& headers,
+    const std::vector<std::byte>& body) {
+  return perform(method, url, headers, body.data(), body.size());
+}
+
+bell::Result<HTTPReader> requestWithBodyPtr(
+    Method method, const std::string& url,
+    const std::vector<std::pair<std::string, std::string>>& headers,
+    const std::byte* body, size_t size) {
+  return perform(method, url, headers, body, size);
+}
+
+}  // namespace http
+}  // namespace bell
+
+#endif
@@ -1,62 +1,496 @@
 #include "events/EventLoop.h"
 
+#include <algorithm>
+
 #include "bell/Logger.h"
 
 using namespace cspot;
 
-cspot::EventLoop::EventLoop() : bell::Task("cspot_event_loop", 8 * 1024) {
+namespace {
+// Default lane of each event type
+EventLoop::Priority defaultPriority(EventLoop::EventType type) {
+  switch (type) {
+    case EventLoop::EventType::DEALER_REQUEST:
+      return EventLoop::Priority::CONTROL;
+    case EventLoop::EventType::CURRENT_TRACK_METADATA:
+      return EventLoop::Priority::BACKGROUND;
+    default:
+      return EventLoop::Priority::STATE;
+  }
+}
+}  // namespace
+
+cspot::EventLoop::EventLoop(size_t laneCapacity)
+    : bell::Task("cspot_event_loop", 8 * 1024) {
+  for (auto& lane : lanes) {
+    lane = std::make_unique<MPSCQueue<Event>>(laneCapacity);
+  }
+
+  for (size_t i = 0; i < laneForType.size(); i++) {
+    laneForType[i] = defaultPriority(static_cast<EventType>(i));
+  }
+
+  for (auto& batch : batches) {
+    batch.pendingIndex.fill(SIZE_MAX);
+    batch.foldNext.fill(false);
+  }
+
+  handlerTable = std::make_shared<const HandlerTable>();
+
+  // Only the latest state of these matters
+  setCoalescing(EventType::TRACKPROVIDER_UPDATED, Coalescing::LATEST_WINS);
+  setCoalescing(EventType::CURRENT_TRACK_METADATA, Coalescing::LATEST_WINS);
+  setQueuePolicy(EventType::TRACKPROVIDER_UPDATED, 2, OverflowPolicy::COALESCE);
+  setQueuePolicy(EventType::CURRENT_TRACK_METADATA, 2,
+                 OverflowPolicy::COALESCE);
+
+  // Dealer events are posted from the websocket thread, which must never
+  // block. A refused request is held back by the DealerClient, which pauses
+  // its reads until the loop caught up. Pushes are superseded by newer ones.
+  setQueuePolicy(EventType::DEALER_REQUEST, laneCapacity,
+                 OverflowPolicy::DROP_NEWEST);
+  setQueuePolicy(EventType::DEALER_MESSAGE, 16, OverflowPolicy::DROP_OLDEST);
+
+  // Callbacks resume tasks and complete jobs, losing one hangs its owner
+  setQueuePolicy(EventType::CALLBACK, laneCapacity, OverflowPolicy::SPILL);
+
   // Run the event loop in a separate thread
   startTask();
 }
 
+cspot::EventLoop::~EventLoop() {
+  isRunning = false;
+  eventSemaphore.give();
+  notifyProducers();
+
+  // Wait for the loop to exit, before members get destroyed
+  stoppedSemaphore.take(-1);
+}
+
 void EventLoop::taskLoop() {
-  // Process events with a timeout of 1000ms
-  processEvents(1000);
+  loopThreadId = std::this_thread::get_id();
+
+  while (isRunning) {
+    // Process events with a timeout of 1000ms
+    processEvents(1000);
+  }
+
+  stoppedSemaphore.give();
+}
+
+void EventLoop::waitForEvents(int timeoutMs) {
+  consumerSleeping.store(true);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  // Re-check after announcing the sleep, a producer might have raced us
+  if (!lanesEmpty() || timersChanged) {
+    consumerSleeping.store(false);
+    return;
+  }
+
+  // A stale token left over from a raced wakeup only causes a spurious pass
+  eventSemaphore.take(timeoutMs);
+  consumerSleeping.store(false);
 }
 
 void EventLoop::processEvents(int timeoutMs) {
+  int waitMs = timeoutMs;
+  timersChanged = false;
+  {
+    // Don't sleep past the next timer expiry
+    std::scoped_lock lock(timerMutex);
+    int timerMs = timerWheel.msUntilNextExpiry(TimerWheel::Clock::now());
+    if (timerMs >= 0 && timerMs < waitMs) {
+      waitMs = timerMs;
+    }
+  }
+
   // Wait for events to be posted
-  if (!eventSemaphore.take(timeoutMs)) {
-    return;  // Timeout, no events to process
+  if (lanesEmpty() && waitMs > 0) {
+    waitForEvents(waitMs);
   }
 
-  std::queue<Event> processingQueue;
+  runExpiredTimers();
+  dispatchLanes();
+}
 
-  {
-    std::scoped_lock lock(queueMutex);
+bool EventLoop::lanesEmpty() const {
+  for (size_t i = 0; i < laneCount; i++) {
+    if (!lanes[i]->empty() || spillLists[i].count > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void EventLoop::collectLane(size_t laneIdx, const HandlerTable& table) {
+  auto& lane = *lanes[laneIdx];
+  auto& batch = batches[laneIdx];
+  bool hasCollected = false;
+  bool isDrained = false;
+
+  while (batch.events.size() < lane.capacity()) {
+    auto event = lane.tryPop();
+    if (!event.has_value()) {
+      isDrained = true;
+      break;
+    }
+    hasCollected = true;
+    collectEvent(laneIdx, std::move(event.value()), table);
+  }
+
+  // Spilled events were posted after the ones in the lane
+  auto& spillList = spillLists[laneIdx];
+  if (isDrained && spillList.count > 0) {
+    std::deque<Event> spilled;
+    {
+      std::scoped_lock lock(spillList.mutex);
+      spilled.swap(spillList.events);
+      spillList.count = 0;
+    }
+
+    for (auto& event : spilled) {
+      collectEvent(laneIdx, std::move(event), table);
+    }
+    hasCollected = true;
+  }
+
+  if (hasCollected) {
+    notifyProducers();
+  }
+}
+
+void EventLoop::collectEvent(size_t laneIdx, Event&& event,
+                             const HandlerTable& table) {
+  auto& batch = batches[laneIdx];
+  auto typeIdx = static_cast<size_t>(event.type);
+  auto& entry = table.entries[typeIdx];
+  auto& counters = typeCounters[typeIdx];
+  uint32_t queued = --counters.queued;
+  if (queued <= entry.capacity / 4) {
+    counters.isLagging = false;
+  }
+
+  // A newer event of this type was posted over capacity, make room for it
+  bool isReplaced = false;
+  uint32_t replacements = counters.pendingReplacements;
+  while (replacements > 0 && !isReplaced) {
+    isReplaced = counters.pendingReplacements.compare_exchange_weak(
+        replacements, replacements - 1);
+  }
 
-    if (eventQueue.empty()) {
-      return;  // No events to process
+  if (isReplaced) {
+    uint32_t dropped = ++counters.dropped;
+    if (entry.overflowPolicy == OverflowPolicy::DROP_OLDEST) {
+      BELL_LOG(error, LOG_TAG,
+               "Event queue full, dropped oldest event of type {} ({} dropped "
+               "so far)",
+               static_cast<int>(event.type), dropped);
+      return;
     }
+  }
+
+  size_t pendingIdx = batch.pendingIndex[typeIdx];
+  bool hasPending = pendingIdx != SIZE_MAX && pendingIdx >= batch.cursor;
+  bool shouldFold = hasPending && (entry.coalescing != Coalescing::NONE ||
+                                   batch.foldNext[typeIdx]);
+  batch.foldNext[typeIdx] = isReplaced;
+
+  if (!shouldFold) {
+    // No undispatched instance to fold into in this batch
+    batch.pendingIndex[typeIdx] = batch.events.size();
+    batch.events.push_back(std::move(event));
+    return;
+  }
 
-    // Swap with the main queue under lock
-    processingQueue.swap(eventQueue);
+  auto& pending = batch.events[pendingIdx].payload;
+  if (entry.merge) {
+    pending = entry.merge(std::move(pending), std::move(event.payload));
+  } else {
+    pending = std::move(event.payload);
   }
+}
+
+void EventLoop::dispatchLanes() {
+  // Keeps the table alive for the pass, even if a handler replaces it
+  HandlerTablePtr tablePtr = handlerTable.load(std::memory_order_acquire);
+  const HandlerTable& table = *tablePtr;
+
+  // Only drain the combined lane length per pass, so constant posting can't
+  // keep us here forever
+  for (size_t i = 0; i < laneCount; i++) {
+    collectLane(i, table);
+  }
+
+  std::array<uint32_t, laneCount> credits = laneBudgets;
+  while (true) {
+    // Pick up control events that arrived while handlers were running
+    collectLane(0, table);
 
-  // Process each event
-  while (!processingQueue.empty()) {
-    Event event = std::move(processingQueue.front());
-    processingQueue.pop();
+    bool hasDispatched = false;
+    bool hasPending = false;
 
-    // Call the appropriate handler for the event type
-    std::scoped_lock lock(handlersMutex);
-    auto it = handlers.find(event.type);
-    if (it != handlers.end()) {
-      try {
-        it->second(std::move(event));
-      } catch (const std::exception& e) {
-        BELL_LOG(error, LOG_TAG, "Error in event handler: {}", e.what());
+    // Re-check from the top after every event, so a control event never waits
+    // for more than one lower priority handler
+    for (size_t i = 0; i < laneCount && !hasDispatched; i++) {
+      auto& batch = batches[i];
+      if (batch.cursor >= batch.events.size()) {
+        continue;
       }
+
+      hasPending = true;
+      if (credits[i] == 0) {
+        continue;
+      }
+
+      credits[i]--;
+      hasDispatched = true;
+      dispatchEvent(std::move(batch.events[batch.cursor++]));
+    }
+
+    if (!hasPending) {
+      break;  // No more events to process
+    }
+
+    if (!hasDispatched) {
+      // Only lanes that ran out of budget have events left, start a new round
+      credits = laneBudgets;
     }
   }
+
+  for (auto& batch : batches) {
+    batch.events.clear();
+    batch.cursor = 0;
+    batch.pendingIndex.fill(SIZE_MAX);
+    batch.foldNext.fill(false);
+  }
 }
 
-void EventLoop::registerHandler(EventType type, EventHandler handler) {
+void EventLoop::dispatchEvent(Event&& event) {
+  // Call the appropriate handlers for the event type, without holding any lock
+  if (event.type == EventType::CALLBACK) {
+    try {
+      std::get<Callback>(event.payload)();
+    } catch (const std::exception& e) {
+      BELL_LOG(error, LOG_TAG, "Error in event callback: {}", e.what());
+    }
+    return;
+  }
+
+  HandlerTablePtr table = handlerTable.load(std::memory_order_acquire);
+  auto& handlers = table->entries[static_cast<size_t>(event.type)].handlers;
+
+  for (size_t i = 0; i < handlers.size(); i++) {
+    try {
+      if (i + 1 == handlers.size()) {
+        // Last subscriber can take ownership of the event
+        handlers[i](std::move(event));
+      } else {
+        handlers[i](Event(event));
+      }
+    } catch (const std::exception& e) {
+      BELL_LOG(error, LOG_TAG, "Error in event handler: {}", e.what());
+    }
+  }
+}
+
+EventLoop::TimerHandle EventLoop::scheduleTimer(
+    uint32_t delayMs, uint32_t periodMs, std::function<void()> callback) {
+  std::shared_ptr<TimerWheel::Timer> timer;
+  {
+    std::scoped_lock lock(timerMutex);
+    timer = timerWheel.schedule(delayMs, periodMs, std::move(callback));
+  }
+
+  // The loop might be sleeping past the new expiry, make it re-evaluate
+  timersChanged = true;
+  wakeConsumer();
+  return TimerHandle(std::move(timer));
+}
+
+void EventLoop::runExpiredTimers() {
+  std::vector<std::shared_ptr<TimerWheel::Timer>> expired;
+  {
+    std::scoped_lock lock(timerMutex);
+    timerWheel.advance(TimerWheel::Clock::now(), expired);
+  }
+
+  // Callbacks run without the timer lock, so they can schedule new timers
+  for (auto& timer : expired) {
+    if (auto callback = timer->claimCallback()) {
+      callback();
+    }
+  }
+}
+
+bool EventLoop::reserveSlot(EventType type, SlotReservation& reservation) {
+  auto typeIdx = static_cast<size_t>(type);
+  HandlerTablePtr table = handlerTable.load(std::memory_order_acquire);
+  auto& entry = table->entries[typeIdx];
+  auto& counters = typeCounters[typeIdx];
+  reservation.spills = entry.overflowPolicy == OverflowPolicy::SPILL;
+
+  while (true) {
+    uint32_t queued = ++counters.queued;
+    if (entry.capacity == 0 || queued <= entry.capacity || reservation.spills) {
+      break;
+    }
+
+    if (entry.overflowPolicy == OverflowPolicy::DROP_OLDEST ||
+        entry.overflowPolicy == OverflowPolicy::COALESCE) {
+      reservation.replacesOlder = true;
+      break;
+    }
+
+    counters.queued--;
+    if (entry.overflowPolicy == OverflowPolicy::BLOCK &&
+        waitForSpace([&]() { return counters.queued < entry.capacity; })) {
+      continue;
+    }
+
+    counters.dropped++;
+    onQueueFull(type);
+    return false;
+  }
+
+  uint32_t queued = counters.queued;
+  uint32_t highWaterMark = counters.highWaterMark;
+  while (queued > highWaterMark &&
+         !counters.highWaterMark.compare_exchange_weak(highWaterMark, queued)) {
+  }
+
+  if (reservation.replacesOlder ||
+      (entry.capacity > 0 && queued * 4 >= entry.capacity * 3)) {
+    reportBackpressure(type);
+  }
+  return true;
+}
+
+void EventLoop::spill(size_t laneIdx, Event&& event) {
+  auto& spillList = spillLists[laneIdx];
+  std::scoped_lock lock(spillList.mutex);
+  spillList.events.push_back(std::move(event));
+  spillList.count++;
+}
+
+bool EventLoop::waitForLane(EventType type) {
+  auto typeIdx = static_cast<size_t>(type);
+  HandlerTablePtr table = handlerTable.load(std::memory_order_acquire);
+  auto& entry = table->entries[typeIdx];
+
+  if (entry.overflowPolicy == OverflowPolicy::BLOCK) {
+    uint32_t lastDrain = drainCount;
+    if (waitForSpace([&]() { return drainCount != lastDrain; })) {
+      return true;
+    }
+  }
+
+  // Release the slot reserved for the event
+  typeCounters[typeIdx].queued--;
+  typeCounters[typeIdx].dropped++;
+  return false;
+}
+
+bool EventLoop::waitForSpace(const std::function<bool()>& hasSpace) {
+  if (std::this_thread::get_id() == loopThreadId.load()) {
+    return false;  // Nobody would drain the queue
+  }
+
+  std::unique_lock lock(spaceMutex);
+  blockedProducers++;
+  while (isRunning && !hasSpace()) {
+    // The loop notifies after every drain, the timeout covers a notification
+    // racing with this check
+    spaceCondition.wait_for(lock, std::chrono::milliseconds(100));
+  }
+  blockedProducers--;
+  return isRunning;
+}
+
+void EventLoop::notifyProducers() {
+  drainCount++;
+  if (blockedProducers > 0) {
+    std::scoped_lock lock(spaceMutex);
+    spaceCondition.notify_all();
+  }
+}
+
+void EventLoop::onQueueFull(EventType type) {
+  BELL_LOG(error, LOG_TAG,
+           "Event queue full, dropped event of type {} ({} dropped so far)",
+           static_cast<int>(type),
+           typeCounters[static_cast<size_t>(type)].dropped.load());
+  reportBackpressure(type);
+}
+
+void EventLoop::reportBackpressure(EventType type) {
+  auto& counters = typeCounters[static_cast<size_t>(type)];
+  if (counters.isLagging.exchange(true)) {
+    return;  // Already reported, until the type drains
+  }
+
+  HandlerTablePtr table = handlerTable.load(std::memory_order_acquire);
+  if (table->onBackpressure) {
+    table->onBackpressure(type, getQueueStats(type));
+  }
+}
+
+EventLoop::QueueStats EventLoop::getQueueStats(EventType type) const {
+  auto& counters = typeCounters[static_cast<size_t>(type)];
+  return {counters.queued, counters.highWaterMark, counters.dropped};
+}
+
+void EventLoop::updateHandlerTable(
+    const std::function<void(HandlerTable&)>& update) {
   std::scoped_lock lock(handlersMutex);
-  handlers.insert({type, std::move(handler)});
+  auto table = std::make_shared<HandlerTable>(*handlerTable.load());
+  update(*table);
+
+  // The replaced table is freed once no reader holds it anymore
+  handlerTable.store(std::move(table), std::memory_order_release);
+}
+
+void EventLoop::registerHandler(EventType type, EventHandler handler) {
+  updateHandlerTable([&](HandlerTable& table) {
+    table.entries[static_cast<size_t>(type)].handlers.push_back(
+        std::move(handler));
+  });
 }
 
 void EventLoop::unregisterHandler(EventType type) {
-  std::scoped_lock lock(handlersMutex);
-  handlers.erase(type);
+  updateHandlerTable([&](HandlerTable& table) {
+    table.entries[static_cast<size_t>(type)].handlers.clear();
+  });
+}
+
+void EventLoop::setCoalescing(EventType type, Coalescing coalescing,
+                              MergeFunction merge) {
+  updateHandlerTable([&](HandlerTable& table) {
+    auto& entry = table.entries[static_cast<size_t>(type)];
+    entry.coalescing = coalescing;
+    entry.merge = std::move(merge);
+  });
+}
+
+void EventLoop::setQueuePolicy(EventType type, uint32_t capacity,
+                               OverflowPolicy policy) {
+  if (type == EventType::CALLBACK && policy != OverflowPolicy::SPILL) {
+    BELL_LOG(error, LOG_TAG, "Callbacks must never be dropped, keeping SPILL");
+    policy = OverflowPolicy::SPILL;
+  }
+
+  // The lane bounds the type anyway
+  capacity = std::min<uint32_t>(capacity, lanes[0]->capacity());
+
+  updateHandlerTable([&](HandlerTable& table) {
+    auto& entry = table.entries[static_cast<size_t>(type)];
+    entry.capacity = capacity;
+    entry.overflowPolicy = policy;
+  });
+}
+
+void EventLoop::setBackpressureCallback(BackpressureCallback callback) {
+  updateHandlerTable([&](HandlerTable& table) {
+    table.onBackpressure = std::move(callback);
+  });
 }
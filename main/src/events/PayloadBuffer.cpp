@@ -0,0 +1,117 @@
+#include "events/PayloadBuffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+using namespace cspot;
+
+PayloadBuffer PayloadBuffer::copyFrom(const void* data, size_t size) {
+  PayloadWriter writer(size);
+  writer.append(data, size);
+  return std::move(writer).freeze();
+}
+
+void PayloadBuffer::release() {
+  if (block && block->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    PayloadPool::instance().free(block);
+  }
+  block = nullptr;
+}
+
+PayloadWriter::PayloadWriter(size_t capacity)
+    : block(PayloadPool::instance().allocate(capacity)) {}
+
+PayloadWriter::~PayloadWriter() {
+  if (block) {
+    PayloadPool::instance().free(block);
+  }
+}
+
+void PayloadWriter::setSize(size_t size) {
+  block->size = static_cast<uint32_t>(std::min<size_t>(size, block->capacity));
+}
+
+bool PayloadWriter::append(const void* data, size_t size) {
+  if (size > block->capacity - block->size) {
+    return false;
+  }
+  if (size == 0) {
+    return true;
+  }
+
+  std::memcpy(block->bytes() + block->size, data, size);
+  block->size += static_cast<uint32_t>(size);
+  return true;
+}
+
+PayloadBuffer PayloadWriter::freeze() && {
+  block->refCount.store(1, std::memory_order_relaxed);
+  return PayloadBuffer(std::exchange(block, nullptr));
+}
+
+PayloadPool& PayloadPool::instance() {
+  static PayloadPool pool;
+  return pool;
+}
+
+PayloadPool::~PayloadPool() {
+  for (auto& freeList : freeLists) {
+    for (auto* block : freeList) {
+      block->~Block();
+      ::operator delete(block);
+    }
+  }
+}
+
+PayloadBuffer::Block* PayloadPool::allocate(size_t capacity) {
+  uint8_t sizeClass = 0;
+  while (sizeClass < sizeClassCount && classCapacities[sizeClass] < capacity) {
+    sizeClass++;
+  }
+
+  PayloadBuffer::Block* block = nullptr;
+  if (sizeClass < sizeClassCount) {
+    capacity = classCapacities[sizeClass];
+
+    std::scoped_lock lock(freeListsMutex);
+    auto& freeList = freeLists[sizeClass];
+    if (!freeList.empty()) {
+      block = freeList.back();
+      freeList.pop_back();
+      cachedBytes -= block->capacity;
+    }
+  } else {
+    sizeClass = unpooledClass;
+  }
+
+  if (!block) {
+    void* memory = ::operator new(sizeof(PayloadBuffer::Block) + capacity);
+    block = new (memory) PayloadBuffer::Block();
+    block->capacity = static_cast<uint32_t>(capacity);
+    block->sizeClass = sizeClass;
+  }
+
+  block->refCount.store(0, std::memory_order_relaxed);
+  block->size = 0;
+  return block;
+}
+
+void PayloadPool::free(PayloadBuffer::Block* block) {
+  if (block->sizeClass != unpooledClass) {
+    std::scoped_lock lock(freeListsMutex);
+    auto& freeList = freeLists[block->sizeClass];
+    if (freeList.size() < classCacheLimits[block->sizeClass] &&
+        cachedBytes + block->capacity <= maxCachedBytes) {
+      if (freeList.capacity() == 0) {
+        freeList.reserve(classCacheLimits[block->sizeClass]);
+      }
+      freeList.push_back(block);
+      cachedBytes += block->capacity;
+      return;
+    }
+  }
+
+  block->~Block();
+  ::operator delete(block);
+}
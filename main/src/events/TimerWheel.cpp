@@ -0,0 +1,169 @@
+#include "events/TimerWheel.h"
+
+#include <algorithm>
+#include <utility>
+
+using namespace cspot;
+
+TimerWheel::TimerWheel(uint32_t tickMs)
+    : tickMs(tickMs), startTime(Clock::now()) {}
+
+void TimerWheel::Timer::cancel() {
+  // Destroyed outside the lock, along with whatever the callback captured
+  std::function<void()> released;
+  {
+    std::scoped_lock lock(callbackMutex);
+    cancelled = true;
+    released = std::exchange(callback, nullptr);
+  }
+}
+
+std::function<void()> TimerWheel::Timer::claimCallback() {
+  std::scoped_lock lock(callbackMutex);
+  if (cancelled) {
+    return nullptr;
+  }
+  if (periodTicks > 0) {
+    return callback;
+  }
+  return std::exchange(callback, nullptr);
+}
+
+uint64_t TimerWheel::tickAt(Clock::time_point time) const {
+  auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       time - startTime)
+                       .count();
+  return static_cast<uint64_t>(std::max<int64_t>(elapsedMs, 0)) / tickMs;
+}
+
+std::shared_ptr<TimerWheel::Timer> TimerWheel::schedule(
+    uint32_t delayMs, uint32_t periodMs, std::function<void()> callback) {
+  auto now = Clock::now();
+  if (timerCount == 0) {
+    // The wheel does not turn while empty, catch up first
+    currentTick = std::max(currentTick, tickAt(now));
+  }
+
+  auto timer = std::make_shared<Timer>();
+  timer->callback = std::move(callback);
+
+  // Always round up, so a timer never fires early
+  auto expiresAtMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         now - startTime)
+                         .count() +
+                     delayMs;
+  timer->expiresAtTick = std::max<uint64_t>(
+      (expiresAtMs + tickMs - 1) / tickMs, currentTick + 1);
+  timer->periodTicks =
+      periodMs > 0 ? std::max<uint32_t>((periodMs + tickMs - 1) / tickMs, 1)
+                   : 0;
+
+  insert(timer);
+  return timer;
+}
+
+void TimerWheel::insert(std::shared_ptr<Timer> timer) {
+  // Timers cascaded on their expiry tick land in the slot processed next
+  uint64_t expiresAt = std::max(timer->expiresAtTick, currentTick);
+  uint64_t delta = expiresAt - currentTick;
+
+  uint32_t level = 0;
+  while (level < levelCount - 1 &&
+         delta >= (1ULL << (slotBits * (level + 1)))) {
+    level++;
+  }
+
+  // Timers beyond the range of the last level park in its furthest slot, and
+  // get re-bucketed once it cascades
+  uint64_t maxDelta = (1ULL << (slotBits * levelCount)) - 1;
+  uint64_t bucketTick = delta > maxDelta ? currentTick + maxDelta : expiresAt;
+
+  uint32_t slot = (bucketTick >> (slotBits * level)) & slotMask;
+  levels[level][slot].push_back(std::move(timer));
+  timerCount++;
+}
+
+void TimerWheel::cascade(uint32_t level) {
+  uint32_t slot = (currentTick >> (slotBits * level)) & slotMask;
+
+  Slot timers;
+  timers.swap(levels[level][slot]);
+  timerCount -= timers.size();
+
+  for (auto& timer : timers) {
+    if (!timer->cancelled) {
+      insert(std::move(timer));
+    }
+  }
+}
+
+void TimerWheel::advance(Clock::time_point now,
+                         std::vector<std::shared_ptr<Timer>>& expired) {
+  uint64_t targetTick = tickAt(now);
+
+  if (timerCount == 0) {
+    // Nothing to expire, skip ahead
+    currentTick = std::max(currentTick, targetTick);
+    return;
+  }
+
+  while (currentTick < targetTick) {
+    currentTick++;
+
+    // Cascade higher levels whenever the level below wraps around, top-down
+    // so timers moved from above are still picked up on this tick
+    uint32_t wrappedLevels = 0;
+    while (wrappedLevels < levelCount - 1 &&
+           (currentTick &
+            ((1ULL << (slotBits * (wrappedLevels + 1))) - 1)) == 0) {
+      wrappedLevels++;
+    }
+    for (uint32_t level = wrappedLevels; level > 0; level--) {
+      cascade(level);
+    }
+
+    Slot timers;
+    timers.swap(levels[0][currentTick & slotMask]);
+    timerCount -= timers.size();
+
+    for (auto& timer : timers) {
+      if (timer->cancelled) {
+        continue;
+      }
+
+      if (timer->periodTicks > 0) {
+        // Re-arm relative to the scheduled tick, so periodic timers don't drift
+        timer->expiresAtTick += timer->periodTicks;
+        insert(timer);
+      }
+
+      expired.push_back(std::move(timer));
+    }
+  }
+}
+
+int TimerWheel::msUntilNextExpiry(Clock::time_point now) const {
+  if (timerCount == 0) {
+    return -1;
+  }
+
+  auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                       now - startTime)
+                       .count();
+  auto untilTick = [&](uint64_t tick) {
+    return std::max<int64_t>(static_cast<int64_t>(tick * tickMs) - elapsedMs,
+                             0);
+  };
+
+  // Higher levels only cascade down on the next wrap of the lowest level
+  uint64_t nextWrap = (currentTick | slotMask) + 1;
+
+  // Lowest level holds everything up to one lap ahead, in order
+  for (uint32_t i = 1; i < slotCount; i++) {
+    if (!levels[0][(currentTick + i) & slotMask].empty()) {
+      return static_cast<int>(untilTick(std::min(currentTick + i, nextWrap)));
+    }
+  }
+
+  return static_cast<int>(untilTick(nextWrap));
+}
@@ -0,0 +1,172 @@
+#include "events/WorkerPool.h"
+
+#include <algorithm>
+
+#include "bell/Logger.h"
+
+#ifdef ESP_PLATFORM
+#include <esp_pthread.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace cspot;
+
+namespace {
+// Set on worker threads, so jobs submitted from a worker stay local
+thread_local const WorkerPool* currentPool = nullptr;
+thread_local size_t currentWorkerIdx = 0;
+}  // namespace
+
+WorkerPool::WorkerPool(std::shared_ptr<EventLoop> eventLoop,
+                       size_t workerCount, bool pinWorkers)
+    : eventLoop(std::move(eventLoop)) {
+  if (workerCount == 0) {
+    workerCount = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  }
+
+  for (size_t i = 0; i < workerCount; i++) {
+    workers.push_back(std::make_unique<Worker>());
+  }
+
+  for (size_t i = 0; i < workerCount; i++) {
+    startWorker(i, pinWorkers);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  // Workers drain their queues before exiting, see workerLoop
+  {
+    std::scoped_lock lock(idleMutex);
+    isRunning = false;
+  }
+  idleCondition.notify_all();
+
+  for (auto& worker : workers) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
+    }
+  }
+}
+
+void WorkerPool::startWorker(size_t workerIdx, bool pin) {
+  unsigned int coreCount =
+      std::max<unsigned int>(std::thread::hardware_concurrency(), 1);
+
+#ifdef ESP_PLATFORM
+  // The config applies to every std::thread created by the calling task, keep
+  // the caller's one to restore it afterwards
+  esp_pthread_cfg_t previousCfg;
+  bool hasPreviousCfg = esp_pthread_get_cfg(&previousCfg) == ESP_OK;
+
+  // FreeRTOS tasks can only be pinned on creation. The default stack is far
+  // too small for HTTP and JSON jobs, use the same one as the EventLoop.
+  esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+  cfg.thread_name = "cspot_worker";
+  cfg.stack_size = workerStackSize;
+  cfg.pin_to_core = pin ? static_cast<int>(workerIdx % coreCount) : -1;
+  esp_pthread_set_cfg(&cfg);
+#endif
+
+  auto& worker = *workers[workerIdx];
+  worker.thread = std::thread([this, workerIdx] { workerLoop(workerIdx); });
+
+#ifdef ESP_PLATFORM
+  if (!hasPreviousCfg) {
+    previousCfg = esp_pthread_get_default_config();
+  }
+  esp_pthread_set_cfg(&previousCfg);
+#endif
+
+#if !defined(ESP_PLATFORM) && defined(__linux__)
+  if (pin) {
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(workerIdx % coreCount, &cpuSet);
+    if (pthread_setaffinity_np(worker.thread.native_handle(), sizeof(cpuSet),
+                               &cpuSet) != 0) {
+      BELL_LOG(error, LOG_TAG, "Failed to pin worker {} to a core",
+               workerIdx);
+    }
+  }
+#else
+  (void)coreCount;
+#endif
+}
+
+void WorkerPool::submit(Job job) {
+  size_t workerIdx = currentPool == this
+                         ? currentWorkerIdx
+                         : nextWorker.fetch_add(1) % workers.size();
+  // Counted before it becomes visible, so a worker never sees it negative
+  pendingJobs++;
+  {
+    auto& worker = *workers[workerIdx];
+    std::scoped_lock lock(worker.jobsMutex);
+    worker.jobs.push_back(std::move(job));
+  }
+
+  if (idleWorkers > 0) {
+    // Taking the lock makes sure the worker is either waiting, or will see
+    // the new job when checking the predicate
+    std::scoped_lock lock(idleMutex);
+    idleCondition.notify_one();
+  }
+}
+
+bool WorkerPool::takeJob(size_t workerIdx, Job& job) {
+  {
+    // Own jobs are taken from the back, the most recently pushed first
+    auto& worker = *workers[workerIdx];
+    std::scoped_lock lock(worker.jobsMutex);
+    if (!worker.jobs.empty()) {
+      job = std::move(worker.jobs.back());
+      worker.jobs.pop_back();
+      return true;
+    }
+  }
+
+  // Steal the oldest job of another worker, starting with our neighbour
+  for (size_t i = 1; i < workers.size(); i++) {
+    auto& victim = *workers[(workerIdx + i) % workers.size()];
+    std::scoped_lock lock(victim.jobsMutex);
+    if (!victim.jobs.empty()) {
+      job = std::move(victim.jobs.front());
+      victim.jobs.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void WorkerPool::workerLoop(size_t workerIdx) {
+  currentPool = this;
+  currentWorkerIdx = workerIdx;
+
+  while (true) {
+    Job job;
+    if (takeJob(workerIdx, job)) {
+      pendingJobs--;
+
+      try {
+        job();
+      } catch (const std::exception& e) {
+        BELL_LOG(error, LOG_TAG, "Error in worker job: {}", e.what());
+      }
+      continue;
+    }
+
+    // Only exit once every queue is empty, so each queued job still runs and
+    // posts its completion. Otherwise tasks awaiting it would never resume.
+    if (!isRunning) {
+      break;
+    }
+
+    std::unique_lock lock(idleMutex);
+    idleWorkers++;
+    idleCondition.wait(lock, [this] { return pendingJobs > 0 || !isRunning; });
+    idleWorkers--;
+  }
+}
@@ -1,7 +1,90 @@
 #include "proto/NanoPBHelper.h"
 
+#include <array>
+
 using namespace nanopb_helper;
 
+namespace {
+// Maps base64 characters to their 6 bit values, -1 for anything else
+constexpr std::array<int8_t, 256> base64DecodeTable = [] {
+  std::array<int8_t, 256> table{};
+  for (auto& value : table) {
+    value = -1;
+  }
+
+  constexpr std::string_view alphabet =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  for (size_t i = 0; i < alphabet.size(); i++) {
+    table[static_cast<uint8_t>(alphabet[i])] = static_cast<int8_t>(i);
+  }
+  return table;
+}();
+
+bool base64StreamRead(pb_istream_t* stream, pb_byte_t* buf, size_t count) {
+  auto* state = static_cast<Base64StreamState*>(stream->state);
+
+  for (size_t i = 0; i < count; i++) {
+    while (state->bitCount < 8) {
+      if (state->next == state->end) {
+        PB_RETURN_ERROR(stream, "base64 input ended");
+      }
+
+      int8_t value = base64DecodeTable[static_cast<uint8_t>(*state->next++)];
+      if (value < 0) {
+        PB_RETURN_ERROR(stream, "invalid base64 character");
+      }
+
+      state->bits = (state->bits << 6) | static_cast<uint32_t>(value);
+      state->bitCount += 6;
+    }
+
+    state->bitCount -= 8;
+    buf[i] = static_cast<pb_byte_t>(state->bits >> state->bitCount);
+    state->bits &= (1u << state->bitCount) - 1;
+  }
+
+  return true;
+}
+}  // namespace
+
+pb_istream_t nanopb_helper::pbIstreamFromBase64(std::string_view encoded,
+                                                Base64StreamState& state) {
+  // Padding carries no data
+  while (!encoded.empty() && encoded.back() == '=') {
+    encoded.remove_suffix(1);
+  }
+
+  state = Base64StreamState{encoded.data(), encoded.data() + encoded.size()};
+
+  pb_istream_t stream;
+  stream.callback = &base64StreamRead;
+  stream.state = &state;
+
+  // Every character carries 6 bits, leftover bits are padding
+  stream.bytes_left = encoded.size() * 6 / 8;
+#ifndef PB_NO_ERRMSG
+  stream.errmsg = nullptr;
+#endif
+  return stream;
+}
+
+bool nanopb_helper::appendVarintField(std::vector<uint8_t>& output,
+                                      uint32_t tag, uint64_t value) {
+  pb_ostream_t stream;
+  stream.callback = [](pb_ostream_t* stream, const pb_byte_t* buf,
+                       size_t count) -> bool {
+    auto* vec = static_cast<std::vector<uint8_t>*>(stream->state);
+    vec->insert(vec->end(), buf, buf + count);
+    return true;
+  };
+  stream.state = &output;
+  stream.max_size = SIZE_MAX;
+  stream.bytes_written = 0;
+
+  return pb_encode_tag(&stream, PB_WT_VARINT, tag) &&
+         pb_encode_varint(&stream, value);
+}
+
 bool nanopb_helper::pbDecodeString(pb_istream_t* stream,
                                    const pb_field_t* field, void** arg) {
   auto& str = *static_cast<std::string*>(*arg);
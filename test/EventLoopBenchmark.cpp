@@ -0,0 +1,117 @@
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include "events/EventLoop.h"
+#include "events/MPSCQueue.h"
+
+using namespace cspot;
+
+namespace {
+constexpr int producerCount = 4;
+constexpr int itemsPerProducer = 10000;
+
+// The unbounded mutex + deque queue EventLoop used before the MPSC ring
+template <typename T>
+class LockedQueue {
+ public:
+  bool tryEmplace(T value) {
+    std::scoped_lock lock(mutex);
+    items.push_back(std::move(value));
+    return true;
+  }
+
+  std::optional<T> tryPop() {
+    std::scoped_lock lock(mutex);
+    if (items.empty()) {
+      return std::nullopt;
+    }
+    T value = std::move(items.front());
+    items.pop_front();
+    return value;
+  }
+
+ private:
+  std::mutex mutex;
+  std::deque<T> items;
+};
+
+// Several producers push into the queue, one consumer drains it
+template <typename Queue>
+int runProducerConsumer(Queue& queue) {
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < producerCount; producer++) {
+    producers.emplace_back([&queue]() {
+      for (int i = 0; i < itemsPerProducer; i++) {
+        while (!queue.tryEmplace(i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  int received = 0;
+  while (received < producerCount * itemsPerProducer) {
+    if (queue.tryPop()) {
+      received++;
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  return received;
+}
+}  // namespace
+
+TEST_CASE("Event queue producer/consumer throughput", "[!benchmark]") {
+  BENCHMARK("MPSCQueue") {
+    MPSCQueue<int> queue(32);
+    return runProducerConsumer(queue);
+  };
+
+  BENCHMARK("Mutex + deque") {
+    LockedQueue<int> queue;
+    return runProducerConsumer(queue);
+  };
+
+  EventLoop eventLoop;
+  std::atomic<int> dispatched = 0;
+  eventLoop.registerHandler(EventLoop::EventType::DEALER_MESSAGE,
+                            [&](EventLoop::Event&&) { dispatched++; });
+  eventLoop.setQueuePolicy(EventLoop::EventType::DEALER_MESSAGE, 32,
+                           EventLoop::OverflowPolicy::BLOCK);
+
+  // Post to dispatch, producers wait for the loop whenever the lane is full
+  BENCHMARK("EventLoop post to dispatch") {
+    dispatched = 0;
+    std::atomic<int> posted = 0;
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < producerCount; producer++) {
+      producers.emplace_back([&eventLoop, &posted]() {
+        for (int i = 0; i < itemsPerProducer; i++) {
+          if (eventLoop.post(EventLoop::EventType::DEALER_MESSAGE,
+                             PayloadBuffer())) {
+            posted++;
+          }
+        }
+      });
+    }
+
+    for (auto& producer : producers) {
+      producer.join();
+    }
+    while (dispatched < posted) {
+      std::this_thread::yield();
+    }
+    return posted.load();
+  };
+}
@@ -0,0 +1,343 @@
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include "events/EventLoop.h"
+#include "events/MPSCQueue.h"
+
+using namespace cspot;
+
+namespace {
+// Waits until the predicate holds, gives up after a second
+template <typename Predicate>
+bool waitFor(Predicate predicate) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (!predicate()) {
+    if (std::chrono::steady_clock::now() > deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+// Keeps the loop thread busy in a callback, until released
+class LoopBlocker {
+ public:
+  explicit LoopBlocker(EventLoop& eventLoop) {
+    auto released = release.get_future().share();
+    eventLoop.postCallback([this, released]() {
+      isBlocking = true;
+      released.wait();
+    });
+    REQUIRE(waitFor([this]() { return isBlocking.load(); }));
+  }
+
+  ~LoopBlocker() { unblock(); }
+
+  void unblock() {
+    if (!isReleased) {
+      isReleased = true;
+      release.set_value();
+    }
+  }
+
+ private:
+  std::promise<void> release;
+  std::atomic<bool> isBlocking = false;
+  bool isReleased = false;
+};
+
+PayloadBuffer makePayload(const std::string& text) {
+  return PayloadBuffer::copyFrom(text.data(), text.size());
+}
+
+std::string payloadText(const EventLoop::Event& event) {
+  return std::string(std::get<PayloadBuffer>(event.payload).view());
+}
+}  // namespace
+
+TEST_CASE("MPSCQueue rounds its capacity up to a power of two", "[events]") {
+  MPSCQueue<int> queue(5);
+  REQUIRE(queue.capacity() == 8);
+}
+
+TEST_CASE("MPSCQueue pops in FIFO order", "[events]") {
+  MPSCQueue<int> queue(4);
+  REQUIRE(queue.empty());
+
+  for (int i = 0; i < 4; i++) {
+    REQUIRE(queue.tryEmplace(i));
+  }
+  REQUIRE_FALSE(queue.tryEmplace(4));
+
+  for (int i = 0; i < 4; i++) {
+    auto value = queue.tryPop();
+    REQUIRE(value.has_value());
+    REQUIRE(*value == i);
+  }
+  REQUIRE_FALSE(queue.tryPop().has_value());
+  REQUIRE(queue.empty());
+}
+
+TEST_CASE("MPSCQueue leaves the argument alone when full", "[events]") {
+  MPSCQueue<std::string> queue(2);
+  REQUIRE(queue.tryEmplace("a"));
+  REQUIRE(queue.tryEmplace("b"));
+
+  std::string rejected = "kept";
+  REQUIRE_FALSE(queue.tryEmplace(std::move(rejected)));
+  REQUIRE(rejected == "kept");
+}
+
+TEST_CASE("MPSCQueue keeps the order of every producer", "[events]") {
+  constexpr int producerCount = 4;
+  constexpr int itemsPerProducer = 20000;
+  MPSCQueue<std::pair<int, int>> queue(64);
+
+  std::vector<std::thread> producers;
+  for (int producer = 0; producer < producerCount; producer++) {
+    producers.emplace_back([&queue, producer]() {
+      for (int i = 0; i < itemsPerProducer; i++) {
+        while (!queue.tryEmplace(producer, i)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<int> nextExpected(producerCount, 0);
+  int received = 0;
+  bool isOrdered = true;
+  while (received < producerCount * itemsPerProducer) {
+    auto item = queue.tryPop();
+    if (!item) {
+      std::this_thread::yield();
+      continue;
+    }
+    isOrdered = isOrdered && item->second == nextExpected[item->first];
+    nextExpected[item->first] = item->second + 1;
+    received++;
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+
+  REQUIRE(isOrdered);
+  REQUIRE_FALSE(queue.tryPop().has_value());
+}
+
+TEST_CASE("EventLoop dispatches posted events to every handler", "[events]") {
+  EventLoop eventLoop;
+  std::atomic<int> firstCount = 0;
+  std::atomic<int> secondCount = 0;
+
+  eventLoop.registerHandler(EventLoop::EventType::DEALER_MESSAGE,
+                            [&](EventLoop::Event&& event) {
+                              if (payloadText(event) == "hello") {
+                                firstCount++;
+                              }
+                            });
+  eventLoop.registerHandler(EventLoop::EventType::DEALER_MESSAGE,
+                            [&](EventLoop::Event&& event) {
+                              if (payloadText(event) == "hello") {
+                                secondCount++;
+                              }
+                            });
+
+  REQUIRE(eventLoop.post(EventLoop::EventType::DEALER_MESSAGE,
+                         makePayload("hello")));
+  REQUIRE(waitFor([&]() { return firstCount == 1 && secondCount == 1; }));
+}
+
+TEST_CASE("EventLoop runs callbacks on the loop thread", "[events]") {
+  EventLoop eventLoop;
+  std::promise<std::thread::id> callbackThread;
+
+  eventLoop.postCallback([&]() {
+    callbackThread.set_value(std::this_thread::get_id());
+  });
+
+  auto future = callbackThread.get_future();
+  REQUIRE(future.wait_for(std::chrono::seconds(1)) ==
+          std::future_status::ready);
+  REQUIRE(future.get() != std::this_thread::get_id());
+}
+
+TEST_CASE("EventLoop counts events dropped on overflow", "[events]") {
+  EventLoop eventLoop;
+  std::vector<std::string> received;
+  std::atomic<int> receivedCount = 0;
+  eventLoop.registerHandler(EventLoop::EventType::DEALER_MESSAGE,
+                            [&](EventLoop::Event&& event) {
+                              received.push_back(payloadText(event));
+                              receivedCount++;
+                            });
+
+  SECTION("DROP_NEWEST rejects the posted event") {
+    eventLoop.setQueuePolicy(EventLoop::EventType::DEALER_MESSAGE, 2,
+                             EventLoop::OverflowPolicy::DROP_NEWEST);
+    {
+      LoopBlocker blocker(eventLoop);
+      REQUIRE(eventLoop.post(EventLoop::EventType::DEALER_MESSAGE,
+                             makePayload("a")));
+      REQUIRE(eventLoop.post(EventLoop::EventType::DEALER_MESSAGE,
+                             makePayload("b")));
+      REQUIRE_FALSE(eventLoop.post(EventLoop::EventType::DEALER_MESSAGE,
+                                   makePayload("c")));
+
+      auto stats =
+          eventLoop.getQueueStats(EventLoop::EventType::DEALER_MESSAGE);
+      REQUIRE(stats.queued == 2);
+      REQUIRE(stats.dropped == 1);
+    }
+
+    REQUIRE(waitFor([&]() { return receivedCount == 2; }));
+    REQUIRE(received == std::vector<std::string>{"a", "b"});
+  }
+
+  SECTION("DROP_OLDEST discards the oldest queued event") {
+    eventLoop.setQueuePolicy(EventLoop::EventType::DEALER_MESSAGE, 2,
+                             EventLoop::OverflowPolicy::DROP_OLDEST);
+    {
+      LoopBlocker blocker(eventLoop);
+      for (auto text : {"a", "b", "c"}) {
+        REQUIRE(eventLoop.post(EventLoop::EventType::DEALER_MESSAGE,
+                               makePayload(text)));
+      }
+    }
+
+    REQUIRE(waitFor([&]() { return receivedCount == 2; }));
+    REQUIRE(received == std::vector<std::string>{"b", "c"});
+    REQUIRE(eventLoop.getQueueStats(EventLoop::EventType::DEALER_MESSAGE)
+                .dropped == 1);
+  }
+}
+
+TEST_CASE("EventLoop never drops callbacks", "[events]") {
+  EventLoop eventLoop(4);
+  std::vector<int> order;
+  std::atomic<int> orderCount = 0;
+
+  SECTION("Posted from another thread") {
+    {
+      // Far more callbacks than the lane holds, the rest spills over
+      LoopBlocker blocker(eventLoop);
+      for (int i = 0; i < 64; i++) {
+        eventLoop.postCallback([&, i]() {
+          order.push_back(i);
+          orderCount++;
+        });
+      }
+    }
+
+    REQUIRE(waitFor([&]() { return orderCount == 64; }));
+    for (int i = 0; i < 64; i++) {
+      REQUIRE(order[i] == i);
+    }
+  }
+
+  SECTION("Posted from the loop thread") {
+    eventLoop.postCallback([&]() {
+      for (int i = 0; i < 64; i++) {
+        eventLoop.postCallback([&, i]() {
+          order.push_back(i);
+          orderCount++;
+        });
+      }
+    });
+
+    REQUIRE(waitFor([&]() { return orderCount == 64; }));
+    for (int i = 0; i < 64; i++) {
+      REQUIRE(order[i] == i);
+    }
+  }
+
+  REQUIRE(eventLoop.getQueueStats(EventLoop::EventType::CALLBACK).dropped ==
+          0);
+}
+
+TEST_CASE("EventLoop serves higher priority lanes first", "[events]") {
+  EventLoop eventLoop;
+  std::vector<std::string> order;
+  std::atomic<int> orderCount = 0;
+  auto record = [&](const char* name) {
+    return [&, name]() {
+      order.push_back(name);
+      orderCount++;
+    };
+  };
+
+  {
+    LoopBlocker blocker(eventLoop);
+    eventLoop.postCallback(record("background"),
+                           EventLoop::Priority::BACKGROUND);
+    eventLoop.postCallback(record("state"), EventLoop::Priority::STATE);
+    eventLoop.postCallback(record("control"), EventLoop::Priority::CONTROL);
+  }
+
+  REQUIRE(waitFor([&]() { return orderCount == 3; }));
+  REQUIRE(order ==
+          std::vector<std::string>{"control", "state", "background"});
+}
+
+TEST_CASE("Cancelling a timer releases its payload right away", "[events]") {
+  EventLoop eventLoop;
+  auto captured = std::make_shared<int>(0);
+  std::weak_ptr<int> watcher = captured;
+
+  EventLoop::Callback callback = [captured = std::move(captured)]() {
+    (*captured)++;
+  };
+  auto handle = eventLoop.postDelayed(EventLoop::EventType::CALLBACK,
+                                      std::move(callback), 60 * 1000);
+  REQUIRE_FALSE(watcher.expired());
+
+  handle.cancel();
+  REQUIRE(watcher.expired());
+}
+
+TEST_CASE("Expired timers are coalesced like posted events", "[events]") {
+  EventLoop eventLoop;
+  std::atomic<int> updates = 0;
+  eventLoop.registerHandler(EventLoop::EventType::TRACKPROVIDER_UPDATED,
+                            [&](EventLoop::Event&&) { updates++; });
+
+  {
+    // Both timers expire while the loop is busy, and reach it together
+    LoopBlocker blocker(eventLoop);
+    eventLoop.postDelayed(EventLoop::EventType::TRACKPROVIDER_UPDATED,
+                          std::monostate(), 1);
+    eventLoop.postDelayed(EventLoop::EventType::TRACKPROVIDER_UPDATED,
+                          std::monostate(), 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+
+  REQUIRE(waitFor([&]() { return updates > 0; }));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  REQUIRE(updates == 1);
+}
+
+TEST_CASE("Replaced handler tables are freed", "[events]") {
+  EventLoop eventLoop;
+  auto captured = std::make_shared<int>(0);
+  std::weak_ptr<int> watcher = captured;
+
+  eventLoop.registerHandler(
+      EventLoop::EventType::DEALER_MESSAGE,
+      [captured = std::move(captured)](EventLoop::Event&&) { (*captured)++; });
+  eventLoop.setCoalescing(EventLoop::EventType::DEALER_MESSAGE,
+                          EventLoop::Coalescing::NONE);
+  REQUIRE_FALSE(watcher.expired());
+
+  // Only the tables holding the handler referenced it
+  eventLoop.unregisterHandler(EventLoop::EventType::DEALER_MESSAGE);
+  REQUIRE(watcher.expired());
+}
@@ -0,0 +1,36 @@
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+#include <catch2/catch_test_macros.hpp>
+
+#include "events/EventLoop.h"
+#include "events/WorkerPool.h"
+
+using namespace cspot;
+
+TEST_CASE("WorkerPool runs queued jobs before shutting down", "[events]") {
+  auto eventLoop = std::make_shared<EventLoop>();
+  std::atomic<int> jobsRun = 0;
+  std::atomic<int> completionsRun = 0;
+
+  {
+    WorkerPool workerPool(eventLoop, 2);
+    for (int i = 0; i < 50; i++) {
+      workerPool.submit(
+          [&jobsRun]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            jobsRun++;
+          },
+          [&completionsRun]() { completionsRun++; });
+    }
+  }
+  REQUIRE(jobsRun == 50);
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  while (completionsRun < 50 && std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  REQUIRE(completionsRun == 50);
+}